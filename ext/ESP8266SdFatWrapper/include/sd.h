@@ -18,6 +18,8 @@ int sd_read(int fd, void *buf, size_t count);
 int sd_write(int fd, void *buf, size_t count);
 int sd_seek(int fd, int32_t offset, int whence);
 uint32_t sd_tell(int fd);
+int sd_preallocate(int fd, uint32_t size);
+int sd_contiguous_range(int fd, uint32_t *first_sector, uint32_t *last_sector);
 
 int sd_filesize(int fd);
 int sd_mkdir(const char *path);
@@ -33,6 +35,8 @@ int sd_fd_is_open(int fd);
 
 bool sd_read_sector(uint32_t sector, uint8_t* dst);
 bool sd_write_sector(uint32_t sector, const uint8_t* src);
+bool sd_read_sectors(uint32_t sector, uint8_t* dst, size_t count);
+bool sd_write_sectors(uint32_t sector, const uint8_t* src, size_t count);
 
 /**
  * Force a sync of the SD card cache to ensure all pending writes are committed
@@ -140,6 +140,24 @@ extern "C" uint32_t sd_tell(int fd) {
     return (uint32_t)files[fd].curPosition();
 }
 
+extern "C" int sd_preallocate(int fd, uint32_t size) {
+    CHECK_FD(fd);
+
+    return files[fd].preAllocate(size) != true;
+}
+
+extern "C" int sd_contiguous_range(int fd, uint32_t *first_sector, uint32_t *last_sector) {
+    CHECK_FD(fd);
+
+    Sector_t first, last;
+    if (!files[fd].contiguousRange(&first, &last))
+        return 1;
+
+    *first_sector = (uint32_t)first;
+    *last_sector = (uint32_t)last;
+    return 0;
+}
+
 extern "C" int sd_mkdir(const char *path) {
     if (sd_exists(path)) {
         /* return 0 if the directory already exists */
@@ -207,6 +225,22 @@ extern "C" bool sd_write_sector(uint32_t sector, const uint8_t* src) {
     return sd.card()->writeSector(sector, src);
 }
 
+extern "C" bool sd_read_sectors(uint32_t sector, uint8_t* dst, size_t count) {
+    while (sd.card()->isBusy()) {
+        // Wait until the card is ready
+        tight_loop_contents();
+    }
+    return sd.card()->readSectors(sector, dst, count);
+}
+
+extern "C" bool sd_write_sectors(uint32_t sector, const uint8_t* src, size_t count) {
+    while (sd.card()->isBusy()) {
+        // Wait until the card is ready
+        tight_loop_contents();
+    }
+    return sd.card()->writeSectors(sector, src, count);
+}
+
 extern "C" bool sd_sync_cache(void) {
     // This function must only be called from Core 0
     if (get_core_num() != 0) {
@@ -1,4 +1,3 @@
 #include "bigmem.h"
 
-bigmem_t bigmem;
-uint8_t cache[CACHE_SIZE];
\ No newline at end of file
+uint8_t cache[CACHE_SIZE] __attribute__((aligned(4)));
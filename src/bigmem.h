@@ -1,16 +1,19 @@
 #include <inttypes.h>
 #include <stdint.h>
 
-#define CACHE_SIZE  512 * 45
+/*
+* Read cache of card pages, sized to what is left of the 256 KB main SRAM.
+* The other large static buffers, to be checked whenever one of them grows:
+*   UI and debug: LVGL pool 36 KB, draw buffer 8 KB, debug queue 4 KB
+*   card (41.5 KB): load chunks 16 KB, flush run 8 KB, sector bitmaps 6 KB,
+*         page slots and write combining 4.5 KB, dirty ring 2 KB, journal 1 KB,
+*         unlock table 1.5 KB
+*   MMCE (38 KB): block rings 16.5 KB, SD cache 10.5 KB, write-behind 9 KB,
+*         file commands 1.5 KB
+* That is about 128 KB, with these 52 KB some 76 KB remain for code run
+* from RAM, SDK and SdFat data. Debug builds print what is actually left
+* at boot, the link fails with "region RAM overflowed" if it is negative.
+*/
+#define CACHE_SIZE  512 * 104
 
-typedef union {
-    struct {
-        uint16_t dirty_heap[8 * 1024 * 1024 / 512];
-        uint8_t dirty_map[8 * 1024 * 1024 / 512 / 8];
-    } gc;
-
-} bigmem_t;
-
-
-extern bigmem_t bigmem;
 extern uint8_t cache[CACHE_SIZE];
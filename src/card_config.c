@@ -25,6 +25,9 @@ typedef struct {
     size_t channel_name_max_len;
     uint8_t card_size;
     uint8_t max_channels;
+    uint16_t flush_lockout;
+    uint16_t flush_time_slice;
+    uint16_t latency;
 } parse_card_config_t;
 
 typedef struct {
@@ -75,6 +78,21 @@ static int parse_card_configuration(void *user, const char *section, const char
         if (max_channels > 0) {
             ctx->max_channels = max_channels;
         }
+    } else if (MATCH("Settings", "FlushLockout")) {
+        int lockout = atoi(value);
+        if ((lockout > 0) && (lockout <= 10000)) {
+            ctx->flush_lockout = (uint16_t)lockout;
+        }
+    } else if (MATCH("Settings", "FlushTimeSlice")) {
+        int time_slice = atoi(value);
+        if ((time_slice > 0) && (time_slice <= 1000)) {
+            ctx->flush_time_slice = (uint16_t)time_slice;
+        }
+    } else if (MATCH("Settings", "Latency")) {
+        int latency = atoi(value);
+        if ((latency >= 4) && (latency <= 512) && ((latency & (latency - 1)) == 0)) {
+            ctx->latency = (uint16_t)latency;
+        }
     }
     #undef MATCH
 
@@ -100,7 +118,10 @@ void card_config_read_channel_name(const char* card_folder, const char* card_bas
             .channel_name = name,
             .channel_name_max_len = name_max_len,
             .card_size = 0,
-            .max_channels = 8
+            .max_channels = 8,
+            .flush_lockout = 0,
+            .flush_time_slice = 0,
+            .latency = 0
         };
         ini_parse_sd_file(fd, parse_card_configuration, &ctx);
         sd_close(fd);
@@ -115,7 +136,10 @@ uint8_t card_config_get_gc_cardsize(const char* card_folder, const char* card_ba
         .channel_name = NULL,
         .channel_name_max_len = 0,
         .card_size = 0,
-        .max_channels = 8
+        .max_channels = 8,
+        .flush_lockout = 0,
+        .flush_time_slice = 0,
+        .latency = 0
     };
 
     card_config_get_ini_name(card_folder, card_base, config_path);
@@ -136,7 +160,10 @@ uint8_t card_config_get_max_channels(const char* card_folder, const char* card_b
         .channel_name = NULL,
         .channel_name_max_len = 0,
         .card_size = 0,
-        .max_channels = 8
+        .max_channels = 8,
+        .flush_lockout = 0,
+        .flush_time_slice = 0,
+        .latency = 0
     };
 
     card_config_get_ini_name(card_folder, card_base, config_path);
@@ -151,6 +178,57 @@ uint8_t card_config_get_max_channels(const char* card_folder, const char* card_b
     return ctx.max_channels;
 }
 
+void card_config_get_flush_policy(const char* card_folder, const char* card_base, uint16_t* lockout_ms, uint16_t* time_slice_ms) {
+    char config_path[MAX_CFG_PATH_LENGTH];
+    int fd;
+    parse_card_config_t ctx = {
+        .channel_number = NULL,
+        .channel_name = NULL,
+        .channel_name_max_len = 0,
+        .card_size = 0,
+        .max_channels = 8,
+        .flush_lockout = 0,
+        .flush_time_slice = 0,
+        .latency = 0
+    };
+
+    card_config_get_ini_name(card_folder, card_base, config_path);
+
+    fd = sd_open(config_path, O_RDONLY);
+    if (fd >= 0) {
+        ini_parse_sd_file(fd, parse_card_configuration, &ctx);
+        sd_close(fd);
+    }
+    log(LOG_TRACE, "flush_lockout=%u flush_time_slice=%u\n", ctx.flush_lockout, ctx.flush_time_slice);
+    *lockout_ms = ctx.flush_lockout;
+    *time_slice_ms = ctx.flush_time_slice;
+}
+
+uint16_t card_config_get_gc_latency(const char* card_folder, const char* card_base) {
+    char config_path[MAX_CFG_PATH_LENGTH];
+    int fd;
+    parse_card_config_t ctx = {
+        .channel_number = NULL,
+        .channel_name = NULL,
+        .channel_name_max_len = 0,
+        .card_size = 0,
+        .max_channels = 8,
+        .flush_lockout = 0,
+        .flush_time_slice = 0,
+        .latency = 0
+    };
+
+    card_config_get_ini_name(card_folder, card_base, config_path);
+
+    fd = sd_open(config_path, O_RDONLY);
+    if (fd >= 0) {
+        ini_parse_sd_file(fd, parse_card_configuration, &ctx);
+        sd_close(fd);
+    }
+    log(LOG_TRACE, "latency=%u\n", ctx.latency);
+    return ctx.latency;
+}
+
 bool card_config_read_image(uint8_t buff[1032], const char* card_folder, const char* card_base, int chan_idx) {
     char image_path[64];
     int fd;
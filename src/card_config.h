@@ -7,5 +7,7 @@
 void card_config_read_channel_name(const char* card_folder, const char* card_base, const char* channel_number, char* name, size_t name_max_len);
 uint8_t card_config_get_max_channels(const char* card_folder, const char* card_base);
 uint8_t card_config_get_gc_cardsize(const char* card_folder, const char* card_base);
+void card_config_get_flush_policy(const char* card_folder, const char* card_base, uint16_t* lockout_ms, uint16_t* time_slice_ms);
+uint16_t card_config_get_gc_latency(const char* card_folder, const char* card_base);
 void card_config_get_card_folder(const char* game_id, char* card_folder, size_t card_folder_max_len);
 bool card_config_read_image(uint8_t buff[1032], const char* card_folder, const char* card_base, int chan_idx);
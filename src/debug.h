@@ -12,6 +12,7 @@
 #define LOG_LEVEL_GC_MC      2
 #define LOG_LEVEL_GC_UL      2
 #define LOG_LEVEL_GC_MAIN    2
+#define LOG_LEVEL_GC_JNL     2
 
 #define LOG_ERROR 1
 #define LOG_WARN 2
@@ -1,6 +1,7 @@
 
 #include "mmceman/gc_mmceman.h"
 #include "mmceman/gc_mmceman_block_commands.h"
+#include "mmceman/gc_mmceman_fs_commands.h"
 #include "pico/multicore.h"
 #if WITH_GUI
 #include "gui.h"
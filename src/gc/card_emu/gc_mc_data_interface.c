@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "hardware/timer.h"
 #include "pico/critical_section.h"
 #include "pico/platform.h"
 #include "gc_mc_data_interface.h"
@@ -23,59 +24,273 @@
 #define log(level, fmt, x...) LOG_PRINT(LOG_LEVEL_MC_DATA, level, fmt, ##x)
 #endif
 
-#define READ_CACHE      3
+#define READ_CACHE      (CACHE_SIZE / GC_PAGE_SIZE)
 
-#define MAX_READ_AHEAD  1
+/* header, directory and FAT blocks - re-read by the cube all the time */
+#define HOT_PAGES       (5 * GC_MC_SECTOR_SIZE / GC_PAGE_SIZE)
+#define HOT_BONUS       (2 * READ_CACHE)
+
+/* number of consecutive pages fetched into spare slots after serving a read */
+#define MAX_READ_AHEAD  2
 
 #define MAX_TIME_SLICE  ( 5 * 1000 )
 
+/*
+* The cube writes a page in 128 byte pieces. They are combined in SRAM and go to
+* PSRAM in one transfer once the page is complete, another page is written, the
+* page is erased, or the card was left alone for WC_IDLE_US. Reads of the page
+* are served with the pieces merged in.
+*/
+#define WC_PIECE        ( 128 )
+#define WC_PIECES       ( GC_PAGE_SIZE / WC_PIECE )
+#define WC_FULL         ( (1U << WC_PIECES) - 1U )
+#define WC_IDLE_US      ( 2000 )
+
 static volatile bool dma_in_progress = false;
+static volatile gc_mcdi_page_t* volatile dma_page;
 
 static volatile gc_mcdi_page_t      readpages[READ_CACHE];
+static volatile gc_mcdi_page_t*     current_page[NUM_CORES];
 static volatile bool                 write_occured;
 static volatile bool                 busy_cycle;
 static critical_section_t            crit;
 
+/* erased pages are served from here, without touching PSRAM */
+static volatile gc_mcdi_page_t      erased_page;
+static uint8_t                       erased_data[GC_PAGE_SIZE] __attribute__((aligned(4)));
+
+static uint32_t                      use_clock;
+static volatile uint32_t             cache_hits, cache_misses, read_ahead_hits;
+static volatile uint32_t             read_ahead_next, read_ahead_end;
+/* number of times core 1 found the PSRAM taken by core 0 */
+static volatile uint32_t             contention;
 
-static void gc_mc_data_interface_invalidate_read(void);
+static uint8_t                       wc_data[GC_PAGE_SIZE] __attribute__((aligned(4)));
+static uint32_t                      wc_page;
+/* pieces of wc_page held in wc_data, 0 - nothing pending */
+static uint8_t                       wc_mask;
+static uint32_t                      wc_last_write;
+static volatile uint32_t             wc_writes, wc_commits;
 
 
 static void __time_critical_func(gc_mc_data_interface_rx_done)() {
+    if (dma_page->page_state == PAGE_READ_AHEAD_REQ)
+        dma_page->page_state = PAGE_READ_AHEAD_AVAILABLE;
     dma_in_progress = false;
-    gc_dirty_unlock();
 }
 
-void __time_critical_func(gc_mc_data_interface_start_dma)(volatile gc_mcdi_page_t* page_p) {
-    gc_dirty_lockout_renew();
-    /* the spinlock will be unlocked by the DMA irq once all data is tx'd */
-    gc_dirty_lock();
+/* waits for the PSRAM to become idle, counting the times a transfer of core 0 was in the way */
+static void __time_critical_func(gc_mc_data_interface_wait_psram)(void) {
+    if (!dma_in_progress && psram_dma_active())
+        contention++;
     psram_wait_for_dma();
+}
+
+static void __time_critical_func(gc_mc_data_interface_start_dma)(volatile gc_mcdi_page_t* page_p) {
+    gc_mc_data_interface_wait_psram();
+    dma_page = page_p;
     dma_in_progress = true;
-    page_p->page_state = PAGE_DATA_AVAILABLE;
     psram_read_dma(page_p->page * GC_PAGE_SIZE, page_p->data, GC_PAGE_SIZE, gc_mc_data_interface_rx_done);
     log(LOG_INFO, "%s start dma %zu\n", __func__, page_p->page);
     busy_cycle = true;
 }
 
+/* writes the combined pieces to PSRAM, after that core 0 may flush the page */
+static void __time_critical_func(gc_mc_data_interface_wc_commit)(void) {
+    uint32_t base = wc_page * GC_PAGE_SIZE;
 
+    if (wc_mask == 0)
+        return;
 
-void __time_critical_func(gc_mc_data_interface_setup_read_page)(uint32_t page, bool wait) {
+    gc_mc_data_interface_wait_psram();
 
-    if (page * GC_PAGE_SIZE + GC_PAGE_SIZE <= gc_cardman_get_card_size()) {
+    /* first write after an erase, the rest of the page has to exist in PSRAM now */
+    bool erased = gc_cardman_is_segment_erased(wc_page);
+    if (erased && (wc_mask != WC_FULL)) {
+        psram_fill_dma(base, 0xFF, GC_PAGE_SIZE, NULL);
+        psram_wait_for_dma();
+    }
 
-        volatile gc_mcdi_page_t* page_p = &readpages[get_core_num()];
+    /* runs of consecutive pieces, usually the whole page at once */
+    for (uint32_t i = 0; i < WC_PIECES; ) {
+        uint32_t n = 0;
+        while ((i + n < WC_PIECES) && (wc_mask & (1U << (i + n))))
+            n++;
+        if (n == 0) {
+            i++;
+            continue;
+        }
+        psram_write_dma(base + i * WC_PIECE, &wc_data[i * WC_PIECE], n * WC_PIECE, NULL);
+        psram_wait_for_dma();
+        i += n;
+    }
+
+    if (erased)
+        gc_cardman_clear_segment_erased(wc_page);
+    /* only once the data is in PSRAM, core 0 may pick it up right away */
+    gc_dirty_mark(wc_page);
+    wc_mask = 0;
+    wc_commits++;
+}
+
+static volatile gc_mcdi_page_t* __time_critical_func(gc_mc_data_interface_lookup)(uint32_t page) {
+    for (int i = 0; i < READ_CACHE; i++) {
+        if ((readpages[i].page_state >= PAGE_DATA_AVAILABLE || readpages[i].page_state == PAGE_READ_AHEAD_REQ)
+            && (readpages[i].page == page))
+            return &readpages[i];
+    }
+    return NULL;
+}
 
-        log(LOG_TRACE, "%s Waiting page %u - State: %u\n", __func__, page, page_p->page_state);
+/* least recently used slot, with pages of the system area being kept around longer */
+static volatile gc_mcdi_page_t* __time_critical_func(gc_mc_data_interface_evict)(void) {
+    volatile gc_mcdi_page_t* victim = NULL;
+    uint32_t victim_score = UINT32_MAX;
 
-        critical_section_enter_blocking(&crit);
+    for (int i = 0; i < READ_CACHE; i++) {
+        if (readpages[i].page_state == PAGE_EMPTY)
+            return &readpages[i];
+
+        if (&readpages[i] == current_page[get_core_num()])
+            continue;
+
+        uint32_t score = readpages[i].last_use + ((readpages[i].page < HOT_PAGES) ? HOT_BONUS : 0);
+        if (score < victim_score) {
+            victim = &readpages[i];
+            victim_score = score;
+        }
+    }
+    return victim;
+}
+
+/*
+* Issues the next pending read-ahead page, if the PSRAM is free.
+* Never blocks, core 0 using the PSRAM means we just try again later.
+*/
+void __time_critical_func(gc_mc_data_interface_read_ahead)(void) {
+    while (!dma_in_progress && (read_ahead_next < read_ahead_end)) {
+        uint32_t page = read_ahead_next;
+
+        if ((page * GC_PAGE_SIZE + GC_PAGE_SIZE > gc_cardman_get_card_size())
+            || !gc_cardman_is_segment_available(page)) {
+            read_ahead_end = page;
+            return;
+        }
+
+        /* a page with pieces still in wc_data would be read stale */
+        if (gc_cardman_is_segment_erased(page) || gc_mc_data_interface_lookup(page)
+            || (wc_mask && (page == wc_page))) {
+            read_ahead_next = page + 1;
+            continue;
+        }
+
+        if (psram_dma_active())
+            return;
+
+        volatile gc_mcdi_page_t* page_p = gc_mc_data_interface_evict();
         page_p->page = page;
-        page_p->page_state = PAGE_READ_REQ;
-        critical_section_exit(&crit);
+        page_p->page_state = PAGE_READ_AHEAD_REQ;
+        page_p->last_use = use_clock;
+        read_ahead_next = page + 1;
 
+        gc_dirty_lockout_renew();
         gc_mc_data_interface_start_dma(page_p);
+        return;
+    }
+}
 
-        if (wait)
-            psram_wait_for_dma();
+/*
+* Serves the page being combined without committing it. A cached copy is kept
+* coherent by the writes, otherwise the page is put together in a free slot from
+* the erased pattern or PSRAM with the pending pieces on top.
+*/
+static void __time_critical_func(gc_mc_data_interface_wc_read)(uint32_t page, volatile gc_mcdi_page_t* page_p) {
+    if (page_p) {
+        cache_hits++;
+        page_p->last_use = ++use_clock;
+        current_page[get_core_num()] = page_p;
+        while (dma_in_progress && (dma_page == page_p)) {};
+        page_p->page_state = PAGE_DATA_AVAILABLE;
+        return;
+    }
+
+    cache_misses++;
+    page_p = gc_mc_data_interface_evict();
+    /* a read-ahead may still be filling the slot */
+    while (dma_in_progress && (dma_page == page_p)) {};
+
+    critical_section_enter_blocking(&crit);
+    page_p->page = page;
+    page_p->page_state = PAGE_DATA_AVAILABLE;
+    page_p->last_use = ++use_clock;
+    current_page[get_core_num()] = page_p;
+    critical_section_exit(&crit);
+
+    if (gc_cardman_is_segment_erased(page)) {
+        memset(page_p->data, 0xFF, GC_PAGE_SIZE);
+    } else {
+        gc_dirty_lockout_renew();
+        gc_mc_data_interface_start_dma(page_p);
+        psram_wait_for_dma();
+    }
+
+    for (uint32_t i = 0; i < WC_PIECES; i++) {
+        if (wc_mask & (1U << i))
+            memcpy(&page_p->data[i * WC_PIECE], &wc_data[i * WC_PIECE], WC_PIECE);
+    }
+}
+
+void __time_critical_func(gc_mc_data_interface_setup_read_page)(uint32_t page, bool wait) {
+
+    if (page * GC_PAGE_SIZE + GC_PAGE_SIZE <= gc_cardman_get_card_size()) {
+
+        volatile gc_mcdi_page_t* page_p = gc_mc_data_interface_lookup(page);
+
+        /* committing the page being combined would eat the read latency */
+        if (wc_mask && (page == wc_page)) {
+            gc_mc_data_interface_wc_read(page, page_p);
+        } else if (gc_cardman_is_segment_erased(page)) {
+            erased_page.page = page;
+            current_page[get_core_num()] = &erased_page;
+        } else if (page_p) {
+            cache_hits++;
+            page_p->last_use = ++use_clock;
+            current_page[get_core_num()] = page_p;
+
+            log(LOG_TRACE, "%s Hit page %u\n", __func__, page);
+
+            /* the slot may still be filled by a previous or read-ahead request, callers that
+               don't wait follow the fill with gc_mc_data_interface_bytes_available */
+            if (wait)
+                while (dma_in_progress && (dma_page == page_p)) {};
+
+            if (page_p->page_state != PAGE_DATA_AVAILABLE) {
+                read_ahead_hits++;
+                page_p->page_state = PAGE_DATA_AVAILABLE;
+            }
+        } else {
+            cache_misses++;
+            page_p = gc_mc_data_interface_evict();
+
+            log(LOG_TRACE, "%s Waiting page %u - State: %u\n", __func__, page, page_p->page_state);
+
+            gc_dirty_lockout_renew();
+
+            critical_section_enter_blocking(&crit);
+            page_p->page = page;
+            page_p->page_state = PAGE_DATA_AVAILABLE;
+            page_p->last_use = ++use_clock;
+            current_page[get_core_num()] = page_p;
+            critical_section_exit(&crit);
+
+            gc_mc_data_interface_start_dma(page_p);
+
+            if (wait)
+                psram_wait_for_dma();
+        }
+
+        read_ahead_next = page + 1;
+        read_ahead_end = page + 1 + MAX_READ_AHEAD;
 
     } else {
         log(LOG_WARN, "%s Addr out of bounds: %u\n", __func__, page);
@@ -84,22 +299,58 @@ void __time_critical_func(gc_mc_data_interface_setup_read_page)(uint32_t page, b
 
 volatile gc_mcdi_page_t* __time_critical_func(gc_mc_data_interface_get_page)(void) {
 
-    return &readpages[get_core_num()];
+    return current_page[get_core_num()];
 }
 
 void __time_critical_func(gc_mc_data_interface_write_mc)(uint32_t addr, void *buf, uint16_t length) {
     if ((addr + length) <= gc_cardman_get_card_size()) {
-        log(LOG_TRACE, "%s addr 0x%x (0x%x)\n", __func__, addr, (addr/GC_PAGE_SIZE));
-        gc_mc_data_interface_invalidate_read();
+        uint32_t page = addr / GC_PAGE_SIZE;
+        log(LOG_TRACE, "%s addr 0x%x (0x%x)\n", __func__, addr, page);
+
+        gc_dirty_lockout_renew_write();
+        if (wc_mask && (page != wc_page))
+            gc_mc_data_interface_wc_commit();
+
+        if ((length == WC_PIECE) && ((addr % WC_PIECE) == 0)) {
+            /* keep a cached copy of the page coherent, once a read-ahead into it is done */
+            volatile gc_mcdi_page_t* page_p = gc_mc_data_interface_lookup(page);
+            if (page_p) {
+                while (dma_in_progress && (dma_page == page_p)) {};
+                memcpy(&page_p->data[addr % GC_PAGE_SIZE], buf, length);
+            }
+
+            memcpy(&wc_data[addr % GC_PAGE_SIZE], buf, length);
+            wc_page = page;
+            wc_mask |= (uint8_t)(1U << ((addr % GC_PAGE_SIZE) / WC_PIECE));
+            wc_last_write = time_us_32();
+            wc_writes++;
+            write_occured = true;
+
+            if (wc_mask == WC_FULL)
+                gc_mc_data_interface_wc_commit();
+            return;
+        }
+
+        gc_mc_data_interface_wc_commit();
+        gc_mc_data_interface_wait_psram();
+
+        /* first write after an erase, the page has to exist in PSRAM now */
+        if (gc_cardman_is_segment_erased(addr / GC_PAGE_SIZE)) {
+            psram_fill_dma(addr & ~(uint32_t)(GC_PAGE_SIZE - 1), 0xFF, GC_PAGE_SIZE, NULL);
+            psram_wait_for_dma();
+            gc_cardman_clear_segment_erased(addr / GC_PAGE_SIZE);
+        }
 
-        psram_wait_for_dma();
-        gc_dirty_lockout_renew();
-        gc_dirty_lock();
         psram_write_dma(addr, buf, length, NULL);
+
+        /* keep a cached copy of the page coherent instead of dropping it */
+        volatile gc_mcdi_page_t* page_p = gc_mc_data_interface_lookup(addr / GC_PAGE_SIZE);
+        if (page_p)
+            memcpy(&page_p->data[addr % GC_PAGE_SIZE], buf, length);
+
         psram_wait_for_dma();
+        /* only once the data is in PSRAM, core 0 may pick it up right away */
         gc_dirty_mark(addr/GC_PAGE_SIZE);
-        gc_dirty_unlock();
-        gc_cardman_mark_segment_available(addr/GC_PAGE_SIZE);
         write_occured = true;
 
     }
@@ -111,47 +362,96 @@ void gc_mc_data_interface_flush(void) {
     }
 }
 
-void __time_critical_func(gc_mc_data_interface_erase)(uint32_t page) {
-    if ((page + ERASE_SECTORS) * GC_PAGE_SIZE <= gc_cardman_get_card_size()) {
+static void __time_critical_func(gc_mc_data_interface_invalidate)(uint32_t page, uint32_t count) {
+    for (int i = 0; i < READ_CACHE; i++) {
+        if ((readpages[i].page >= page) && (readpages[i].page < page + count))
+            readpages[i].page_state = PAGE_EMPTY;
+    }
+}
+
+/*
+* Erasing only flags the pages, reads of them are answered with 0xFF and
+* the first write fills the page in PSRAM. The flush writes 0xFF to SD.
+* Core 0 keeps the loader off the pages once it picks up the range.
+*/
+void __time_critical_func(gc_mc_data_interface_erase)(uint32_t addr) {
+    if (addr + ERASE_SECTORS * GC_PAGE_SIZE <= gc_cardman_get_card_size()) {
+        uint32_t page = addr / GC_PAGE_SIZE;
         log(LOG_TRACE, "%s page %u\n", __func__, page);
 
-        gc_mc_data_interface_invalidate_read();
+        gc_mc_data_interface_wc_commit();
 
-        uint8_t erasebuff[GC_PAGE_SIZE] = { 0 };
-        memset(erasebuff, 0xFF, GC_PAGE_SIZE);
-        gc_dirty_lockout_renew();
-        gc_dirty_lock();
-        for (int i = 0; i < ERASE_SECTORS; ++i) {
-            psram_write_dma(page + (uint32_t)(i * GC_PAGE_SIZE), erasebuff, GC_PAGE_SIZE, NULL);
-            psram_wait_for_dma();
-            gc_cardman_mark_segment_available(page + (uint32_t)(i * GC_PAGE_SIZE));
-            gc_dirty_mark((uint32_t)(page/GC_PAGE_SIZE + i));
-        }
-        gc_dirty_unlock();
+        gc_dirty_lockout_renew_write();
+        gc_cardman_mark_segments_erased(page, ERASE_SECTORS);
+        gc_mc_data_interface_invalidate(page, ERASE_SECTORS);
+        gc_dirty_mark_range(page, ERASE_SECTORS);
     }
 }
 
-inline void __time_critical_func(gc_mc_data_interface_wait_for_byte)(uint32_t offset) {
-    if (offset <= GC_PAGE_SIZE)
-        while (dma_in_progress && (psram_read_dma_remaining() >= (GC_PAGE_SIZE - offset))) {};
+void __time_critical_func(gc_mc_data_interface_erase_card)(void) {
+    uint32_t pages = gc_cardman_get_card_size() / GC_PAGE_SIZE;
+
+    gc_mc_data_interface_wc_commit();
+    gc_dirty_lockout_renew_write();
+    gc_cardman_mark_segments_erased(0, pages);
+    gc_mc_data_interface_invalidate(0, pages);
+    gc_dirty_mark_range(0, pages);
 }
 
-static void __time_critical_func (gc_mc_data_interface_invalidate_read)(void) {
+/* commits a partly written page once the cube has left the card alone for a while */
+void __time_critical_func(gc_mc_data_interface_write_combine_idle)(void) {
+    if (wc_mask && ((time_us_32() - wc_last_write) > WC_IDLE_US) && !psram_dma_active())
+        gc_mc_data_interface_wc_commit();
+}
 
-    critical_section_enter_blocking(&crit);
-    readpages[get_core_num()].page = 0;
-    readpages[get_core_num()].page_state = PAGE_EMPTY;
-    critical_section_exit(&crit);
+void __time_critical_func(gc_mc_data_interface_write_combine_flush)(void) {
+    gc_mc_data_interface_wc_commit();
+}
+
+/* number of leading bytes of the current page that are in its buffer already */
+uint32_t __time_critical_func(gc_mc_data_interface_bytes_available)(void) {
+    if (dma_in_progress && (dma_page == current_page[get_core_num()]))
+        return GC_PAGE_SIZE - psram_read_dma_remaining();
+    return GC_PAGE_SIZE;
+}
 
+inline void __time_critical_func(gc_mc_data_interface_wait_for_byte)(uint32_t offset) {
+    if (offset <= GC_PAGE_SIZE)
+        while (gc_mc_data_interface_bytes_available() <= offset) {};
 }
 
 // Core 0
 void gc_mc_data_interface_card_changed(void) {
+    if (cache_hits + cache_misses) {
+        DPRINTF("Read cache: %u hits (%u read-ahead), %u misses (%u%%)\n", cache_hits, read_ahead_hits, cache_misses,
+                (uint32_t)((100ULL * cache_hits) / (cache_hits + cache_misses)));
+    }
+    if (contention) {
+        DPRINTF("Core 1 waited on core 0 %u times\n", contention);
+    }
+    if (wc_writes) {
+        DPRINTF("Write combining: %u writes in %u PSRAM commits\n", wc_writes, wc_commits);
+    }
+
     for(int i = 0; i < READ_CACHE; i++) {
         readpages[i].page_state = PAGE_EMPTY;
         readpages[i].page = 0;
+        readpages[i].last_use = 0;
         readpages[i].data = &cache[i * GC_PAGE_SIZE];
     }
+    for (int i = 0; i < NUM_CORES; i++)
+        current_page[i] = &readpages[i];
+
+    memset(erased_data, 0xFF, sizeof(erased_data));
+    erased_page.page_state = PAGE_DATA_AVAILABLE;
+    erased_page.data = erased_data;
+
+    use_clock = 0;
+    cache_hits = cache_misses = read_ahead_hits = 0;
+    contention = 0;
+    read_ahead_next = read_ahead_end = 0;
+    wc_mask = 0;
+    wc_writes = wc_commits = 0;
 
 
     write_occured = false;
@@ -167,6 +467,11 @@ void gc_mc_data_interface_init(void) {
     gc_mc_data_interface_card_changed();
 }
 
+void gc_mc_data_interface_get_cache_stats(uint32_t *hits, uint32_t *misses) {
+    *hits = cache_hits;
+    *misses = cache_misses;
+}
+
 bool gc_mc_data_interface_write_occured(void) {
     return write_occured;
 }
@@ -19,21 +19,28 @@ typedef struct {
         PAGE_READ_AHEAD_AVAILABLE = 6,
     } page_state;
     uint8_t* data;
+    uint32_t last_use;
 } gc_mcdi_page_t;
 
 
 // Core 1
 
 void gc_mc_data_interface_setup_read_page(uint32_t page, bool wait);
+void gc_mc_data_interface_read_ahead(void);
 void gc_mc_data_interface_write_mc(uint32_t page, void *buf, uint16_t length);
-void gc_mc_data_interface_erase(uint32_t page);
+void gc_mc_data_interface_write_combine_idle(void);
+void gc_mc_data_interface_write_combine_flush(void);
+void gc_mc_data_interface_erase(uint32_t addr);
+void gc_mc_data_interface_erase_card(void);
 volatile gc_mcdi_page_t* gc_mc_data_interface_get_page(void);
+uint32_t gc_mc_data_interface_bytes_available(void);
 void gc_mc_data_interface_wait_for_byte(uint32_t offset);
 
 
 // Core 0
 void gc_mc_data_interface_card_changed(void);
 bool gc_mc_data_interface_write_occured(void);
+void gc_mc_data_interface_get_cache_stats(uint32_t *hits, uint32_t *misses);
 void gc_mc_data_interface_task(void);
 void gc_mc_data_interface_init(void);
 void gc_mc_data_interface_flush(void);
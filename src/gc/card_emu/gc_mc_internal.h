@@ -14,9 +14,13 @@
 extern uint DMA_WAIT_CHAN;
 extern uint DMA_WRITE_CHAN;
 extern uint DMA_BLOCK_READ_CHAN;
+extern uint32_t gc_mc_latency_cycles;
 
 #define GC_MC_LATENCY_CYCLES ( 0x80 )
+/* shortest latency the streaming read path is trusted with */
+#define GC_MC_LATENCY_MIN    ( 0x20 )
 #define GC_MC_SECTOR_SIZE    ( 0x2000 )
+#define GC_MC_INT_DELAY_US   ( 1000 )
 
 
 #define MCE_GET_DEV_ID                 0x00
@@ -29,6 +33,26 @@ extern uint DMA_BLOCK_READ_CHAN;
 #define MCE_CMD_BLOCK_READ             0x21
 #define MCE_CMD_BLOCK_START_WRITE      0x22
 #define MCE_CMD_BLOCK_WRITE            0x23
+#define MCE_CMD_BURST_START_READ       0x24
+#define MCE_CMD_BURST_READ             0x25
+#define MCE_CMD_BURST_START_WRITE      0x26
+#define MCE_CMD_BURST_WRITE            0x27
+#define MCE_CMD_FS_OPEN                0x40
+#define MCE_CMD_FS_CLOSE               0x41
+#define MCE_CMD_FS_START_READ          0x42
+#define MCE_CMD_FS_READ                0x43
+#define MCE_CMD_FS_START_WRITE         0x44
+#define MCE_CMD_FS_WRITE               0x45
+#define MCE_CMD_FS_SEEK                0x46
+#define MCE_CMD_FS_STAT                0x47
+#define MCE_CMD_FS_READDIR             0x48
+#define MCE_CMD_FS_GET_ENTRY           0x4A
+#define MCE_CMD_FS_GET_RESULT          0x4F
+
+/* capability byte after the version in the device ID, the upper nibble tells it from undefined data */
+#define MCE_CAPS_SIGNATURE             0xB0
+#define MCE_CAPS_BURST                 0x01
+#define MCE_CAPS_FS                    0x02
 
 #define GC_MC_PROBE_CMD                0x00
 #define GC_MC_READ_CMD                 0x52
@@ -10,6 +10,7 @@
 
 #include "mmceman/gc_mmceman.h"
 #include "mmceman/gc_mmceman_block_commands.h"
+#include "mmceman/gc_mmceman_fs_commands.h"
 #include "pico/multicore.h"
 #include "pico/platform.h"
 #include "gc_mc_internal.h"
@@ -20,6 +21,7 @@
 #include <settings.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #if LOG_LEVEL_GC_MC == 0
 #define log(x...)
@@ -40,16 +42,54 @@ static pio_t cmd_reader, dat_writer, clock_probe;
 static uint8_t interrupt_enable = 0;
 uint8_t card_state;
 
-static dma_channel_config dma_wait_config, dma_write_config, dma_block_read_config;
+static dma_channel_config dma_wait_config, dma_write_config, dma_block_read_config, dma_packed_read_config;
+static dma_channel_config dma_burst_write_config, dma_burst_read_config, dma_burst_ctrl_config;
 static uint8_t _;
 
 
 static int memcard_running;
+static int int_alarm = -1;
+
+/* Per-command timing, used to check handlers against the EXI budget.
+ * Only collected in debug builds, indexed by the command byte.
+ * The read slack is the number of latency bytes still left in
+ * DMA_WAIT_CHAN when the page was ready to go out - zero means the cube
+ * was already clocking the data phase and got stale bytes. */
+#if DEBUG_USB_UART
+typedef struct {
+    uint32_t count;
+    uint32_t total_us;
+    uint32_t max_us;
+} mc_cmd_stats_t;
+
+static mc_cmd_stats_t cmd_stats[256];
+#endif
+static uint32_t read_min_slack;
+static uint32_t read_late;
+
+/*
+* Latency bytes advertised in the probe ID and burnt by DMA_WAIT_CHAN. Profiles
+* below the default have to be met by the read path, once a read misses its
+* deadline the default is used again from the next probe on, until another
+* card is entered.
+*/
+uint32_t gc_mc_latency_cycles = GC_MC_LATENCY_CYCLES;
+static bool latency_fallback;
 static volatile int mc_exit_request, mc_exit_response, mc_enter_request, mc_enter_response;
 
 uint DMA_WAIT_CHAN;
 uint DMA_WRITE_CHAN;
 uint DMA_BLOCK_READ_CHAN;
+uint DMA_BURST_CTRL_CHAN;
+
+/*
+* A burst moves several ring slots in one transaction. The data channel chains to
+* the control channel after every block, which loads the next slot address from
+* this list into the data channel and starts it. The 0 at the end stops the chain.
+*/
+static uint32_t burst_addrs[MMCEMAN_BLOCK_BURST_MAX + 1];
+static uint8_t* burst_buffers[MMCEMAN_BLOCK_BURST_MAX];
+static uint32_t burst_count;
 
 static inline void __time_critical_func(RAM_pio_sm_drain_tx_fifo)(PIO pio, uint sm) {
     uint instr = (pio->sm[sm].shiftctrl & PIO_SM0_SHIFTCTRL_AUTOPULL_BITS) ? pio_encode_out(pio_null, 32) : pio_encode_pull(false, false);
@@ -70,6 +110,7 @@ static void __time_critical_func(reset_pio)(void) {
     pio_sm_clear_fifos(pio0, cmd_reader.sm);
 
     RAM_pio_sm_drain_tx_fifo(pio0, dat_writer.sm);
+    dat_writer_set_packed(pio0, dat_writer.sm, false);
 
     pio_enable_sm_mask_in_sync(pio0, sm_mask);
 
@@ -154,6 +195,25 @@ static void __time_critical_func(init_pio)(void) {
         512,                    // Number of transfers
         false                   // Start immediately
     );
+
+    /*
+    * Bulk reads move whole words into the TX FIFO with dat_writer in packed
+    * mode, byte swapped so the first byte in memory goes out first.
+    */
+    dma_packed_read_config = dma_block_read_config;
+    channel_config_set_transfer_data_size(&dma_packed_read_config, DMA_SIZE_32);
+    channel_config_set_bswap(&dma_packed_read_config, true);
+
+    dma_burst_read_config = dma_packed_read_config;
+    dma_burst_write_config = dma_write_config;
+
+    DMA_BURST_CTRL_CHAN = dma_claim_unused_channel(true);
+    dma_burst_ctrl_config = dma_channel_get_default_config(DMA_BURST_CTRL_CHAN);
+    channel_config_set_read_increment(&dma_burst_ctrl_config, true);
+    channel_config_set_write_increment(&dma_burst_ctrl_config, false);
+    channel_config_set_transfer_data_size(&dma_burst_ctrl_config, DMA_SIZE_32);
+    channel_config_set_chain_to(&dma_burst_read_config, DMA_BURST_CTRL_CHAN);
+    channel_config_set_chain_to(&dma_burst_write_config, DMA_BURST_CTRL_CHAN);
 }
 
 static void __time_critical_func(card_deselected)(uint gpio, uint32_t event_mask) {
@@ -181,6 +241,7 @@ uint8_t __time_critical_func(gc_receiveFirst)(uint8_t *cmd) {
             && 1) {
         if (reset || mc_exit_request)
             return reset != 0 ? RECEIVE_RESET : RECEIVE_EXIT;
+        gc_mc_data_interface_write_combine_idle();
     }
     (*cmd) = (uint8_t)pio_sm_get(pio0, cmd_reader.sm);
     return RECEIVE_OK;
@@ -195,9 +256,22 @@ static uint8_t mc_probe_id[4] = {
     0x00, 0x00, 0x00, 0x00
 };
 
+static uint32_t mc_select_latency(void) {
+    uint32_t latency = gc_cardman_get_latency();
+
+    if ((latency == 0) || latency_fallback)
+        return GC_MC_LATENCY_CYCLES;
+    if (latency < GC_MC_LATENCY_MIN)
+        return GC_MC_LATENCY_MIN;
+    return latency;
+}
+
 static void mc_generateId(void) {
+    gc_mc_latency_cycles = mc_select_latency();
+    dma_channel_set_trans_count(DMA_WAIT_CHAN, gc_mc_latency_cycles, false);
+
     uint32_t size = ((gc_cardman_get_card_size() * 8) / (1024 * 1024));
-    uint32_t latency = __builtin_ctz(GC_MC_LATENCY_CYCLES) - __builtin_ctz(0x4);
+    uint32_t latency = __builtin_ctz(gc_mc_latency_cycles) - __builtin_ctz(0x4);
     uint32_t sector_size = __builtin_ctz(GC_MC_SECTOR_SIZE) - __builtin_ctz(0x2000);
     uint32_t value = (size & 0xfc) |
         ((_ROTL(latency << 2, 6))) |
@@ -221,8 +295,11 @@ static void mc_generateId(void) {
 static void __time_critical_func(mc_probe)(void) {
     uint8_t _;
     gc_receiveOrNextCmd(&_);
-    dma_channel_set_read_addr(DMA_BLOCK_READ_CHAN, mc_probe_id, false);
-    dma_channel_set_trans_count(DMA_BLOCK_READ_CHAN, sizeof(mc_probe_id), true);
+    /* a late read asked for the default latency, the ID and the wait have to follow */
+    if (latency_fallback && (gc_mc_latency_cycles != GC_MC_LATENCY_CYCLES))
+        mc_generateId();
+    dma_channel_configure(DMA_BLOCK_READ_CHAN, &dma_block_read_config, ((uint8_t*)&pio0->txf[dat_writer.sm])+3,
+                          mc_probe_id, sizeof(mc_probe_id), true);
     log(LOG_TRACE, "Probe!\n");
 
     card_state = 0x01;
@@ -230,6 +307,70 @@ static void __time_critical_func(mc_probe)(void) {
 
 
 
+static void __time_critical_func(mc_int_alarm_fired)(uint alarm_num) {
+    (void)alarm_num;
+    gpio_put(PIN_GC_INT, 0);
+}
+
+/*
+* Pulls INT low once the delay has passed, without keeping core 1 from
+* answering status polls in the meantime.
+*/
+static void __time_critical_func(mc_assert_int_delayed)(uint32_t delay_us) {
+    hardware_alarm_set_target((uint)int_alarm, make_timeout_time_us(delay_us));
+}
+
+/*
+* Segments that are not yet loaded from SD get requested from core 0
+* with priority, we only wait for the ones we actually touch. The range
+* is clamped to the card, whatever lies past the end is never loaded and
+* gets rejected by the data interface instead.
+*/
+static bool __time_critical_func(mc_wait_for_segments)(uint32_t offset, uint32_t length) {
+    uint32_t card_size = gc_cardman_get_card_size();
+
+    if ((length == 0) || (offset >= card_size))
+        return true;
+    if (length > card_size - offset)
+        length = card_size - offset;
+
+    for (uint32_t segment = offset / GC_PAGE_SIZE; segment <= (offset + length - 1) / GC_PAGE_SIZE; segment++) {
+        if (!gc_cardman_is_segment_available(segment)) {
+            gc_cardman_set_priority_segment(segment);
+            while (!gc_cardman_is_segment_available(segment)) {
+                if (mc_exit_request)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+* Sends the current page while it is still coming in from PSRAM. Each TX transfer
+* only covers the words that have arrived, so it never overtakes the fill. PSRAM
+* is much faster than EXI, after the first chunk the rest follows in one go.
+*/
+static void __time_critical_func(mc_stream_page)(const uint8_t *data) {
+    uint32_t sent = 0;
+
+    dat_writer_set_packed(pio0, dat_writer.sm, true);
+    while (sent < GC_PAGE_SIZE) {
+        if (reset) {
+            dma_channel_abort(DMA_BLOCK_READ_CHAN);
+            return;
+        }
+        if (dma_channel_is_busy(DMA_BLOCK_READ_CHAN))
+            continue;
+
+        uint32_t avail = gc_mc_data_interface_bytes_available() & ~3U;
+        if (avail > sent) {
+            dma_channel_transfer_from_buffer_now(DMA_BLOCK_READ_CHAN, &data[sent], (avail - sent) / 4);
+            sent = avail;
+        }
+    }
+}
+
 static void __time_critical_func(gc_mc_read)(void) {
     //uint16_t i = 0;
     uint8_t offset[4] = {};
@@ -257,17 +398,33 @@ static void __time_critical_func(gc_mc_read)(void) {
     // Setup data read
     log(LOG_TRACE, "Offset : %04x Test Offset: %04x\n", offset_u32, offset_u32 << 12);
     log(LOG_TRACE, "Raw: %02x %02x %02x %02x\n", offset[0], offset[1], offset[2], offset[3]);
-    gc_mc_data_interface_setup_read_page(offset_u32/512U, true);
+    /* erased pages are answered without PSRAM, loaded or not */
+    bool erased = (offset_u32 < gc_cardman_get_card_size()) && gc_cardman_is_segment_erased(offset_u32 / 512U);
+    if (!erased && !mc_wait_for_segments(offset_u32, GC_PAGE_SIZE))
+        return;
+    gc_mc_data_interface_setup_read_page(offset_u32/512U, false);
 
     volatile gc_mcdi_page_t *page = gc_mc_data_interface_get_page();
     if (page->page_state != PAGE_DATA_AVAILABLE) {
         log(LOG_ERROR, "%s: page %u not available\n", __func__, offset_u32/512U);
         return;
     }
-    dma_channel_set_read_addr(DMA_BLOCK_READ_CHAN, page->data, false);
-    dma_channel_set_trans_count(DMA_BLOCK_READ_CHAN, 0x200, false);
+    dma_channel_configure(DMA_BLOCK_READ_CHAN, &dma_packed_read_config, &pio0->txf[dat_writer.sm],
+                          page->data, 0, false);
+    uint32_t slack = dma_channel_hw_addr(DMA_WAIT_CHAN)->transfer_count;
+    if (slack < read_min_slack)
+        read_min_slack = slack;
     while (dma_channel_is_busy(DMA_WAIT_CHAN)); // Wait for DMA to complete
-    dma_channel_start(DMA_BLOCK_READ_CHAN);
+    // Missed the deadline if the cube is clocking the data while the first word isn't there
+    if ((slack == 0) || (gc_mc_data_interface_bytes_available() < 4)) {
+        read_late++;
+        if (gc_mc_latency_cycles < GC_MC_LATENCY_CYCLES)
+            latency_fallback = true;
+    }
+    mc_stream_page(page->data);
+
+    // Prefetch the following pages while the cube is clocking out this one
+    gc_mc_data_interface_read_ahead();
     //log(LOG_TRACE, "Reading page %u\n", offset_u32/512U);
 /*    for (i = 0; i < 0x200; i++) {
         gc_mc_respond(page->data[i]);
@@ -295,6 +452,9 @@ static void __time_critical_func(gc_mc_write)(void) {
     //DPRINTF("W: %08x / %u\n",offset_u32, 128);
 
     while (dma_channel_is_busy(DMA_WRITE_CHAN)) {}; // Wait for DMA to complete
+    // Partial write, the rest of the segment has to be loaded first
+    if (!mc_wait_for_segments(offset_u32, 128))
+        return;
     gc_mc_data_interface_write_mc(offset_u32, data, 128);
 
 
@@ -303,9 +463,9 @@ static void __time_critical_func(gc_mc_write)(void) {
     if (interrupt_enable & 0x01) {
         // Wait 1ms in jpn
         if (gc_cardman_get_card_enc())
-            sleep_us(1000);
-
-        gpio_put(PIN_GC_INT, 0);
+            mc_assert_int_delayed(GC_MC_INT_DELAY_US);
+        else
+            gpio_put(PIN_GC_INT, 0);
     }
 }
 
@@ -323,17 +483,34 @@ static void __time_critical_func(mc_erase_sector)(void) {
     card_state |= 0x06; // Set card state to 0x06 (write done)
 
     if (interrupt_enable & 0x01) {
-        sleep_us(1000); // Wait for 200us to ensure the card is ready
-        gpio_put(PIN_GC_INT, 0);
+        mc_assert_int_delayed(GC_MC_INT_DELAY_US);
     }
 }
 
 
+static void __time_critical_func(mc_erase_card)(void) {
+    uint8_t _;
+    gc_receiveOrNextCmd(&_);
+    gc_receiveOrNextCmd(&_);
+
+    gc_mc_data_interface_erase_card();
+    log(LOG_INFO, "Erase card\n");
+
+    card_state |= 0x06; // Set card state to 0x06 (write done)
+
+    if (interrupt_enable & 0x01) {
+        mc_assert_int_delayed(GC_MC_INT_DELAY_US);
+    }
+}
+
 static void __time_critical_func(mc_get_dev_id)(void) {
     gc_mc_respond(0x38); // out byte 5
     gc_mc_respond(0x42); // out byte 5
     gc_mc_respond(0x01); // out byte 5
     gc_mc_respond(0x01); // out byte 5
+    /* hosts that stop after the version never clock these out */
+    gc_mc_respond(MCE_CAPS_SIGNATURE | MCE_CAPS_BURST | MCE_CAPS_FS);
+    gc_mc_respond(MMCEMAN_BLOCK_BURST_MAX);
 }
 
 /**
@@ -401,15 +578,16 @@ static void __time_critical_func(mc_block_start_read)(void) {
         if (mc_exit_request) return;
     }
     gc_mmceman_block_read_data(&block_buffer);
-    dma_channel_set_read_addr(DMA_BLOCK_READ_CHAN, block_buffer, false);
-    dma_channel_set_trans_count(DMA_BLOCK_READ_CHAN, 0x200, false);
     gpio_put(PIN_GC_INT, 0);
 }
 
 static void __time_critical_func(mc_block_read)(void) {
     uint8_t _;
     gc_receive(&_);
-    dma_channel_start(DMA_BLOCK_READ_CHAN);
+    dat_writer_set_packed(pio0, dat_writer.sm, true);
+    /* probes and file reads between two sectors reconfigure the channel for byte transfers */
+    dma_channel_configure(DMA_BLOCK_READ_CHAN, &dma_packed_read_config, &pio0->txf[dat_writer.sm],
+                          block_buffer, 0x200 / 4, true);
 
     while(dma_channel_is_busy(DMA_BLOCK_READ_CHAN)) {
         if (reset) {
@@ -425,7 +603,6 @@ static void __time_critical_func(mc_block_read)(void) {
             if (mc_exit_request) return;
         }
         gc_mmceman_block_read_data(&block_buffer);
-        dma_channel_set_read_addr(DMA_BLOCK_READ_CHAN, block_buffer, false);
 
         gpio_put(PIN_GC_INT, 0);
     }
@@ -481,9 +658,366 @@ static void __time_critical_func(mc_block_write)(void) {
     gpio_put(PIN_GC_INT, 0);
 }
 
+static void __time_critical_func(mc_burst_arm)(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++)
+        burst_addrs[i] = (uint32_t)(uintptr_t)burst_buffers[i];
+    burst_addrs[count] = 0;
+    burst_count = count;
+}
+
+/* runs the armed chain on the data channel, returns false if it was aborted */
+static bool __time_critical_func(mc_burst_run)(uint data_chan, const dma_channel_config *config, uint32_t transfers, volatile void *trigger) {
+    dma_channel_set_trans_count(data_chan, transfers, false);
+    dma_channel_set_config(data_chan, config, false);
+    dma_channel_configure(DMA_BURST_CTRL_CHAN, &dma_burst_ctrl_config, trigger, burst_addrs, 1, true);
+
+    bool ok = true;
+    while (dma_channel_is_busy(data_chan) || dma_channel_is_busy(DMA_BURST_CTRL_CHAN)
+           || (dma_channel_hw_addr(DMA_BURST_CTRL_CHAN)->read_addr != (uint32_t)(uintptr_t)&burst_addrs[burst_count + 1])) {
+        if (reset) {
+            dma_channel_abort(DMA_BURST_CTRL_CHAN);
+            dma_channel_abort(data_chan);
+            ok = false;
+            break;
+        }
+    }
+    return ok;
+}
+
+/**
+ * Command:  Start burst read
+ * Request:  0x8B 24 aa aa aa aa bb bb
+ *
+ * Same as start read multiple block, but the blocks are then moved by burst reads.
+*/
+static void __time_critical_func(mc_burst_start_read)(void) {
+    uint8_t sector[4] = {};
+    uint8_t count[2] = {};
+    uint32_t *sec_u32 = (uint32_t *)sector;
+    uint16_t *count_u16 = (uint16_t *)count;
+    uint32_t n;
+
+    for (int i = 3; i >= 0; i--) {
+        gc_receive(&sector[i]);
+    }
+    for (int i = 1; i >= 0; i--) {
+        gc_receive(&count[i]);
+    }
+
+    gc_mmceman_block_request_read_sector(*sec_u32, *count_u16);
+    interrupt_enable = 0x01;
+    log(LOG_TRACE, "Burst read start: sector=%u count=%u\n", *sec_u32, *count_u16);
+    while ((n = gc_mmceman_block_read_burst(burst_buffers, MMCEMAN_BLOCK_BURST_MAX)) == 0) {
+        if (mc_exit_request) return;
+    }
+    mc_burst_arm(n);
+    gpio_put(PIN_GC_INT, 0);
+}
+
+static void __time_critical_func(mc_burst_read)(void) {
+    uint8_t _;
+    uint32_t n;
+    gc_receive(&_);
+
+    dat_writer_set_packed(pio0, dat_writer.sm, true);
+    /* the probe leaves the byte lane of the FIFO in here */
+    dma_channel_set_write_addr(DMA_BLOCK_READ_CHAN, &pio0->txf[dat_writer.sm], false);
+    bool ok = mc_burst_run(DMA_BLOCK_READ_CHAN, &dma_burst_read_config, 0x200 / 4,
+                           &dma_hw->ch[DMA_BLOCK_READ_CHAN].al3_read_addr_trig);
+    dma_channel_set_config(DMA_BLOCK_READ_CHAN, &dma_block_read_config, false);
+    if (!ok) {
+        log(LOG_ERROR, "Burst read aborted due to reset\n");
+        return;
+    }
+
+    if (!gc_mmceman_block_read_idle()) {
+        while ((n = gc_mmceman_block_read_burst(burst_buffers, MMCEMAN_BLOCK_BURST_MAX)) == 0) {
+            if (mc_exit_request) return;
+        }
+        mc_burst_arm(n);
+        gpio_put(PIN_GC_INT, 0);
+    }
+}
+
+/**
+ * Command:  Start burst write
+ * Request:  0x8B 26 aa aa aa aa bb bb
+ *
+ * Same as start write multiple block, but the blocks are then moved by burst writes.
+*/
+static void __time_critical_func(mc_burst_start_write)(void) {
+    uint8_t sector[4] = {};
+    uint8_t count[2] = {};
+    uint32_t *sec_u32 = (uint32_t *)sector;
+    uint16_t count_u16 = 0;
+    for (int i = 3; i >= 0; i--) {
+        gc_receive(&sector[i]);
+    }
+    gc_receive(&count[0]);
+    gc_receive(&count[1]);
+    count_u16 = (uint16_t)(((uint16_t)count[0] << 8) | count[1]);
+    while (!gc_mmceman_block_write_idle()) {
+        if (mc_exit_request) return;
+    }
+    log(LOG_INFO, "Burst write start: sector=%u count=%u\n", *sec_u32, count_u16);
+    gc_mmceman_block_request_write_sector(*sec_u32, count_u16);
+    mc_burst_arm(gc_mmceman_get_write_blocks(burst_buffers, MMCEMAN_BLOCK_BURST_MAX));
+
+    dma_channel_set_read_addr(DMA_WRITE_CHAN, &pio0->rxf[cmd_reader.sm], false);
+    gpio_put(PIN_GC_INT, 0);
+}
+
+static void __time_critical_func(mc_burst_write)(void) {
+    uint32_t n = burst_count;
+
+    bool ok = mc_burst_run(DMA_WRITE_CHAN, &dma_burst_write_config, 0x200,
+                           &dma_hw->ch[DMA_WRITE_CHAN].al2_write_addr_trig);
+    dma_channel_set_config(DMA_WRITE_CHAN, &dma_write_config, false);
+    if (!ok) {
+        log(LOG_ERROR, "Burst write aborted due to reset\n");
+        return;
+    }
+
+    /* make room for the next burst, or wait for the whole request on the last one */
+    gc_mmceman_block_write_blocks(n, MMCEMAN_BLOCK_BURST_MAX);
+    if (!gc_mmceman_block_write_idle())
+        mc_burst_arm(gc_mmceman_get_write_blocks(burst_buffers, MMCEMAN_BLOCK_BURST_MAX));
+
+    while (!reset) {
+        if (mc_exit_request) return;
+    }
+
+    gpio_put(PIN_GC_INT, 0);
+}
+
+static bool __time_critical_func(mc_fs_receive_u32)(uint32_t *value) {
+    uint8_t byte;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        if (gc_receive(&byte) != RECEIVE_OK)
+            return false;
+        *value = (*value << 8) | byte;
+    }
+    return true;
+}
+
+/* the path is taken before the request, a stream still running keeps its buffers until then */
+static bool __time_critical_func(mc_fs_receive_path)(char *path) {
+    for (int i = 0; i < MMCEMAN_FS_PATH_MAX - 1; i++) {
+        if (gc_receive((uint8_t*)&path[i]) != RECEIVE_OK)
+            return false;
+        if (path[i] == 0x00)
+            return true;
+    }
+    path[MMCEMAN_FS_PATH_MAX - 1] = 0x00;
+    return true;
+}
+
+/* core 0 carries out the request, INT tells the host to fetch the result */
+static void __time_critical_func(mc_fs_wait_result)(void) {
+    while (gc_mmceman_fs_busy()) {
+        if (mc_exit_request) return;
+    }
+    gpio_put(PIN_GC_INT, 0);
+}
+
+/**
+ * Command:  Open file
+ * Request:  0x8B 40 ff pp pp .. 00
+ *
+ * ff: MMCEMAN_FS_O_* flags, pp: path on the SD card, nul-terminated.
+ * Result is the file descriptor or -1.
+*/
+static void __time_critical_func(mc_fs_open)(void) {
+    char path[MMCEMAN_FS_PATH_MAX];
+    uint8_t flags;
+    if ((gc_receive(&flags) != RECEIVE_OK) || !mc_fs_receive_path(path))
+        return;
+    gc_mmceman_fs_open(flags, path);
+    mc_fs_wait_result();
+}
+
+static void __time_critical_func(mc_fs_close)(void) {
+    uint8_t fd;
+    if (gc_receive(&fd) != RECEIVE_OK)
+        return;
+    gc_mmceman_fs_close(fd);
+    mc_fs_wait_result();
+}
+
+/**
+ * Command:  Seek
+ * Request:  0x8B 46 dd oo oo oo oo ww
+ *
+ * dd: file descriptor, oo: signed offset, ww: 0 set, 1 current, 2 end.
+ * Result is the new position or -1.
+*/
+static void __time_critical_func(mc_fs_seek)(void) {
+    uint8_t fd, whence;
+    uint32_t offset;
+    if ((gc_receive(&fd) != RECEIVE_OK) || !mc_fs_receive_u32(&offset) || (gc_receive(&whence) != RECEIVE_OK))
+        return;
+    gc_mmceman_fs_seek(fd, (int32_t)offset, whence);
+    mc_fs_wait_result();
+}
+
+static void __time_critical_func(mc_fs_stat)(void) {
+    char path[MMCEMAN_FS_PATH_MAX];
+    if (!mc_fs_receive_path(path))
+        return;
+    gc_mmceman_fs_stat(path);
+    mc_fs_wait_result();
+}
+
+static void __time_critical_func(mc_fs_readdir)(void) {
+    uint8_t fd;
+    if (gc_receive(&fd) != RECEIVE_OK)
+        return;
+    gc_mmceman_fs_readdir(fd);
+    mc_fs_wait_result();
+}
+
+/**
+ * Command:  Get entry
+ * Request:  0x8B 4A xx
+ * Response: 0xXX XX XX tt ss ss ss ss nn .. nn
+ *
+ * Entry of the last stat or readdir, tt: 0 file, 1 directory, ss: size, nn: 64 byte name.
+*/
+static void __time_critical_func(mc_fs_get_entry)(void) {
+    const gc_mmceman_fs_entry_t *entry = gc_mmceman_fs_entry();
+    uint8_t _;
+    gc_receive(&_);
+    gc_mc_respond(entry->type);
+    for (int i = 3; i >= 0; i--) {
+        gc_mc_respond((uint8_t)(entry->size >> (8 * i)));
+    }
+    for (int i = 0; i < MMCEMAN_FS_NAME_MAX; i++) {
+        gc_mc_respond((uint8_t)entry->name[i]);
+    }
+}
+
+static void __time_critical_func(mc_fs_get_result)(void) {
+    int32_t result = gc_mmceman_fs_result();
+    uint8_t _;
+    gc_receive(&_);
+    for (int i = 3; i >= 0; i--) {
+        gc_mc_respond((uint8_t)((uint32_t)result >> (8 * i)));
+    }
+}
+
+/**
+ * Command:  Start file read
+ * Request:  0x8B 42 dd ll ll ll ll
+ *
+ * Streams up to ll bytes from file dd, INT once the first chunk is ready.
+*/
+static void __time_critical_func(mc_fs_start_read)(void) {
+    uint8_t fd;
+    uint32_t length;
+    if ((gc_receive(&fd) != RECEIVE_OK) || !mc_fs_receive_u32(&length))
+        return;
+    gc_mmceman_fs_read_start(fd, length);
+    log(LOG_TRACE, "FS read start: fd=%u length=%u\n", fd, length);
+    while (!gc_mmceman_fs_read_ready()) {
+        if (mc_exit_request) return;
+    }
+    gpio_put(PIN_GC_INT, 0);
+}
+
+/**
+ * Command:  Read file chunk
+ * Request:  0x8B 43 xx
+ * Response: 0xXX XX XX ll ll dd .. dd
+ *
+ * ll: bytes used of the 512 byte chunk dd, 0 at the end of the stream.
+ * INT once the next chunk is ready.
+*/
+static void __time_critical_func(mc_fs_read)(void) {
+    uint16_t length = 0;
+    uint8_t *buffer;
+    uint8_t _;
+    gc_receive(&_);
+
+    buffer = gc_mmceman_fs_read_chunk(&length);
+    if (!buffer) {
+        log(LOG_ERROR, "FS read chunk not ready\n");
+        return;
+    }
+    gc_mc_respond((uint8_t)(length >> 8));
+    gc_mc_respond((uint8_t)length);
+    dma_channel_configure(DMA_BLOCK_READ_CHAN, &dma_block_read_config, ((uint8_t*)&pio0->txf[dat_writer.sm])+3,
+                          buffer, MMCEMAN_FS_CHUNK_SIZE, true);
+
+    while (dma_channel_is_busy(DMA_BLOCK_READ_CHAN)) {
+        if (reset) {
+            log(LOG_ERROR, "FS read aborted due to reset\n");
+            dma_channel_abort(DMA_BLOCK_READ_CHAN);
+            return;
+        }
+    }
+    if (length == 0)
+        return;
+
+    gc_mmceman_fs_read_release();
+    while (!gc_mmceman_fs_read_ready()) {
+        if (mc_exit_request) return;
+    }
+    gpio_put(PIN_GC_INT, 0);
+}
+
+/**
+ * Command:  Start file write
+ * Request:  0x8B 44 dd ll ll ll ll
+ *
+ * ll bytes for file dd follow in 512 byte chunks, the last one padded.
+*/
+static void __time_critical_func(mc_fs_start_write)(void) {
+    uint8_t fd;
+    uint32_t length;
+    if ((gc_receive(&fd) != RECEIVE_OK) || !mc_fs_receive_u32(&length))
+        return;
+    gc_mmceman_fs_write_start(fd, length);
+    log(LOG_TRACE, "FS write start: fd=%u length=%u\n", fd, length);
+
+    dma_channel_configure(DMA_WRITE_CHAN, &dma_write_config, gc_mmceman_fs_write_buffer(), &pio0->rxf[cmd_reader.sm], MMCEMAN_FS_CHUNK_SIZE, false);
+    gpio_put(PIN_GC_INT, 0);
+}
+
+/**
+ * Command:  Write file chunk
+ * Request:  0x8B 45 dd .. dd
+ *
+ * INT once the next chunk can be taken, after the last one once all of it
+ * is on the card. The result is the number of bytes written or -1.
+*/
+static void __time_critical_func(mc_fs_write)(void) {
+    dma_channel_start(DMA_WRITE_CHAN);
+
+    while (dma_channel_is_busy(DMA_WRITE_CHAN)) {
+        if (reset) {
+            log(LOG_ERROR, "FS write aborted due to reset\n");
+            dma_channel_abort(DMA_WRITE_CHAN);
+            return;
+        }
+    }
+    gc_mmceman_fs_write_chunk();
+    while (!gc_mmceman_fs_write_ready()) {
+        if (mc_exit_request) return;
+    }
+    dma_channel_set_write_addr(DMA_WRITE_CHAN, gc_mmceman_fs_write_buffer(), false);
+
+    while (!reset) {
+        if (mc_exit_request) return;
+    }
+    gpio_put(PIN_GC_INT, 0);
+}
+
 static void __time_critical_func(mc_block_set_accessmode)(void) {
     uint8_t mode = 0x0;
     gc_receive(&mode);
+    /* core 0 flushes the card before handing the SD card over, nothing may be left behind */
+    gc_mc_data_interface_write_combine_flush();
     gc_mmceman_block_set_sd_mode((mode != 0));
 
     if (mode != 0) {
@@ -505,6 +1039,8 @@ static void __time_critical_func(mc_mce_cmd)(void) {
             mode = gc_mmceman_block_get_sd_mode() ? 1 : 0;
             gc_receive(&cmd); // buffer byte
             gc_mc_respond(mode);
+            /* hosts that stop after the mode never clock this out */
+            gc_mc_respond(gc_mmceman_block_get_write_errors());
             break;
         case MCE_SET_ACCESS_MODE:
             mc_block_set_accessmode();
@@ -530,6 +1066,51 @@ static void __time_critical_func(mc_mce_cmd)(void) {
         case MCE_CMD_BLOCK_WRITE:
             mc_block_write();
             break;
+        case MCE_CMD_BURST_START_READ:
+            mc_burst_start_read();
+            break;
+        case MCE_CMD_BURST_READ:
+            mc_burst_read();
+            break;
+        case MCE_CMD_BURST_START_WRITE:
+            mc_burst_start_write();
+            break;
+        case MCE_CMD_BURST_WRITE:
+            mc_burst_write();
+            break;
+        case MCE_CMD_FS_OPEN:
+            mc_fs_open();
+            break;
+        case MCE_CMD_FS_CLOSE:
+            mc_fs_close();
+            break;
+        case MCE_CMD_FS_START_READ:
+            mc_fs_start_read();
+            break;
+        case MCE_CMD_FS_READ:
+            mc_fs_read();
+            break;
+        case MCE_CMD_FS_START_WRITE:
+            mc_fs_start_write();
+            break;
+        case MCE_CMD_FS_WRITE:
+            mc_fs_write();
+            break;
+        case MCE_CMD_FS_SEEK:
+            mc_fs_seek();
+            break;
+        case MCE_CMD_FS_STAT:
+            mc_fs_stat();
+            break;
+        case MCE_CMD_FS_READDIR:
+            mc_fs_readdir();
+            break;
+        case MCE_CMD_FS_GET_ENTRY:
+            mc_fs_get_entry();
+            break;
+        case MCE_CMD_FS_GET_RESULT:
+            mc_fs_get_result();
+            break;
         default:
             DPRINTF("MCE: Unknown command: %02x ", cmd);
             break;
@@ -551,7 +1132,7 @@ static void __time_critical_func(mc_pre_loop)(void) {
             && pio_sm_is_rx_fifo_empty(pio0, cmd_reader.sm)
             && pio_sm_is_rx_fifo_empty(pio0, cmd_reader.sm)
             && 1) {
-        if (reset || (gc_cardman_is_idle() && gc_mmceman_block_idle())) {
+        if (reset || (gc_cardman_is_accessible() && gc_mmceman_block_idle())) {
             return;
         }
     }
@@ -569,7 +1150,7 @@ static void __time_critical_func(mc_pre_loop)(void) {
                     && pio_sm_is_rx_fifo_empty(pio0, cmd_reader.sm)
                     && pio_sm_is_rx_fifo_empty(pio0, cmd_reader.sm)
                     && 1) {
-                if (reset || (gc_cardman_is_idle() && gc_mmceman_block_idle())) {
+                if (reset || (gc_cardman_is_accessible() && gc_mmceman_block_idle())) {
                     return;
                 }
             }
@@ -583,15 +1164,49 @@ static void __time_critical_func(mc_pre_loop)(void) {
 }
 
 
+static void __time_critical_func(mc_stats_reset)(void) {
+#if DEBUG_USB_UART
+    memset(cmd_stats, 0, sizeof(cmd_stats));
+#endif
+    read_min_slack = gc_mc_latency_cycles;
+    read_late = 0;
+}
+
+#if DEBUG_USB_UART
+static inline void __time_critical_func(mc_stats_record)(uint8_t cmd, uint32_t time_us) {
+    mc_cmd_stats_t *entry = &cmd_stats[cmd];
+    entry->count++;
+    entry->total_us += time_us;
+    if (time_us > entry->max_us)
+        entry->max_us = time_us;
+}
+#endif
+
+static void mc_stats_print(void) {
+#if DEBUG_USB_UART
+    for (uint32_t cmd = 0; cmd < sizeof(cmd_stats) / sizeof(cmd_stats[0]); cmd++) {
+        if (cmd_stats[cmd].count > 0)
+            log(LOG_INFO, "Cmd %02x: %u calls, avg %u us, max %u us\n", cmd, cmd_stats[cmd].count,
+                cmd_stats[cmd].total_us / cmd_stats[cmd].count, cmd_stats[cmd].max_us);
+    }
+#endif
+    log(LOG_INFO, "Read slack: min %u of %u latency bytes, %u late\n", read_min_slack, gc_mc_latency_cycles, read_late);
+    DPRINTF("%s ran with %u latency bytes, %u deadline misses%s\n", gc_cardman_get_folder_name(), gc_mc_latency_cycles,
+            read_late, latency_fallback ? ", back to default" : "");
+}
+
 static void __time_critical_func(mc_main_loop)(void) {
     card_state = 0x01;
     uint8_t cmd;
     uint8_t res;
 
+    mc_stats_reset();
+
     while (1) {
         cmd = 0;
         res = 0;
         while (!reset) {
+            gc_mc_data_interface_read_ahead();
         }; // Wait for reset
         gpio_put(PIN_GC_INT, 1);
 
@@ -603,11 +1218,23 @@ static void __time_critical_func(mc_main_loop)(void) {
             if (res == RECEIVE_RESET) {
                 continue;
             } else if (res == RECEIVE_EXIT) {
+                hardware_alarm_cancel((uint)int_alarm);
+                gc_mc_data_interface_write_combine_flush();
+                mc_stats_print();
                 mc_exit_response = 1;
                 mc_exit_request = 0;
                 return;
             }
         }
+        /*
+        * The delayed interrupt of a write or erase is due after its deselect, but
+        * it must not fire into the next command.
+        */
+        hardware_alarm_cancel((uint)int_alarm);
+
+#if DEBUG_USB_UART
+        uint32_t cmd_start = time_us_32();
+#endif
 
         switch (cmd) {
             case GC_MC_PROBE_CMD:
@@ -647,12 +1274,16 @@ static void __time_critical_func(mc_main_loop)(void) {
                 gc_mc_write();
                 break;
             case GC_MC_ERASE_CARD_CMD:
-                DPRINTF("ERASE CARD ");
+                mc_erase_card();
                 break;
             default:
                 //DPRINTF("Unknown command: %02x ", cmd);
                 break;
         }
+
+#if DEBUG_USB_UART
+        mc_stats_record(cmd, time_us_32() - cmd_start);
+#endif
     }
 }
 static bool initial_boot = true;
@@ -667,14 +1298,14 @@ static void __no_inline_not_in_flash_func(mc_main)(void) {
             reset_pio();
             gpio_put(PIN_MC_CONNECTED, 1);
 
-            while (!gc_cardman_is_idle() || !gc_mmceman_block_idle()) {
+            while (!gc_cardman_is_accessible() || !gc_mmceman_block_idle()) {
                 mc_pre_loop();
             };
             gpio_put(PIN_MC_CONNECTED, 0);
             initial_boot = false;
             sleep_ms(10);
         } else {
-            while (!gc_cardman_is_idle());
+            while (!gc_cardman_is_accessible());
         }
         mc_generateId();
 
@@ -740,6 +1371,14 @@ static void my_gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bo
 void gc_memory_card_main(void) {
     multicore_lockout_victim_init();
     init_pio();
+    gc_unlock_init();
+
+    /* registered from core 1, so the alarm irq is handled here as well - again after a core 1 restart */
+    if (int_alarm < 0)
+        int_alarm = hardware_alarm_claim_unused(true);
+    else
+        hardware_alarm_set_callback((uint)int_alarm, NULL);
+    hardware_alarm_set_callback((uint)int_alarm, mc_int_alarm_fired);
     gpio_set_dir(PIN_GC_INT, true);
     gpio_put(PIN_GC_INT, 1);
     gpio_set_drive_strength(PIN_GC_INT, GPIO_DRIVE_STRENGTH_12MA);
@@ -778,6 +1417,8 @@ void gc_memory_card_enter(void) {
     if (memcard_running)
         return;
 
+    /* a new card gets its own latency profile back */
+    latency_fallback = false;
     mc_enter_request = 1;
     while (!mc_enter_response) {}
     mc_enter_request = mc_enter_response = 0;
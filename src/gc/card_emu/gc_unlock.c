@@ -44,44 +44,91 @@ static void __time_critical_func(extract_flash_id)(uint8_t *flash_id,  uint8_t *
     chks = chks ^ 0xff;
 }
 
-static uint32_t __time_critical_func(exnor_1st)(uint32_t a,uint32_t b)
+/*
+* The card LFSR is stepped one bit at a time by exnor. Only the very first
+* step is non-linear (the feedback is OR'ed into a bit that is always zero
+* afterwards), all following steps are the same affine map over GF(2)^32:
+*
+*   a' = (a << 1) ^ (parity(a[8], a[16], a[24], a[31]) << 1) ^ 2
+*
+* Powers of that map are kept in a table, so advancing by n steps costs at
+* most one table application per bit of n instead of n iterations.
+* Each level holds the images of the 32 unit vectors plus the constant.
+*/
+#define EXNOR_JUMP_LEVELS (12)
+
+static uint32_t exnor_jump[EXNOR_JUMP_LEVELS][33];
+
+static uint32_t __time_critical_func(exnor_linear)(const uint32_t *level, uint32_t a) {
+    uint32_t r = 0;
+    for (uint32_t j = 0; a; j++, a >>= 1) {
+        if (a & 1)
+            r ^= level[j];
+    }
+    return r;
+}
+
+static inline uint32_t __time_critical_func(exnor_apply)(const uint32_t *level, uint32_t a) {
+    return exnor_linear(level, a) ^ level[32];
+}
+
+uint32_t __time_critical_func(exnor)(uint32_t a,uint32_t b)
 {
-	uint32_t d,e,f,r1,r2,r3,r4;
-
-    for (uint32_t c = 0; c < b; c++) {
-		d = (a>>23);
-		e = (a>>15);
-		f = (a>>7);
-		r1 = (a^f);
-		r2 = (e^r1);
-		r3 = ~(d^r2);		//eqv(d,r2)
-		e = (a>>1);
-		r4 = ((r3<<30)&0x40000000);
-		a = (e|r4);
-	};
-	return a;
+    uint32_t d,e,f,r1,r2,r3,r4;
+
+    if (b == 0)
+        return a;
+
+    d = (a<<23);
+    e = (a<<15);
+    f = (a<<7);
+    r1 = (a^f);
+    r2 = (e^r1);
+    r3 = ~(d^r2);		//eqv(d,r2)
+    e = (a<<1);
+    r4 = ((r3>>30)&0x02);
+    a = (e|r4);
+    b--;
+
+    for (uint32_t level = 0; level < EXNOR_JUMP_LEVELS - 1; level++) {
+        if (b & (1U << level))
+            a = exnor_apply(exnor_jump[level], a);
+    }
+    for (b >>= (EXNOR_JUMP_LEVELS - 1); b; b--)
+        a = exnor_apply(exnor_jump[EXNOR_JUMP_LEVELS - 1], a);
+
+    return a;
 }
 
+static uint32_t __time_critical_func(reverse32)(uint32_t a)
+{
+    a = ((a >> 1) & 0x55555555) | ((a & 0x55555555) << 1);
+    a = ((a >> 2) & 0x33333333) | ((a & 0x33333333) << 2);
+    a = ((a >> 4) & 0x0F0F0F0F) | ((a & 0x0F0F0F0F) << 4);
+    a = ((a >> 8) & 0x00FF00FF) | ((a & 0x00FF00FF) << 8);
+    return (a >> 16) | (a << 16);
+}
 
-static uint32_t __time_critical_func(exnor)(uint32_t a,uint32_t b)
+/* the initial LFSR is the mirror image of the one stepped by exnor */
+uint32_t __time_critical_func(exnor_1st)(uint32_t a,uint32_t b)
 {
-	uint32_t d,e,f,r1,r2,r3,r4;
-
-    for (uint32_t c = 0; c < b; c++) {
-		d = (a<<23);
-		e = (a<<15);
-		f = (a<<7);
-		r1 = (a^f);
-		r2 = (e^r1);
-		r3 = ~(d^r2);		//eqv(d,r2)
-		e = (a<<1);
-		r4 = ((r3>>30)&0x02);
-		a = (e|r4);
-	};
-	return a;
+    return reverse32(exnor(reverse32(a), b));
 }
 
+void __time_critical_func(gc_unlock_init)(void) {
+    for (uint32_t j = 0; j < 32; j++) {
+        uint32_t a = 1U << j;
+        exnor_jump[0][j] = (a << 1) ^ ((((a >> 8) ^ (a >> 16) ^ (a >> 24) ^ (a >> 31)) & 1U) << 1);
+    }
+    exnor_jump[0][32] = 0x02;
 
+    for (uint32_t level = 1; level < EXNOR_JUMP_LEVELS; level++) {
+        const uint32_t *prev = exnor_jump[level - 1];
+        for (uint32_t j = 0; j < 32; j++)
+            exnor_jump[level][j] = exnor_linear(prev, prev[j]);
+        exnor_jump[level][32] = exnor_apply(prev, prev[32]);
+    }
+}
 
 static uint32_t __time_critical_func(bitrev)(uint32_t val)
 {
@@ -201,6 +248,7 @@ void __time_critical_func(mc_unlock)(void) {
 
 
         log(LOG_TRACE, "Unlock Msg2: Decoded Offset is %08x / %02x\n", initial_offset_u32, initial_length_u32);
+        uint32_t cipher_start = time_us_32();
         init_cipher(&card_cipher, initial_offset_u32, initial_length_u32);
 
         log(LOG_TRACE, "Unlock Msg2: Initial Cipher is %08x\n", card_cipher);
@@ -221,6 +269,7 @@ void __time_critical_func(mc_unlock)(void) {
         d = 0x00000000 ^ card_cipher;
         update_cipher(&card_cipher, 32);
         e = 0x00000000 ^ card_cipher;
+        uint32_t cipher_time = time_us_32() - cipher_start;
 
         while (dma_channel_is_busy(DMA_WAIT_CHAN)) {tight_loop_contents();}; // Wait for DMA to complete
 
@@ -268,7 +317,9 @@ void __time_critical_func(mc_unlock)(void) {
         while (gc_receive(&_) != RECEIVE_RESET) {
             len++;
         }
-        update_cipher(&card_cipher,((len + GC_MC_LATENCY_CYCLES) << 3) + 1);
+        cipher_start = time_us_32();
+        update_cipher(&card_cipher,((len + gc_mc_latency_cycles) << 3) + 1);
+        cipher_time += time_us_32() - cipher_start;
 
         log(LOG_TRACE, "Unlock Msg2: Serial is %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x %02x  \n",
             flash_id[0], flash_id[1], flash_id[2], flash_id[3],
@@ -283,6 +334,7 @@ void __time_critical_func(mc_unlock)(void) {
         log(LOG_TRACE, "Unlock Msg2: Unlock: %08x / %u\n", offset_u32, len);
         log(LOG_TRACE, "Unlock Msg2: Last cipher is %08x\n", card_cipher);
         log(LOG_TRACE, "Unlock Msg2: Key is %08x %08x %08x %08x %08x - len %u \n", a, b, c, d, e, len);
+        log(LOG_TRACE, "Unlock Msg2: Cipher took %u us\n", cipher_time);
     } else if (unlock_stage == 2) {
         /*uint8_t len = 0;
         gc_receiveOrNextCmd(&offset[3]);
@@ -4,7 +4,12 @@
 #include <stdint.h>
 
 // Function declarations
+void gc_unlock_init(void);
 void mc_unlock(void);
 void mc_unlock_stage_0(uint32_t offset_u32);
 
+// Card LFSR advanced by b steps, exnor_1st for the mirrored one the cipher starts from
+uint32_t exnor(uint32_t a, uint32_t b);
+uint32_t exnor_1st(uint32_t a, uint32_t b);
+
 #endif /* GC_UNLOCK_H */
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "gc_bitmap.h"
+
+#include <string.h>
+
+/* bits [off, off + n) of a leaf word, n is 1..32 */
+static inline uint32_t range_mask(uint32_t off, uint32_t n) {
+    return ((n == 32) ? ~0U : ((1U << n) - 1)) << off;
+}
+
+void gc_bitmap_clear_all(gc_bitmap_t *map) {
+    memset(map, 0, sizeof(*map));
+}
+
+void __time_critical_func(gc_bitmap_set_range)(gc_bitmap_t *map, uint32_t first, uint32_t count) {
+    if (first >= GC_BITMAP_BITS)
+        return;
+    if (count > GC_BITMAP_BITS - first)
+        count = GC_BITMAP_BITS - first;
+
+    while (count) {
+        uint32_t leaf = first / 32;
+        uint32_t n = 32 - first % 32;
+        if (n > count)
+            n = count;
+
+        uint32_t mask = range_mask(first % 32, n);
+        uint32_t old = map->leaf[leaf];
+        map->leaf[leaf] = old | mask;
+        map->count += (uint32_t)__builtin_popcount(mask & ~old);
+        map->summary[leaf / 32] |= 1U << (leaf % 32);
+        map->top |= 1U << (leaf / 32);
+
+        first += n;
+        count -= n;
+    }
+}
+
+void __time_critical_func(gc_bitmap_set)(gc_bitmap_t *map, uint32_t bit) {
+    gc_bitmap_set_range(map, bit, 1);
+}
+
+void __time_critical_func(gc_bitmap_clear_range)(gc_bitmap_t *map, uint32_t first, uint32_t count) {
+    if (first >= GC_BITMAP_BITS)
+        return;
+    if (count > GC_BITMAP_BITS - first)
+        count = GC_BITMAP_BITS - first;
+
+    while (count) {
+        uint32_t leaf = first / 32;
+        uint32_t n = 32 - first % 32;
+        if (n > count)
+            n = count;
+
+        uint32_t mask = range_mask(first % 32, n);
+        uint32_t old = map->leaf[leaf];
+        map->leaf[leaf] = old & ~mask;
+        map->count -= (uint32_t)__builtin_popcount(mask & old);
+        /* leaf first, so a reader never sees an empty summary over a non-empty leaf */
+        if (map->leaf[leaf] == 0) {
+            map->summary[leaf / 32] &= ~(1U << (leaf % 32));
+            if (map->summary[leaf / 32] == 0)
+                map->top &= ~(1U << (leaf / 32));
+        }
+
+        first += n;
+        count -= n;
+    }
+}
+
+void __time_critical_func(gc_bitmap_clear)(gc_bitmap_t *map, uint32_t bit) {
+    gc_bitmap_clear_range(map, bit, 1);
+}
+
+/* returns the first set bit >= from, or -1 */
+int32_t __time_critical_func(gc_bitmap_find_next)(const gc_bitmap_t *map, uint32_t from) {
+    while (from < GC_BITMAP_BITS) {
+        uint32_t leaf = from / 32;
+        uint32_t word = map->leaf[leaf] & (~0U << (from % 32));
+        if (word)
+            return (int32_t)(leaf * 32 + (uint32_t)__builtin_ctz(word));
+
+        /* rest of this summary word */
+        if (++leaf == GC_BITMAP_LEAVES)
+            return -1;
+        uint32_t summary = leaf / 32;
+        word = map->summary[summary] & (~0U << (leaf % 32));
+
+        if (!word) {
+            /* next non-empty summary word */
+            if (++summary == GC_BITMAP_SUMMARIES)
+                return -1;
+            uint32_t top = map->top & (~0U << summary);
+            if (!top)
+                return -1;
+            summary = (uint32_t)__builtin_ctz(top);
+            word = map->summary[summary];
+            if (!word) {
+                /* cleared under our feet, carry on behind it */
+                from = (summary + 1) * 32 * 32;
+                continue;
+            }
+        }
+
+        from = (summary * 32 + (uint32_t)__builtin_ctz(word)) * 32;
+    }
+    return -1;
+}
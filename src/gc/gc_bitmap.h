@@ -0,0 +1,37 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "pico/platform.h"
+
+/*
+* Two level summary over one bit per 512 byte sector of an 8 MB card.
+* A summary bit is set when its leaf word has any bit set, the top word
+* does the same for the summary words, so finding the next set bit is
+* at most three ctz scans instead of walking the whole map.
+*/
+#define GC_BITMAP_BITS          (8 * 1024 * 1024 / 512)
+#define GC_BITMAP_LEAVES        (GC_BITMAP_BITS / 32)
+#define GC_BITMAP_SUMMARIES     (GC_BITMAP_LEAVES / 32)
+
+typedef struct {
+    uint32_t top;
+    uint32_t summary[GC_BITMAP_SUMMARIES];
+    uint32_t leaf[GC_BITMAP_LEAVES];
+    uint32_t count;
+} gc_bitmap_t;
+
+static inline bool __time_critical_func(gc_bitmap_test)(const gc_bitmap_t *map, uint32_t bit) {
+    return ((const volatile uint32_t*)map->leaf)[bit / 32] & (1U << (bit % 32));
+}
+
+static inline uint32_t gc_bitmap_count(const gc_bitmap_t *map) {
+    return map->count;
+}
+
+void gc_bitmap_clear_all(gc_bitmap_t *map);
+void gc_bitmap_set(gc_bitmap_t *map, uint32_t bit);
+void gc_bitmap_set_range(gc_bitmap_t *map, uint32_t first, uint32_t count);
+void gc_bitmap_clear(gc_bitmap_t *map, uint32_t bit);
+void gc_bitmap_clear_range(gc_bitmap_t *map, uint32_t first, uint32_t count);
+int32_t gc_bitmap_find_next(const gc_bitmap_t *map, uint32_t from);
@@ -13,7 +13,9 @@
 #include "hardware/timer.h"
 
 #include "pico/platform.h"
+#include "gc_bitmap.h"
 #include "gc_dirty.h"
+#include "gc_journal.h"
 #include "psram/psram.h"
 
 #include "sd.h"
@@ -31,20 +33,46 @@
 #define SEGMENT_SIZE   (512)
 #define PAGE_SIZE      (128)
 
+/* the loader reads this much from SD at once, while the previous chunk is written to PSRAM */
+#define LOAD_CHUNK_SIZE     (8192)
+#define LOAD_CHUNK_SEGMENTS (LOAD_CHUNK_SIZE / SEGMENT_SIZE)
+/* PSRAM writes of a chunk are split so core 1 never waits long for the PSRAM */
+#define LOAD_DMA_SEGMENTS   (4)
+
+/* header, directory and FAT blocks, everything behind them is 0xFF on a fresh card */
+#define GC_SYSTEM_AREA_SIZE (5 * SECTOR_SIZE)
+
 
-#define CARD_HOME_GC        "MemoryCards/GC"
 #define CARD_HOME_LENGTH    (17)
 
 static int32_t segment_count = -1;
 
 
 #define SEGMENT_COUNT_4MB (8*1024*1024 / SEGMENT_SIZE)
-uint8_t gc_available_segments[SEGMENT_COUNT_4MB / 8];  // bitmap
+static gc_bitmap_t gc_unloaded_segments;  // not yet paged in from SD, everything else is in PSRAM
+static uint8_t gc_erased_segments[SEGMENT_COUNT_4MB / 8];  // bitmap, logically 0xFF and not materialized in PSRAM
 
 static uint8_t flushbuf[SEGMENT_SIZE];
+static uint8_t loadbuf[2][LOAD_CHUNK_SIZE];
+static int loadbuf_idx;
 int gc_cardman_fd = -1;
 
-static int32_t current_read_segment = 0, priority_segment = -1;
+/* first SD sector of the image if it is one contiguous extent, segment I/O then bypasses the FAT */
+static uint32_t card_lba;
+static bool card_lba_valid;
+
+/* chunk currently streamed from one of the loadbufs into PSRAM */
+static struct {
+    uint8_t *buf;
+    volatile uint32_t segment;
+    volatile uint32_t remaining;
+    volatile uint32_t in_flight;
+} psram_load;
+
+static int32_t current_read_segment = 0;
+static volatile int32_t priority_segment = -1;
+/* set once the whole image is in PSRAM, the bitmap is no longer consulted after that */
+static volatile bool all_segments_loaded;
 
 #define MAX_GAME_NAME_LENGTH (127)
 #define MAX_PREFIX_LENGTH    (4)
@@ -54,11 +82,14 @@ static int card_idx;
 static int card_chan;
 static bool needs_update;
 static uint32_t card_size;
+static uint16_t card_latency;
 static uint8_t card_enc = 0x1;
 static cardman_cb_t cardman_cb;
 static char folder_name[MAX_FOLDER_NAME_LENGTH];
 static char cardhome[CARD_HOME_LENGTH];
 static uint64_t cardprog_start;
+/* where the bulk load spends its time, the PSRAM stall is what the double buffering did not hide */
+static uint64_t load_sd_us, load_stall_us;
 static int cardman_segments_done;
 static uint32_t cardprog_pos;
 
@@ -153,19 +184,57 @@ static bool try_set_game_id_card() {
     return true;
 }
 
-int gc_cardman_read_segment(int segment, void *buf512) {
-    if (gc_cardman_fd < 0)
-        return -1;
+/* looks up where the image lives on the SD card, it has to be complete and preallocated by now */
+static void resolve_card_extent(void) {
+    uint32_t first, last;
 
-    if (sd_seek(gc_cardman_fd, segment * SEGMENT_SIZE, SEEK_SET) != 0)
-        return -1;
+    card_lba_valid = false;
+    /* anything SdFat still holds for the image must be on the card before it is bypassed */
+    sd_flush(gc_cardman_fd);
 
-    if (sd_read(gc_cardman_fd, buf512, SEGMENT_SIZE) != SEGMENT_SIZE)
-        return -1;
+    if ((sd_contiguous_range(gc_cardman_fd, &first, &last) != 0) || (last - first + 1 < card_size / SEGMENT_SIZE)) {
+        log(LOG_WARN, "card image is fragmented, using file I/O\n");
+        return;
+    }
+
+    card_lba = first;
+    card_lba_valid = true;
+    log(LOG_INFO, "card image at sector %u\n", card_lba);
+}
+
+static int card_read(uint32_t segment, void *buf, uint32_t count) {
+    if (card_lba_valid)
+        return sd_read_sectors(card_lba + segment, buf, count) ? 0 : -3;
+
+    if (sd_seek(gc_cardman_fd, (int32_t)(segment * SEGMENT_SIZE), SEEK_SET) != 0)
+        return -2;
+
+    if (sd_read(gc_cardman_fd, buf, count * SEGMENT_SIZE) != (int)(count * SEGMENT_SIZE))
+        return -3;
+
+    return 0;
+}
+
+static int card_write(uint32_t segment, void *buf, uint32_t count) {
+    if (card_lba_valid)
+        return sd_write_sectors(card_lba + segment, buf, count) ? 0 : -3;
+
+    if (sd_seek(gc_cardman_fd, (int32_t)(segment * SEGMENT_SIZE), SEEK_SET) != 0)
+        return -2;
+
+    if (sd_write(gc_cardman_fd, buf, count * SEGMENT_SIZE) != (int)(count * SEGMENT_SIZE))
+        return -3;
 
     return 0;
 }
 
+int gc_cardman_read_segment(int segment, void *buf512) {
+    if (gc_cardman_fd < 0)
+        return -1;
+
+    return (card_read((uint32_t)segment, buf512, 1) == 0) ? 0 : -1;
+}
+
 static bool try_set_next_named_card() {
     bool ret = false;
     if (cardman_state != GC_CM_STATE_NAMED) {
@@ -203,20 +272,30 @@ int gc_cardman_write_segment(int segment, void *buf512) {
     if (gc_cardman_fd < 0)
         return -1;
 
-    if (sd_seek(gc_cardman_fd, segment * SEGMENT_SIZE, SEEK_SET) != 0)
-        return -2;
+    return card_write((uint32_t)segment, buf512, 1);
+}
 
-    if (sd_write(gc_cardman_fd, buf512, SEGMENT_SIZE) != SEGMENT_SIZE)
-        return -3;
+int gc_cardman_write_segments(int segment, int count, void *buf) {
+    if (gc_cardman_fd < 0)
+        return -1;
 
-    return 0;
+    return card_write((uint32_t)segment, buf, (uint32_t)count);
 }
 
-
 int gc_cardman_write_page(int addr, void *buf128) {
     if (gc_cardman_fd < 0)
         return -1;
 
+    if (card_lba_valid) {
+        /* the file API would go through a cache that no longer sees the raw writes */
+        uint8_t segbuf[SEGMENT_SIZE];
+        uint32_t segment = (uint32_t)addr / SEGMENT_SIZE;
+        if (card_read(segment, segbuf, 1) != 0)
+            return -2;
+        memcpy(&segbuf[(uint32_t)addr % SEGMENT_SIZE], buf128, PAGE_SIZE);
+        return card_write(segment, segbuf, 1);
+    }
+
     if (sd_seek(gc_cardman_fd, addr, SEEK_SET) != 0)
         return -2;
 
@@ -226,20 +305,45 @@ int gc_cardman_write_page(int addr, void *buf128) {
     return 0;
 }
 
-bool gc_cardman_is_segment_available(uint32_t segment) {
-    return gc_available_segments[segment / 8] & (1U << (segment % 8));
+bool __time_critical_func(gc_cardman_is_segment_available)(uint32_t segment) {
+    if (all_segments_loaded || (segment >= GC_BITMAP_BITS))
+        return true;
+    return !gc_bitmap_test(&gc_unloaded_segments, segment);
+}
+
+void __time_critical_func(gc_cardman_mark_segment_available)(uint32_t segment) {
+    gc_bitmap_clear(&gc_unloaded_segments, segment);
+}
+
+void __time_critical_func(gc_cardman_mark_segments_available)(uint32_t segment, uint32_t count) {
+    gc_bitmap_clear_range(&gc_unloaded_segments, segment, count);
+}
+
+bool __time_critical_func(gc_cardman_is_segment_erased)(uint32_t segment) {
+    return ((volatile uint8_t*)gc_erased_segments)[segment / 8] & (1U << (segment % 8));
+}
+
+void __time_critical_func(gc_cardman_mark_segments_erased)(uint32_t segment, uint32_t count) {
+    if (((segment | count) % 8U) == 0) {
+        memset(&gc_erased_segments[segment / 8], 0xFF, count / 8U);
+    } else {
+        for (uint32_t i = segment; i < segment + count; i++)
+            gc_erased_segments[i / 8] |= (uint8_t)(1U << (i % 8U));
+    }
 }
 
-void gc_cardman_mark_segment_available(uint32_t segment) {
-    gc_available_segments[segment / 8] |= (uint8_t)(1U << (segment % 8U));
+void __time_critical_func(gc_cardman_clear_segment_erased)(uint32_t segment) {
+    gc_erased_segments[segment / 8] &= (uint8_t)~(1U << (segment % 8U));
 }
 
-void gc_cardman_set_priority_segment(uint32_t segment) {
+/* called from core 1 when the cube touches a segment that has not been loaded yet */
+void __time_critical_func(gc_cardman_set_priority_segment)(uint32_t segment) {
     priority_segment = (int32_t)segment;
 }
 
 void gc_cardman_flush(void) {
-    if (gc_cardman_fd >= 0)
+    /* raw sector writes are on the card already, there is no FAT or directory entry to update */
+    if ((gc_cardman_fd >= 0) && !card_lba_valid)
         sd_flush(gc_cardman_fd);
 }
 
@@ -363,22 +467,118 @@ static void genblock(size_t pos, void *vbuf) {
     }
 }
 
-static int next_segment_to_load() {
-    if (priority_segment != -1) {
-        if (gc_cardman_is_segment_available((uint32_t)priority_segment))
-            priority_segment = -1;
-        else
-            return priority_segment;
+/* reads one segment from SD and places it in PSRAM, unless core 1 claimed it in the meantime */
+static void load_segment(int32_t segment_idx) {
+    uint32_t pos = (uint32_t)segment_idx * SEGMENT_SIZE;
+    if (card_read((uint32_t)segment_idx, flushbuf, 1) != 0)
+        fatal("cannot read memcard\nread %u", pos);
+
+    log(LOG_TRACE, "Writing pos %u\n", pos);
+    gc_dirty_lock();
+    /* an erase may have overwritten the whole segment while we were reading it */
+    if (!gc_cardman_is_segment_available((uint32_t)segment_idx)) {
+        psram_write_dma(pos, flushbuf, SEGMENT_SIZE, NULL);
+        psram_wait_for_dma();
+        gc_cardman_mark_segment_available((uint32_t)segment_idx);
+    }
+    gc_dirty_unlock();
+}
+
+static void psram_load_start_locked(void);
+
+static void __time_critical_func(psram_load_done)(void) {
+    gc_cardman_mark_segments_available(psram_load.segment, psram_load.in_flight);
+    psram_load.buf += psram_load.in_flight * SEGMENT_SIZE;
+    psram_load.segment += psram_load.in_flight;
+    psram_load.remaining -= psram_load.in_flight;
+    psram_load.in_flight = 0;
+
+    /* chain the next part right from the irq, the lock stays with the loader until it is done */
+    if (psram_load.remaining)
+        psram_load_start_locked();
+    else
+        gc_dirty_unlock();
+}
+
+/*
+* Must be called with the dirty spinlock held, which is released once the DMA is done.
+* Never waits for the PSRAM, as this also runs from the DMA irq - if core 1 is
+* using it, psram_load_wait starts the part later.
+*/
+static void __time_critical_func(psram_load_start_locked)(void) {
+    /* erases may have claimed segments while the chunk was read from SD */
+    while (psram_load.remaining && gc_cardman_is_segment_available(psram_load.segment)) {
+        psram_load.buf += SEGMENT_SIZE;
+        psram_load.segment++;
+        psram_load.remaining--;
+    }
+
+    uint32_t count = 0;
+    while ((count < psram_load.remaining) && (count < LOAD_DMA_SEGMENTS)
+           && !gc_cardman_is_segment_available(psram_load.segment + count))
+        count++;
+
+    if (count == 0) {
+        gc_dirty_unlock();
+        return;
+    }
+
+    psram_load.in_flight = count;
+    if (!psram_try_write_dma(psram_load.segment * SEGMENT_SIZE, psram_load.buf, count * SEGMENT_SIZE, psram_load_done)) {
+        psram_load.in_flight = 0;
+        gc_dirty_unlock();
+    }
+}
+
+/* waits until the chunk in flight has completely landed in PSRAM */
+static void psram_load_wait(void) {
+    while (psram_load.remaining) {
+        if (psram_load.in_flight == 0) {
+            /* the last part could not get the PSRAM, the irq only chains while it holds the lock */
+            gc_dirty_lock();
+            psram_load_start_locked();
+        }
+    }
+}
+
+static void psram_load_start(uint8_t *buf, uint32_t segment, uint32_t count) {
+    psram_load.buf = buf;
+    psram_load.segment = segment;
+    psram_load.remaining = count;
+    psram_load.in_flight = 0;
+
+    gc_dirty_lock();
+    psram_load_start_locked();
+}
+
+static int32_t next_priority_segment() {
+    int32_t segment = priority_segment;
+
+    if ((segment != -1) && gc_cardman_is_segment_available((uint32_t)segment)) {
+        priority_segment = -1;
+        segment = -1;
     }
 
-    while (current_read_segment < segment_count) {
-        if (!gc_cardman_is_segment_available((uint32_t)current_read_segment))
-            return current_read_segment++;
-        else
-            current_read_segment++;
+    return segment;
+}
+
+/* finds the next run of segments still to be loaded, stopping at segments that are already there */
+static int32_t next_run_to_load(uint32_t *count) {
+    current_read_segment = gc_bitmap_find_next(&gc_unloaded_segments, (uint32_t)current_read_segment);
+
+    if ((current_read_segment == -1) || (current_read_segment >= segment_count)) {
+        current_read_segment = segment_count;
+        return -1;
     }
 
-    return -1;
+    int32_t first = current_read_segment;
+    while ((current_read_segment < segment_count)
+           && (current_read_segment - first < LOAD_CHUNK_SEGMENTS)
+           && !gc_cardman_is_segment_available((uint32_t)current_read_segment))
+        current_read_segment++;
+
+    *count = (uint32_t)(current_read_segment - first);
+    return first;
 }
 
 static void gc_cardman_continue(void) {
@@ -389,45 +589,53 @@ static void gc_cardman_continue(void) {
         while ((time_us_64() - slice_start < MAX_SLICE_LENGTH)) {
             log(LOG_TRACE, "Slice!\n");
 
-            gc_dirty_lock();
-            int32_t segment_idx = next_segment_to_load();
+            /* keeps the ring from overflowing and erased segments from being loaded */
+            gc_dirty_drain();
+
+            /* core 1 is waiting for this one, don't make it wait for a whole chunk */
+            int32_t segment_idx = next_priority_segment();
+            if (segment_idx != -1) {
+                load_segment(segment_idx);
+                cardman_segments_done++;
+                continue;
+            }
+
+            uint32_t count = 0;
+            segment_idx = next_run_to_load(&count);
             if (segment_idx == -1) {
-                gc_dirty_unlock();
+                psram_load_wait();
+                all_segments_loaded = true;
                 cardman_operation = CARDMAN_IDLE;
                 uint64_t end = time_us_64();
 
                 log(LOG_INFO, "took = %.2f s; SD read speed = %.2f kB/s\n", (double)(end - cardprog_start) / 1e6,
                     1000000.0 * card_size / (double)(end - cardprog_start) / 1024);
+                log(LOG_INFO, "SD reads %.2f s, waited for PSRAM %.2f ms\n", (double)load_sd_us / 1e6,
+                    (double)load_stall_us / 1e3);
                 if (cardman_cb)
                     cardman_cb(100, true);
                 break;
             }
 
+            /* the previous chunk keeps streaming into PSRAM while this one is read */
             uint32_t pos = (uint32_t)segment_idx * SEGMENT_SIZE;
-            if (sd_seek(gc_cardman_fd, (int32_t)pos, 0) != 0)
-                fatal("cannot read memcard\nseek");
-
-            if (sd_read(gc_cardman_fd, flushbuf, SEGMENT_SIZE) != SEGMENT_SIZE)
+            uint8_t *buf = loadbuf[loadbuf_idx];
+            loadbuf_idx ^= 1;
+            uint64_t sd_start = time_us_64();
+            if (card_read((uint32_t)segment_idx, buf, count) != 0)
                 fatal("cannot read memcard\nread %u", pos);
 
-            log(LOG_TRACE, "Writing pos %u\n", pos);
-            psram_write_dma(pos, flushbuf, SEGMENT_SIZE, NULL);
-
-            if (segment_idx == 0) {
-                card_enc = flushbuf[37];
-            }
-
-            psram_wait_for_dma();
-
-            gc_cardman_mark_segment_available((uint32_t)segment_idx);
-            gc_dirty_unlock();
+            uint64_t stall_start = time_us_64();
+            psram_load_wait();
+            load_stall_us += time_us_64() - stall_start;
+            load_sd_us += stall_start - sd_start;
+            psram_load_start(buf, (uint32_t)segment_idx, count);
 
+            cardman_segments_done += (int)count;
             cardprog_pos = (uint32_t)cardman_segments_done * SEGMENT_SIZE;
 
             if (cardman_cb)
                 cardman_cb((int)(100 * (uint64_t)cardprog_pos / (uint64_t)card_size), false);
-
-            cardman_segments_done++;
         }
         log(LOG_TRACE, "%s:%u\n", __func__, __LINE__);
 
@@ -435,9 +643,9 @@ static void gc_cardman_continue(void) {
         uint64_t slice_start = time_us_64();
         while ((time_us_64() - slice_start < MAX_SLICE_LENGTH)) {
             cardprog_pos = (uint32_t)cardman_segments_done * SEGMENT_SIZE;
-            sd_seek(gc_cardman_fd, (int32_t)(cardprog_pos * SEGMENT_SIZE), SEEK_SET);
             if (cardprog_pos >= card_size) {
-                sd_flush(gc_cardman_fd);
+                /* the image has its final size now, later flushes can go around the FAT */
+                resolve_card_extent();
                 log(LOG_INFO, "OK!\n");
 
                 cardman_operation = CARDMAN_IDLE;
@@ -451,23 +659,28 @@ static void gc_cardman_continue(void) {
                 break;
             }
 
-                psram_wait_for_dma();
-                gc_dirty_lock();
-
-                // read back from PSRAM to make sure to retain already rewritten segments, if any
-                psram_read_dma(cardprog_pos, flushbuf, SEGMENT_SIZE, NULL);
-                psram_wait_for_dma();
-
-                if (sd_write(gc_cardman_fd, flushbuf, SEGMENT_SIZE) != SEGMENT_SIZE)
-                    fatal("cannot init memcard");
+            /*
+             * The image is written from the template, not read back from PSRAM:
+             * anything core 1 changed in the meantime is marked dirty and
+             * flushed on top once the card is idle.
+             */
+            uint8_t *buf = loadbuf[1];
+            if (cardprog_pos < GC_SYSTEM_AREA_SIZE) {
+                buf = loadbuf[0];
+                for (uint32_t i = 0; i < LOAD_CHUNK_SIZE; i += SEGMENT_SIZE)
+                    genblock(cardprog_pos + i, &buf[i]);
+            }
 
-                gc_dirty_unlock();
+            if (sd_seek(gc_cardman_fd, (int32_t)cardprog_pos, SEEK_SET) != 0)
+                fatal("cannot init memcard\nseek");
 
+            if (sd_write(gc_cardman_fd, buf, LOAD_CHUNK_SIZE) != LOAD_CHUNK_SIZE)
+                fatal("cannot init memcard");
 
             if (cardman_cb)
                 cardman_cb((int)(100U * (uint64_t)cardprog_pos / (uint64_t)card_size), cardman_operation == CARDMAN_IDLE);
 
-            cardman_segments_done++;
+            cardman_segments_done += LOAD_CHUNK_SEGMENTS;
         }
         sd_flush(gc_cardman_fd);
 
@@ -478,6 +691,8 @@ static void gc_cardman_continue(void) {
 
 void gc_cardman_open(void) {
     char path[256];
+    char journal_path[256];
+    uint64_t open_start = time_us_64();
 
     needs_update = false;
 
@@ -485,6 +700,7 @@ void gc_cardman_open(void) {
     ensuredirs();
 
     snprintf(path, sizeof(path), "%s/%s/%s-%d.raw", cardhome, folder_name, folder_name, card_chan);
+    snprintf(journal_path, sizeof(journal_path), "%s/%s/%s-%d.jnl", cardhome, folder_name, folder_name, card_chan);
     /* this is ok to do on every boot because it wouldn't update if the value is the same as currently stored */
     settings_set_gc_last_card((uint8_t)cardman_state, card_idx, card_chan, folder_name);
     update_encoding();
@@ -492,6 +708,15 @@ void gc_cardman_open(void) {
     log(LOG_INFO, "Switching to card path = %s\n", path);
     gc_mc_data_interface_card_changed();
 
+    uint16_t flush_lockout, flush_time_slice;
+    card_config_get_flush_policy(folder_name, folder_name, &flush_lockout, &flush_time_slice);
+    gc_dirty_card_changed(flush_lockout, flush_time_slice);
+
+    /* the card's own profile wins over the global one */
+    card_latency = card_config_get_gc_latency(folder_name, folder_name);
+    if (card_latency == 0U)
+        card_latency = settings_get_gc_latency();
+
     if (!sd_exists(path)) {
         card_size = card_config_get_gc_cardsize(folder_name, folder_name) * 1024 * 1024 / 8;
         if (card_size == 0U) {
@@ -505,20 +730,33 @@ void gc_cardman_open(void) {
         if (gc_cardman_fd < 0)
             fatal("cannot open for creating new card (%s), size %d", path, card_size);
 
+        if (settings_get_gc_journal())
+            gc_journal_open(journal_path, false);
+
         log(LOG_INFO, "create new image at %s... ", path);
 
         if (cardman_cb)
             cardman_cb(0, false);
-        // quickly generate and write an empty card into PSRAM so that it's immediately available, takes about ~0.6s
-        for (size_t pos = 0; pos < card_size; pos += SEGMENT_SIZE) {
-            genblock(pos, flushbuf);
+        if (sd_preallocate(gc_cardman_fd, card_size) != 0) {
+            log(LOG_WARN, "cannot preallocate %u bytes, writing unallocated\n", card_size);
+        }
 
-            gc_dirty_lock();
+        // quickly generate and write an empty card into PSRAM so that it's immediately available
+        // only the system area differs from the erased state, the rest is filled by DMA
+        gc_dirty_lock();
+        for (uint32_t pos = 0; pos < GC_SYSTEM_AREA_SIZE; pos += SEGMENT_SIZE) {
+            genblock(pos, flushbuf);
             psram_write_dma(pos, flushbuf, SEGMENT_SIZE, NULL);
             psram_wait_for_dma();
-            gc_cardman_mark_segment_available(pos / SEGMENT_SIZE);
-            gc_dirty_unlock();
         }
+        for (uint32_t pos = GC_SYSTEM_AREA_SIZE; pos < card_size; pos += LOAD_CHUNK_SIZE) {
+            psram_fill_dma(pos, 0xFF, LOAD_CHUNK_SIZE, NULL);
+            psram_wait_for_dma();
+        }
+        gc_cardman_mark_segments_available(0, card_size / SEGMENT_SIZE);
+        gc_dirty_unlock();
+
+        memset(loadbuf[1], 0xFF, LOAD_CHUNK_SIZE);
         log(LOG_TRACE, "%s created empty PSRAM image... \n", __func__);
         cardprog_start = time_us_64();
 
@@ -545,27 +783,45 @@ void gc_cardman_open(void) {
         if (gc_cardman_fd < 0)
             fatal("cannot open card");
 
+        resolve_card_extent();
+
+        /* saves that were interrupted by a power loss go into the image before anything is read */
+        if (settings_get_gc_journal())
+            gc_journal_open(journal_path, true);
+
+        /* the header is needed right away for the encoding, the rest is paged in on demand */
+        load_segment(0);
+        card_enc = flushbuf[37];
+        cardman_segments_done = 1;
+
         /* read 8 megs of card image */
         log(LOG_INFO, "reading card (%lu KB).... ", (uint32_t)(card_size / 1024));
         cardprog_start = time_us_64();
+        load_sd_us = load_stall_us = 0;
         if (cardman_cb)
             cardman_cb(0, false);
     }
 
     segment_count = (int32_t)(card_size / SEGMENT_SIZE);
 
-    log(LOG_INFO, "Open Finished!\n");
+    log(LOG_INFO, "Open Finished! Accessible after %u us\n", (uint32_t)(time_us_64() - open_start));
+    (void)open_start;
 }
 
 void gc_cardman_close(void) {
     if (gc_cardman_fd < 0)
         return;
+    psram_load_wait();
+    gc_journal_close();
     gc_cardman_flush();
     sd_close(gc_cardman_fd);
     gc_cardman_fd = -1;
+    card_lba_valid = false;
     current_read_segment = 0;
     priority_segment = -1;
-    memset(gc_available_segments, 0, sizeof(gc_available_segments));
+    all_segments_loaded = false;
+    gc_bitmap_set_range(&gc_unloaded_segments, 0, GC_BITMAP_BITS);
+    memset(gc_erased_segments, 0, sizeof(gc_erased_segments));
 }
 
 void gc_cardman_set_channel(uint16_t chan_num) {
@@ -699,6 +955,11 @@ uint32_t gc_cardman_get_card_size(void) {
     return card_size;
 }
 
+/* read latency in bytes the card should be advertised with, 0 for the default */
+uint16_t gc_cardman_get_latency(void) {
+    return card_latency;
+}
+
 const char *gc_cardman_get_folder_name(void) {
     return folder_name;
 }
@@ -716,8 +977,9 @@ bool gc_cardman_needs_update(void) {
     return needs_update;
 }
 
+/* the card can be served while it is still being loaded, missing segments are paged in on demand */
 bool __time_critical_func(gc_cardman_is_accessible)(void) {
-    return true;
+    return (gc_cardman_fd >= 0) && (cardman_operation != CARDMAN_SD);
 }
 
 bool gc_cardman_is_idle(void) {
@@ -740,6 +1002,7 @@ void gc_cardman_set_sd_mode(bool sd_mode) {
 }
 
 void gc_cardman_init(void) {
+    gc_bitmap_set_range(&gc_unloaded_segments, 0, GC_BITMAP_BITS);
     cardman_operation = CARDMAN_IDLE;
     cardman_state = GC_CM_STATE_NORMAL;
     set_default_card();
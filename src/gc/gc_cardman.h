@@ -7,6 +7,9 @@
 
 #define GC_CARD_IDX_SPECIAL 0
 
+/* every card image and journal lives below this folder on the SD card */
+#define CARD_HOME_GC        "MemoryCards/GC"
+
 typedef enum  {
     GC_CM_STATE_NAMED,
     GC_CM_STATE_GAMEID,
@@ -19,16 +22,22 @@ void gc_cardman_init(void);
 void gc_cardman_task(void);
 int gc_cardman_read_segment(int segment, void *buf512);
 int gc_cardman_write_segment(int segment, void *buf512);
+int gc_cardman_write_segments(int segment, int count, void *buf);
 int gc_cardman_write_page(int addr, void *buf128);
 bool gc_cardman_is_segment_available(uint32_t segment);
 void gc_cardman_mark_segment_available(uint32_t segment);
+void gc_cardman_mark_segments_available(uint32_t segment, uint32_t count);
 void gc_cardman_set_priority_segment(uint32_t segment);
+bool gc_cardman_is_segment_erased(uint32_t segment);
+void gc_cardman_mark_segments_erased(uint32_t segment, uint32_t count);
+void gc_cardman_clear_segment_erased(uint32_t segment);
 void gc_cardman_flush(void);
 void gc_cardman_open(void);
 void gc_cardman_close(void);
 int gc_cardman_get_idx(void);
 int gc_cardman_get_channel(void);
 uint32_t gc_cardman_get_card_size(void);
+uint16_t gc_cardman_get_latency(void);
 
 void gc_cardman_set_channel(uint16_t num);
 void gc_cardman_next_channel(void);
@@ -1,131 +1,408 @@
 #include "gc_dirty.h"
+#include "gc_bitmap.h"
+#include "gc_journal.h"
 #include "psram.h"
 #include "gc_cardman.h"
 #include "debug.h"
 
-#include "bigmem.h"
-#define dirty_heap bigmem.gc.dirty_heap
-#define dirty_map bigmem.gc.dirty_map
-
 #include <hardware/sync.h>
 #include <pico/platform.h>
 #include <stdio.h>
+#include <string.h>
 
 spin_lock_t *gc_dirty_spin_lock;
 volatile uint32_t gc_dirty_lockout;
 int gc_dirty_activity = 0;
 
-static int num_dirty;
+/* quiet time before flushing and how long one flush may run, learned from the gaps unless set per card */
+#define LOCKOUT_DEFAULT_MS      100
+#define LOCKOUT_MIN_MS          20
+#define LOCKOUT_MAX_MS          1000
+#define TIME_SLICE_DEFAULT_MS   100
+#define TIME_SLICE_MIN_MS       20
+#define TIME_SLICE_MAX_MS       100
+#define POLICY_MIN_SAMPLES      16
+#define POLICY_PERCENTILE       90
+#define POLICY_MAX_SAMPLES      1024
 
-#define SWAP(a, b) do { \
-    uint16_t tmp = a; \
-    a = b; \
-    b = tmp; \
-} while (0);
+volatile uint32_t gc_dirty_lockout_ms = LOCKOUT_DEFAULT_MS;
+volatile uint32_t gc_dirty_last_access;
+volatile uint32_t gc_dirty_gap_hist[GC_DIRTY_GAP_BUCKETS];
 
-static inline bool dirty_map_is_marked(uint32_t sector) {
-    return dirty_map[sector / 8] & (1 << (sector % 8));
-}
+static uint32_t time_slice_ms = TIME_SLICE_DEFAULT_MS;
+static uint32_t lockout_override, time_slice_override;
+static uint32_t gap_samples;
 
-static inline void dirty_map_mark_sector(uint32_t sector) {
-    dirty_map[sector / 8] |= (1 << (sector % 8));
-}
+/* sd write time of each flushed run, in log2 us buckets */
+#define FLUSH_LATENCY_BUCKETS   24
+static uint32_t flush_latency_hist[FLUSH_LATENCY_BUCKETS];
+static uint32_t flush_latency_max;
 
-static inline void dirty_map_unmark_sector(uint32_t sector) {
-    dirty_map[sector / 8] &= ~(1 << (sector % 8));
-}
+/* only touched by core 0, core 1 goes through the ring below */
+static gc_bitmap_t dirty_map;
+/* sectors are flushed in ascending order, starting over at the front once the end is reached */
+static uint32_t flush_cursor;
+
+/* longest run of sectors written to sd at once, one erase sector */
+#define MAX_FLUSH_RUN   GC_JOURNAL_MAX_RUN
+
+/* the last pass ran out of journal space, or its commit record could not be written */
+static bool journal_full;
+static bool commit_pending;
 
 void gc_dirty_init(void) {
     gc_dirty_spin_lock = spin_lock_init(spin_lock_claim_unused(1));
 }
 
+/*
+* Core 1 hands written sectors to core 0 through a single producer, single consumer
+* ring, so it never has to wait for the flush. head and tail only ever count up and
+* double as sequence numbers: a sector that is rewritten while it is being flushed
+* gets posted again behind the point the flush started from, and is simply marked
+* dirty once more when core 0 drains the ring.
+*
+* Erases are posted as a range, an entry with DIRTY_RING_RANGE set holds the first
+* sector and is followed by one holding the count.
+*/
+#define DIRTY_RING_SIZE     1024
+#define DIRTY_RING_MASK     (DIRTY_RING_SIZE - 1)
+#define DIRTY_RING_RANGE    0x8000
+
+static uint16_t dirty_ring[DIRTY_RING_SIZE];
+static volatile uint32_t dirty_ring_head;
+static volatile uint32_t dirty_ring_tail;
+/* ring ran full, core 0 has to rescan the card */
+static volatile bool dirty_ring_overflow;
+static uint32_t dirty_ring_overflows;
+/* last single sector core 1 posted, a count entry may hold the same value */
+static uint32_t dirty_ring_last = UINT32_MAX;
+
+// Core 1
 void __time_critical_func(gc_dirty_mark)(uint32_t sector) {
-    if (sector < (sizeof(dirty_map) * 8) ) {
-        /* already marked? */
-        if (dirty_map_is_marked(sector))
-            return;
-
-        /* update map */
-        dirty_map_mark_sector(sector);
-
-        /* update heap */
-        int cur = num_dirty++;
-        dirty_heap[cur] = sector;
-        while (dirty_heap[cur] < dirty_heap[(cur-1)/2]) {
-            SWAP(dirty_heap[cur], dirty_heap[(cur-1)/2]);
-            cur = (cur-1)/2;
-        }
+    if (sector >= GC_BITMAP_BITS)
+        return;
+
+    uint32_t head = dirty_ring_head;
+
+    /* the cube writes a page in several pieces, no need to post it again while it's still queued */
+    if ((head != dirty_ring_tail) && (dirty_ring_last == sector))
+        return;
+
+    if (head - dirty_ring_tail >= DIRTY_RING_SIZE) {
+        dirty_ring_overflow = true;
+        return;
     }
+
+    dirty_ring[head & DIRTY_RING_MASK] = (uint16_t)sector;
+    dirty_ring_last = sector;
+    __mem_fence_release();
+    dirty_ring_head = head + 1;
 }
 
-static void heapify(int i) {
-    int l = i * 2 + 1;
-    int r = i * 2 + 2;
-    int best = i;
-    if (l < num_dirty && dirty_heap[l] < dirty_heap[best])
-        best = l;
-    if (r < num_dirty && dirty_heap[r] < dirty_heap[best])
-        best = r;
-    if (best != i) {
-        SWAP(dirty_heap[i], dirty_heap[best]);
-        heapify(best);
+/* the sectors are erased already, core 0 stops the loader from paging them in and flushes them */
+void __time_critical_func(gc_dirty_mark_range)(uint32_t first, uint32_t count) {
+    if ((first >= GC_BITMAP_BITS) || (count == 0))
+        return;
+    if (count > GC_BITMAP_BITS - first)
+        count = GC_BITMAP_BITS - first;
+
+    uint32_t head = dirty_ring_head;
+
+    if (head - dirty_ring_tail > DIRTY_RING_SIZE - 2) {
+        dirty_ring_overflow = true;
+        return;
+    }
+
+    dirty_ring[head & DIRTY_RING_MASK] = (uint16_t)(DIRTY_RING_RANGE | first);
+    dirty_ring[(head + 1) & DIRTY_RING_MASK] = (uint16_t)count;
+    dirty_ring_last = UINT32_MAX;
+    __mem_fence_release();
+    dirty_ring_head = head + 2;
+}
+
+// Core 0
+
+/* erased segments need no loading anymore, the loader checks for that with the lock held */
+static void gc_dirty_claim_erased(uint32_t first, uint32_t count) {
+    gc_dirty_lock();
+    gc_cardman_mark_segments_available(first, count);
+    gc_dirty_unlock();
+}
+
+/* marks every sector of the card that is present in PSRAM or erased */
+void gc_dirty_mark_card(void) {
+    uint32_t sectors = gc_cardman_get_card_size() / 512;
+
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        if (gc_cardman_is_segment_erased(sector) && !gc_cardman_is_segment_available(sector))
+            gc_dirty_claim_erased(sector, 1);
+        if (gc_cardman_is_segment_available(sector))
+            gc_bitmap_set(&dirty_map, sector);
+    }
+}
+
+void gc_dirty_drain(void) {
+    if (dirty_ring_overflow) {
+        /* clear first, anything dropped after this is caught by the next rescan */
+        dirty_ring_overflow = false;
+        __mem_fence_acquire();
+        ++dirty_ring_overflows;
+        DPRINTF("dirty ring overflow (%u), rescanning card\n", dirty_ring_overflows);
+        gc_dirty_mark_card();
+    }
+
+    uint32_t head = dirty_ring_head;
+    __mem_fence_acquire();
+
+    uint32_t tail = dirty_ring_tail;
+    while (tail != head) {
+        uint16_t entry = dirty_ring[tail & DIRTY_RING_MASK];
+
+        if (entry & DIRTY_RING_RANGE) {
+            uint32_t first = entry & ~DIRTY_RING_RANGE;
+            uint32_t count = dirty_ring[(tail + 1) & DIRTY_RING_MASK];
+
+            gc_dirty_claim_erased(first, count);
+            gc_bitmap_set_range(&dirty_map, first, count);
+            tail += 2;
+        } else {
+            gc_bitmap_set(&dirty_map, entry);
+            tail++;
+        }
+        __mem_fence_release();
+        dirty_ring_tail = tail;
     }
 }
 
 int gc_dirty_get_marked(void) {
-    if (num_dirty == 0)
+    int32_t sector = gc_bitmap_find_next(&dirty_map, flush_cursor);
+    if (sector == -1)
+        sector = gc_bitmap_find_next(&dirty_map, 0);
+    if (sector == -1)
         return -1;
 
-    uint16_t ret = dirty_heap[0];
+    gc_bitmap_clear(&dirty_map, (uint32_t)sector);
+    flush_cursor = (uint32_t)sector + 1;
+
+    return sector;
+}
+
+/* upper bound of the bucket holding the given percentile, buckets being [2^(i+shift), 2^(i+shift+1)) */
+static uint32_t hist_percentile(const volatile uint32_t *hist, int buckets, int shift, uint32_t percentile) {
+    uint32_t total = 0;
+    for (int i = 0; i < buckets; i++)
+        total += hist[i];
+    if (total == 0)
+        return 0;
+
+    uint32_t limit = (total * percentile + 99) / 100;
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < buckets - 1; i++) {
+        sum += hist[i];
+        if (sum >= limit)
+            break;
+    }
+    return 1U << (i + shift + 1);
+}
+
+static void gc_dirty_update_policy(void) {
+    uint32_t total = 0;
+    for (int i = 0; i < GC_DIRTY_GAP_BUCKETS; i++)
+        total += gc_dirty_gap_hist[i];
+    if (total == gap_samples)
+        return;
+
+    /* slowly forget older saves, core 1 may lose a count here which does not matter */
+    if (total > POLICY_MAX_SAMPLES) {
+        total = 0;
+        for (int i = 0; i < GC_DIRTY_GAP_BUCKETS; i++) {
+            gc_dirty_gap_hist[i] /= 2;
+            total += gc_dirty_gap_hist[i];
+        }
+    }
+    gap_samples = total;
+
+    uint32_t lockout = gc_dirty_lockout_ms;
+    if (lockout_override) {
+        lockout = lockout_override;
+    } else if (total >= POLICY_MIN_SAMPLES) {
+        /* outlast nearly all pauses a game makes within one save */
+        lockout = hist_percentile(gc_dirty_gap_hist, GC_DIRTY_GAP_BUCKETS, 1, POLICY_PERCENTILE);
+        if (lockout < LOCKOUT_MIN_MS)
+            lockout = LOCKOUT_MIN_MS;
+        if (lockout > LOCKOUT_MAX_MS)
+            lockout = LOCKOUT_MAX_MS;
+    }
+
+    uint32_t slice = time_slice_override;
+    if (!slice) {
+        /* a game that pauses longer leaves more room to flush in one go */
+        slice = lockout;
+        if (slice < TIME_SLICE_MIN_MS)
+            slice = TIME_SLICE_MIN_MS;
+        if (slice > TIME_SLICE_MAX_MS)
+            slice = TIME_SLICE_MAX_MS;
+    }
+
+    if ((lockout != gc_dirty_lockout_ms) || (slice != time_slice_ms)) {
+        DPRINTF("flush policy: lockout %u ms, time slice %u ms (%u gaps)\n", lockout, slice, total);
+    }
+    gc_dirty_lockout_ms = lockout;
+    time_slice_ms = slice;
+}
+
+static void gc_dirty_record_latency(uint32_t us) {
+    int bucket = 31 - __builtin_clz(us | 1);
+    if (bucket >= FLUSH_LATENCY_BUCKETS)
+        bucket = FLUSH_LATENCY_BUCKETS - 1;
+    flush_latency_hist[bucket]++;
+    if (us > flush_latency_max)
+        flush_latency_max = us;
+}
+
+/* reports the policy of the previous card and applies the overrides of the new one, 0 means adaptive */
+void gc_dirty_card_changed(uint32_t lockout_ms, uint32_t slice_ms) {
+    if (flush_latency_max) {
+        DPRINTF("Flush: lockout %u ms, time slice %u ms, run latency p50 %u us, p90 %u us, p99 %u us, max %u us\n",
+                gc_dirty_lockout_ms, time_slice_ms,
+                hist_percentile(flush_latency_hist, FLUSH_LATENCY_BUCKETS, 0, 50),
+                hist_percentile(flush_latency_hist, FLUSH_LATENCY_BUCKETS, 0, 90),
+                hist_percentile(flush_latency_hist, FLUSH_LATENCY_BUCKETS, 0, 99),
+                flush_latency_max);
+    }
 
-    /* update heap */
-    dirty_heap[0] = dirty_heap[--num_dirty];
-    heapify(0);
+    memset(flush_latency_hist, 0, sizeof(flush_latency_hist));
+    flush_latency_max = 0;
+    for (int i = 0; i < GC_DIRTY_GAP_BUCKETS; i++)
+        gc_dirty_gap_hist[i] = 0;
+    gap_samples = 0;
 
-    /* update map */
-    dirty_map_unmark_sector(ret);
+    lockout_override = lockout_ms;
+    time_slice_override = slice_ms;
+    gc_dirty_lockout_ms = lockout_ms ? lockout_ms : LOCKOUT_DEFAULT_MS;
+    time_slice_ms = slice_ms ? slice_ms : TIME_SLICE_DEFAULT_MS;
+}
 
-    return ret;
+/* erased sectors are not materialized in psram, they are all 0xFF */
+static void gc_dirty_read_sector(int sector, uint8_t *buf) {
+    if (gc_cardman_is_segment_erased((uint32_t)sector)) {
+        memset(buf, 0xFF, 512);
+    } else {
+        psram_read_dma((uint32_t)sector * 512, buf, 512, NULL);
+        psram_wait_for_dma();
+    }
+}
+
+/* pops the next sector if it continues the current run and copies it from psram */
+static bool gc_dirty_get_next_in_run(int sector, uint8_t *buf) {
+    if ((sector < GC_BITMAP_BITS) && gc_bitmap_test(&dirty_map, (uint32_t)sector)) {
+        gc_bitmap_clear(&dirty_map, (uint32_t)sector);
+        flush_cursor = (uint32_t)sector + 1;
+        gc_dirty_read_sector(sector, buf);
+        return true;
+    }
+
+    return false;
+}
+
+/*
+* Appends the run to the journal if there is one, writes it in place otherwise.
+* With a journal the card image is only ever written by compaction, a sector
+* written in place could be overwritten by an older record of it on replay.
+*/
+static int gc_dirty_write_run(int sector, int count, uint8_t *buf) {
+    if (gc_journal_is_active())
+        return gc_journal_append((uint32_t)sector, (uint32_t)count, buf);
+
+    return gc_cardman_write_segments(sector, count, buf);
+}
+
+/*
+* Passes are only committed as a whole. A pass that fails to append ends early
+* and commits what it has, the journal is compacted before the next one starts.
+* Returns false if the journal is not ready for a new pass yet.
+*/
+static bool gc_dirty_journal_prepare(void) {
+    if (commit_pending) {
+        if (gc_journal_commit() != 0)
+            return false;
+        commit_pending = false;
+    }
+    if (journal_full) {
+        gc_journal_compact(UINT32_MAX);
+        if (gc_journal_needs_compaction())
+            return false;
+        journal_full = false;
+    }
+    return true;
 }
 
 /* this goes through blocks in psram marked as dirty and flushes them to sd */
 void gc_dirty_task(void) {
-    static uint8_t flushbuf[512];
+    /* contiguous dirty sectors are collected here and written with a single write */
+    static uint8_t flushbuf[MAX_FLUSH_RUN * 512];
 
     int num_after = 0;
     int hit = 0;
+    int runs = 0;
     uint64_t start = time_us_64();
+    uint64_t write_time = 0;
     int ret = 0;
+
+    gc_dirty_update_policy();
+    gc_dirty_drain();
+    num_after = (int)gc_bitmap_count(&dirty_map);
+
+    bool journal = gc_journal_is_active();
+    if (!journal)
+        journal_full = commit_pending = false;
+
     while (1) {
         if (!gc_dirty_lockout_expired())
             break;
-        /* do up to 100ms of work per call to dirty_taks */
-        if ((time_us_64() - start) > 100 * 1000)
+        if (journal && !gc_dirty_journal_prepare())
+            break;
+        /* do up to one time slice of work per call to dirty_taks */
+        if ((time_us_64() - start) > (uint64_t)time_slice_ms * 1000)
             break;
 
-        gc_dirty_lock();
+        gc_dirty_drain();
         int sector = gc_dirty_get_marked();
-        num_after = num_dirty;
         if (sector == -1) {
-            gc_dirty_unlock();
+            num_after = (int)gc_bitmap_count(&dirty_map);
             break;
         }
-        psram_read_dma(sector * 512, flushbuf, 512, NULL);
-        psram_wait_for_dma();
-        gc_dirty_unlock();
+        gc_dirty_read_sector(sector, flushbuf);
+
+        int count = 1;
+        while ((count < MAX_FLUSH_RUN) && gc_dirty_get_next_in_run(sector + count, &flushbuf[count * 512]))
+            ++count;
+        num_after = (int)gc_bitmap_count(&dirty_map);
 
-        ++hit;
-        ret = gc_cardman_write_segment(sector, flushbuf);
+        hit += count;
+        ++runs;
+        uint64_t write_start = time_us_64();
+        ret = gc_dirty_write_run(sector, count, flushbuf);
+        uint64_t run_time = time_us_64() - write_start;
+        write_time += run_time;
+        gc_dirty_record_latency((uint32_t)run_time);
 
         if (ret != 0) {
             // TODO: do something if we get too many errors?
-            // for now lets push it back into the heap and try again later
-            DPRINTF("!! writing sector 0x%x failed: %i\n", sector, ret);
+            // for now lets mark them dirty again and try again later
+            DPRINTF("!! writing sectors 0x%x-0x%x failed: %i\n", sector, sector + count - 1, ret);
             DPRINTF("Adress: 0x%08x\n", sector * 512);
 
-            gc_dirty_lock();
-            gc_dirty_mark(sector);
-            gc_dirty_unlock();
+            for (int i = 0; i < count; i++)
+                gc_bitmap_set(&dirty_map, (uint32_t)(sector + i));
+            num_after = (int)gc_bitmap_count(&dirty_map);
+
+            /* the pass ends here, what made it into the journal is committed below */
+            if (journal) {
+                journal_full = (ret == -1);
+                break;
+            }
         }
     }
 
@@ -133,11 +410,29 @@ void gc_dirty_task(void) {
 
     if (hit) {
         /* to make sure writes hit the storage medium */
-        gc_cardman_flush();
-        DPRINTF("remain to flush - %d - this one flushed %d and took %d ms\n", num_after, hit, (int)((end - start) / 1000));
+        if (journal) {
+            ret = gc_journal_commit();
+            if (ret != 0) {
+                /* the records stay in the journal, the commit is retried before the next pass */
+                DPRINTF("!! journal commit failed: %i\n", ret);
+                commit_pending = true;
+            }
+        } else {
+            gc_cardman_flush();
+        }
+        DPRINTF("remain to flush - %d - this one flushed %d in %d runs and took %d ms (%d kB/s)\n", num_after, hit, runs,
+                (int)((end - start) / 1000), write_time ? (int)((uint64_t)hit * 512 * 1000 / 1024 * 1000 / write_time) : 0);
+    }
+
+    /* fold the journal into the card image while the cube leaves us alone */
+    if (!num_after && gc_dirty_lockout_expired() && gc_journal_needs_compaction()) {
+        uint64_t elapsed = time_us_64() - start;
+        if (elapsed < (uint64_t)time_slice_ms * 1000)
+            gc_journal_compact((uint32_t)((uint64_t)time_slice_ms * 1000 - elapsed));
     }
 
-    if (num_after || !gc_dirty_lockout_expired())
+    if (num_after || (dirty_ring_head != dirty_ring_tail) || dirty_ring_overflow || !gc_dirty_lockout_expired()
+        || commit_pending)
         gc_dirty_activity = 1;
     else
         gc_dirty_activity = 0;
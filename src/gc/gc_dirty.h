@@ -1,14 +1,28 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include "hardware/sync.h"
 #include "hardware/timer.h"
 #include "pico/platform.h"
 
 #include "util.h"
 
+/* only serializes the SD loader against erases being applied on core 0, dirty tracking itself is lock-free */
 extern spin_lock_t *gc_dirty_spin_lock;
 extern volatile uint32_t gc_dirty_lockout;
+extern volatile uint32_t gc_dirty_lockout_ms;
+
+/*
+* Gaps between card writes, in log2 ms buckets from 2 ms up to 2 s.
+* Shorter gaps belong to the same command, longer ones to the next save.
+*/
+#define GC_DIRTY_GAP_MIN_MS     ( 2 )
+#define GC_DIRTY_GAP_MAX_MS     ( 2048 )
+#define GC_DIRTY_GAP_BUCKETS    ( 10 )
+
+extern volatile uint32_t gc_dirty_last_access;
+extern volatile uint32_t gc_dirty_gap_hist[GC_DIRTY_GAP_BUCKETS];
 
 static inline void __time_critical_func(gc_dirty_lock)(void) {
     spin_lock_unsafe_blocking(gc_dirty_spin_lock);
@@ -19,8 +33,20 @@ static inline void __time_critical_func(gc_dirty_unlock)(void) {
 }
 
 static inline void __time_critical_func(gc_dirty_lockout_renew)(void) {
-    /* lockout for 100ms, store time in ms */
-    gc_dirty_lockout = (uint32_t)(RAM_time_us_64() / 1000) + 100;
+    /* store time in ms */
+    gc_dirty_lockout = (uint32_t)(RAM_time_us_64() / 1000) + gc_dirty_lockout_ms;
+}
+
+/* same as above, for writes and erases - only these tell how a game paces its saves */
+static inline void __time_critical_func(gc_dirty_lockout_renew_write)(void) {
+    uint32_t now = (uint32_t)(RAM_time_us_64() / 1000);
+    uint32_t gap = now - gc_dirty_last_access;
+
+    gc_dirty_last_access = now;
+    if ((gap >= GC_DIRTY_GAP_MIN_MS) && (gap < GC_DIRTY_GAP_MAX_MS))
+        gc_dirty_gap_hist[30 - __builtin_clz(gap)]++;
+
+    gc_dirty_lockout = now + gc_dirty_lockout_ms;
 }
 
 static inline int __time_critical_func(gc_dirty_lockout_expired)(void) {
@@ -28,8 +54,16 @@ static inline int __time_critical_func(gc_dirty_lockout_expired)(void) {
 }
 
 void gc_dirty_init(void);
-int gc_dirty_get_marked(void);
+
+// Core 1
 void gc_dirty_mark(uint32_t sector);
+void gc_dirty_mark_range(uint32_t first, uint32_t count);
+
+// Core 0
+void gc_dirty_drain(void);
+int gc_dirty_get_marked(void);
+void gc_dirty_mark_card(void);
+void gc_dirty_card_changed(uint32_t lockout_ms, uint32_t slice_ms);
 void gc_dirty_task(void);
 
 extern int gc_dirty_activity;
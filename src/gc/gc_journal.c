@@ -0,0 +1,292 @@
+#include "gc_journal.h"
+#include "gc_cardman.h"
+#include "debug.h"
+#include "sd.h"
+
+#include "fnv.h"
+#include "hardware/timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if LOG_LEVEL_GC_JNL == 0
+    #define log(x...)
+#else
+    #define log(level, fmt, x...) LOG_PRINT(LOG_LEVEL_GC_JNL, level, fmt, ##x)
+#endif
+
+/*
+* The journal is a preallocated file of records, each a 512 byte header followed
+* by the sectors it carries. The record at offset 0 is a checkpoint that starts an
+* epoch, every following record of that epoch continues its sequence number. A
+* commit record closes one flush pass, on replay only complete passes are applied.
+* Leftovers of older epochs further back in the file never continue the chain.
+*/
+#define JOURNAL_SIZE            (1024 * 1024)
+#define JOURNAL_SECTOR_SIZE     (512)
+#define JOURNAL_MAGIC           (0x524A4347) // "GCJR"
+
+#define JOURNAL_FLAG_CHECKPOINT (1 << 0)
+#define JOURNAL_FLAG_COMMIT     (1 << 1)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t seq;
+    uint32_t sector;
+    uint16_t count;
+    uint16_t flags;
+    uint32_t hash;
+} gc_journal_header_t;
+
+static int journal_fd = -1;
+static uint32_t journal_epoch;
+static uint32_t journal_seq;
+/* end of the last record written and of the last commit record */
+static uint32_t journal_tail;
+static uint32_t journal_committed;
+/* next record to be folded into the card image */
+static uint32_t compact_pos;
+
+static uint8_t hdrbuf[JOURNAL_SECTOR_SIZE];
+static uint8_t databuf[JOURNAL_SECTOR_SIZE];
+
+static inline uint32_t record_size(const gc_journal_header_t *hdr) {
+    return (1U + hdr->count) * JOURNAL_SECTOR_SIZE;
+}
+
+static uint32_t header_hash(const gc_journal_header_t *hdr) {
+    gc_journal_header_t tmp = *hdr;
+    tmp.hash = 0;
+    return fnv_32a_buf(&tmp, sizeof(tmp), FNV1_32A_INIT);
+}
+
+static bool read_header(uint32_t pos, gc_journal_header_t *hdr) {
+    if (pos + JOURNAL_SECTOR_SIZE > JOURNAL_SIZE)
+        return false;
+    if (sd_seek(journal_fd, (int32_t)pos, SEEK_SET) != 0)
+        return false;
+    if (sd_read(journal_fd, hdrbuf, JOURNAL_SECTOR_SIZE) != JOURNAL_SECTOR_SIZE)
+        return false;
+
+    memcpy(hdr, hdrbuf, sizeof(*hdr));
+    return (hdr->magic == JOURNAL_MAGIC) && (hdr->count <= GC_JOURNAL_MAX_RUN)
+           && (pos + record_size(hdr) <= JOURNAL_SIZE);
+}
+
+static int write_record(gc_journal_header_t *hdr, void *buf) {
+    hdr->magic = JOURNAL_MAGIC;
+    hdr->epoch = journal_epoch;
+    hdr->hash = fnv_32a_buf(buf, (size_t)hdr->count * JOURNAL_SECTOR_SIZE, header_hash(hdr));
+
+    memset(hdrbuf, 0, sizeof(hdrbuf));
+    memcpy(hdrbuf, hdr, sizeof(*hdr));
+
+    if (sd_seek(journal_fd, (int32_t)journal_tail, SEEK_SET) != 0)
+        return -2;
+    if (sd_write(journal_fd, hdrbuf, JOURNAL_SECTOR_SIZE) != JOURNAL_SECTOR_SIZE)
+        return -3;
+    if (hdr->count && (sd_write(journal_fd, buf, (size_t)hdr->count * JOURNAL_SECTOR_SIZE) != hdr->count * JOURNAL_SECTOR_SIZE))
+        return -3;
+
+    journal_tail += record_size(hdr);
+    return 0;
+}
+
+/* starts a new epoch with an empty journal, everything before must be in the card image already */
+static void journal_reset(void) {
+    gc_journal_header_t hdr = { .flags = JOURNAL_FLAG_CHECKPOINT };
+
+    journal_epoch++;
+    journal_seq = 0;
+    journal_tail = 0;
+    hdr.seq = journal_seq;
+    if (write_record(&hdr, NULL) != 0) {
+        log(LOG_ERROR, "cannot write journal checkpoint\n");
+    }
+    sd_flush(journal_fd);
+
+    journal_committed = compact_pos = journal_tail;
+}
+
+/* copies the sectors of the record at pos into the card image, returns the position of the next one */
+static int journal_apply(uint32_t pos, uint32_t *next) {
+    gc_journal_header_t hdr;
+
+    if (!read_header(pos, &hdr))
+        return -1;
+
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        if (sd_read(journal_fd, databuf, JOURNAL_SECTOR_SIZE) != JOURNAL_SECTOR_SIZE)
+            return -2;
+        if (gc_cardman_write_segment((int)(hdr.sector + i), databuf) != 0)
+            return -3;
+        /* the card image has a file position of its own, the journal still points at the next sector */
+    }
+
+    *next = pos + record_size(&hdr);
+    return 0;
+}
+
+/* returns the end of the last complete flush pass in the journal */
+static uint32_t journal_find_committed(const gc_journal_header_t *checkpoint) {
+    uint32_t pos = JOURNAL_SECTOR_SIZE;
+    uint32_t committed = pos;
+    uint32_t seq = checkpoint->seq;
+    gc_journal_header_t hdr;
+
+    while (read_header(pos, &hdr)) {
+        if ((hdr.epoch != checkpoint->epoch) || (hdr.seq != seq + 1))
+            break;
+
+        uint32_t hash = header_hash(&hdr);
+        bool ok = true;
+        for (uint32_t i = 0; i < hdr.count; i++) {
+            if (sd_read(journal_fd, databuf, JOURNAL_SECTOR_SIZE) != JOURNAL_SECTOR_SIZE) {
+                ok = false;
+                break;
+            }
+            hash = fnv_32a_buf(databuf, JOURNAL_SECTOR_SIZE, hash);
+        }
+        if (!ok || (hash != hdr.hash))
+            break;
+
+        seq = hdr.seq;
+        pos += record_size(&hdr);
+        if (hdr.flags & JOURNAL_FLAG_COMMIT)
+            committed = pos;
+    }
+
+    return committed;
+}
+
+static void journal_replay(void) {
+    gc_journal_header_t hdr;
+    uint64_t start = time_us_64();
+
+    if (!read_header(0, &hdr) || !(hdr.flags & JOURNAL_FLAG_CHECKPOINT) || (header_hash(&hdr) != hdr.hash)) {
+        /* nothing usable, make sure leftovers can't match the new epoch */
+        journal_epoch = (uint32_t)time_us_64();
+        return;
+    }
+    journal_epoch = hdr.epoch;
+
+    uint32_t committed = journal_find_committed(&hdr);
+    uint32_t pos = JOURNAL_SECTOR_SIZE;
+    int records = 0;
+    while (pos < committed) {
+        if (journal_apply(pos, &pos) != 0) {
+            log(LOG_ERROR, "journal replay failed at %u\n", pos);
+            break;
+        }
+        records++;
+    }
+
+    if (records) {
+        gc_cardman_flush();
+        log(LOG_INFO, "replayed %d journal records (%u kB) in %u ms\n", records, committed / 1024,
+            (uint32_t)((time_us_64() - start) / 1000));
+    }
+    (void)start;
+}
+
+void gc_journal_open(const char *path, bool replay) {
+    gc_journal_close();
+
+    journal_fd = sd_open(path, O_RDWR | O_CREAT);
+    if (journal_fd < 0) {
+        log(LOG_WARN, "cannot open journal %s, writing in place\n", path);
+        return;
+    }
+    if ((sd_filesize(journal_fd) == 0) && (sd_preallocate(journal_fd, JOURNAL_SIZE) != 0)) {
+        log(LOG_WARN, "cannot preallocate journal\n");
+    }
+
+    if (replay) {
+        journal_replay();
+    } else {
+        /* a fresh card image, the old journal does not belong to it */
+        gc_journal_header_t hdr;
+        journal_epoch = read_header(0, &hdr) ? hdr.epoch : (uint32_t)time_us_64();
+    }
+    journal_reset();
+
+    log(LOG_INFO, "journal %s open\n", path);
+}
+
+void gc_journal_close(void) {
+    if (journal_fd < 0)
+        return;
+
+    /* leave a card image that is complete without the journal */
+    gc_journal_commit();
+    gc_journal_compact(UINT32_MAX);
+    sd_close(journal_fd);
+    journal_fd = -1;
+}
+
+bool gc_journal_is_active(void) {
+    return journal_fd >= 0;
+}
+
+/* returns -1 if the journal is full, it has to be committed and compacted first */
+int gc_journal_append(uint32_t sector, uint32_t count, void *buf) {
+    gc_journal_header_t hdr = { .sector = sector, .count = (uint16_t)count };
+
+    if ((journal_fd < 0) || (count > GC_JOURNAL_MAX_RUN))
+        return -2;
+    /* keep room for the commit record */
+    if (journal_tail + record_size(&hdr) + JOURNAL_SECTOR_SIZE > JOURNAL_SIZE)
+        return -1;
+
+    hdr.seq = journal_seq + 1;
+    int ret = write_record(&hdr, buf);
+    if (ret == 0)
+        journal_seq = hdr.seq;
+
+    return ret;
+}
+
+/* closes the current flush pass, after this it survives a power loss */
+int gc_journal_commit(void) {
+    gc_journal_header_t hdr = { .flags = JOURNAL_FLAG_COMMIT };
+
+    if ((journal_fd < 0) || (journal_tail == journal_committed))
+        return 0;
+
+    hdr.seq = journal_seq + 1;
+    int ret = write_record(&hdr, NULL);
+    if (ret != 0)
+        return ret;
+    journal_seq = hdr.seq;
+
+    sd_flush(journal_fd);
+    journal_committed = journal_tail;
+
+    return 0;
+}
+
+bool gc_journal_needs_compaction(void) {
+    return (journal_fd >= 0) && (journal_committed > JOURNAL_SECTOR_SIZE);
+}
+
+/* folds committed records into the card image for up to budget_us, and empties the journal once all are in */
+void gc_journal_compact(uint32_t budget_us) {
+    uint64_t start = time_us_64();
+
+    if (!gc_journal_needs_compaction())
+        return;
+
+    while ((compact_pos < journal_committed) && ((time_us_64() - start) < budget_us)) {
+        if (journal_apply(compact_pos, &compact_pos) != 0) {
+            log(LOG_ERROR, "journal compaction failed at %u\n", compact_pos);
+            return;
+        }
+    }
+
+    if ((compact_pos == journal_committed) && (journal_tail == journal_committed)) {
+        gc_cardman_flush();
+        log(LOG_TRACE, "journal compacted, %u kB\n", journal_committed / 1024);
+        journal_reset();
+    }
+}
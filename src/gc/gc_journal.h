@@ -0,0 +1,16 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/* longest run of sectors in a single journal record */
+#define GC_JOURNAL_MAX_RUN      ( 16 )
+
+// Core 0
+void gc_journal_open(const char *path, bool replay);
+void gc_journal_close(void);
+bool gc_journal_is_active(void);
+int gc_journal_append(uint32_t sector, uint32_t count, void *buf);
+int gc_journal_commit(void);
+bool gc_journal_needs_compaction(void);
+void gc_journal_compact(uint32_t budget_us);
@@ -10,8 +10,12 @@
 #include "debug.h"
 #include "hardware/timer.h"
 #include "mmceman/gc_mmceman_block_commands.h"
+#include "mmceman/gc_mmceman_fs_commands.h"
+#include "mmceman/gc_mmceman_sd_cache.h"
+#include "mmceman/gc_mmceman_write_behind.h"
 #include "pico/time.h"
 #include "sd.h"
+#include "settings.h"
 
 #if WITH_GUI
 #include "gui.h"
@@ -89,10 +93,17 @@ void gc_mmceman_task(void) {
                 if (gc_mmceman_block_get_sd_mode()) {
                     gc_mc_data_interface_flush();
                     gc_cardman_set_sd_mode(true);
+                    /* the card image is closed, the PSRAM is free until it comes back */
+                    gc_mmceman_sd_cache_enable();
+                    if (settings_get_gc_write_behind())
+                        gc_mmceman_write_behind_enable();
                     gui_activate_sd_mode();
                 } else {
                     const char* game_id;
                     const char* region;
+                    /* staged writes have to be on the card before the PSRAM gets the image back */
+                    gc_mmceman_write_behind_disable();
+                    gc_mmceman_sd_cache_disable();
                     gc_cardman_set_sd_mode(false);
                     game_db_get_current_id(&game_id, &region);
                     if (game_id && region) {
@@ -110,6 +121,8 @@ void gc_mmceman_task(void) {
         mmceman_cmd = 0;
     }
 
+    gc_mmceman_fs_task();
+
     if (gc_cardman_needs_update()
         && (!gc_mmceman_block_get_sd_mode())
         && (mmceman_switching_timeout < time_us_64())
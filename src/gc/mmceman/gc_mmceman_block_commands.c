@@ -1,4 +1,6 @@
 #include "gc_mmceman_block_commands.h"
+#include "gc_mmceman_sd_cache.h"
+#include "gc_mmceman_write_behind.h"
 #include "mmceman/gc_mmceman.h"
 #include "pico/platform.h"
 #include "gc_cardman.h"
@@ -7,66 +9,116 @@
 #include <stdint.h>
 #include <string.h>
 #include "sd.h"
+#include "hardware/timer.h"
+
+#if LOG_LEVEL_MMCEMAN == 0
+    #define log(x...)
+#else
+    #define log(level, fmt, x...) LOG_PRINT(LOG_LEVEL_MMCEMAN, level, fmt, ##x)
+#endif
 
 // Size of each block for SD card operations (must match GameCube memory card spec)
 #define SD_BLOCK_SIZE 512
 
-// Static buffers that will be pointed to
-static uint8_t sd_buffers[2][SD_BLOCK_SIZE];
-static volatile uint8_t sd_write_buffer[SD_BLOCK_SIZE];
-
-typedef struct sd_op_Tag {
-    uint8_t* buffer;      // Pointer to double-buffered data array
-    uint32_t block_num;   // Current block number being processed
-    volatile enum { SD_OP_IDLE, SD_OP_READY, SD_OP_REQUESTED, SD_OP_IN_PROGRESS, SD_OP_CONSUMED} state;
-} sd_op_t;
-
+// Sectors buffered ahead of core 1, filled by multi-block reads of up to half the ring
+#define SD_READ_RING_DEPTH 16
+#define SD_READ_BURST      (SD_READ_RING_DEPTH / 2)
+// Sectors the cube can send ahead of the SD card
+#define SD_WRITE_RING_DEPTH 16
+// Retries of a failed write run before the rest of the request is dropped
+#define SD_WRITE_RETRIES   1
+// Requests at least this long report their throughput
+#define SD_REPORT_MIN      128
+
+// Static buffers that will be pointed to, word aligned for the packed EXI transfers
+static uint8_t sd_read_ring[SD_READ_RING_DEPTH][SD_BLOCK_SIZE] __attribute__((aligned(4)));
+static uint8_t sd_write_ring[SD_WRITE_RING_DEPTH][SD_BLOCK_SIZE] __attribute__((aligned(4)));
+
+/*
+* Sector i of the current read request lives in slot i % SD_READ_RING_DEPTH.
+* Core 0 advances filled, core 1 advances consumed. The slots handed out last are
+* still being sent by core 1, so core 0 stays that many slots short of a full ring.
+* A new request bumps the generation, a read that completes for an older one is dropped.
+*/
+typedef struct sd_read_op_Tag {
+    uint32_t start_block;   // First block of the request
+    uint32_t block_count;   // Number of blocks requested
+    uint32_t generation;    // Bumped whenever the request is replaced
+    volatile uint32_t filled;   // Blocks read from SD so far
+    volatile uint32_t consumed; // Blocks handed to core 1 so far
+    volatile uint32_t held;     // Blocks of the last hand-out, possibly still on the wire
+} sd_read_op_t;
+
+/*
+* Block i of the current write request is received into slot i % SD_WRITE_RING_DEPTH.
+* Core 1 advances received once the DMA has filled a slot, core 0 writes every
+* run of received blocks with one multi-block write and advances written.
+*/
 typedef struct sd_write_op_Tag {
-    uint32_t start_block;   // Current block number being processed
+    uint32_t start_block;   // First block of the request
     uint16_t block_count;   // Number of blocks to write
-    uint32_t blocks_written;  // Number of blocks written so far
+    volatile uint32_t received;       // Blocks received from the cube so far
+    volatile uint32_t blocks_written; // Blocks written so far
     volatile int result;  // Operation result: 0=pending, 1=success, -1=failure
-    volatile int request; // Operation state: 0=idle, 1=read pending, 2=write pending (future)
 } sd_write_op_t;
 
-static volatile uint16_t read_sectors_remaining = 0;
 static sd_write_op_t sd_write_op;
-static sd_op_t sd_read_ops[2];
-static volatile sd_op_t* sd_read_front = &sd_read_ops[0];
-static volatile sd_op_t* sd_read_back = &sd_read_ops[1];
+static sd_read_op_t sd_read_op;
+
+/* throughput of the running requests, core 0 only */
+static uint32_t sd_read_stat_generation;
+static uint64_t sd_read_stat_start;
+static uint64_t sd_write_stat_start;
 
 static critical_section_t sd_ops_crit;
 static bool sd_mode = false;
+// Sectors that never made it to the card since power-up, only counted up by core 0
+static volatile uint32_t write_errors;
 
-static inline void swap_ops(volatile sd_op_t** op1, volatile sd_op_t** op2) {
-    volatile sd_op_t* temp = *op1;
-    *op1 = *op2;
-    *op2 = temp;
+static inline uint32_t read_remaining(void) {
+    return sd_read_op.block_count - sd_read_op.consumed;
 }
 
-// Helper function to check if a block is ready
-static inline bool is_block_ready(volatile sd_op_t* op, uint32_t block_num) {
-    return (op->block_num == block_num && (op->state == SD_OP_READY));
+// blocks_written core 1 has to wait for before the next blocks can be received, 0 if there is room already.
+// The last blocks of a request wait until the whole request is on the card
+static inline uint32_t write_wait_for(uint32_t received, uint32_t next, uint32_t block_count) {
+    if (received == block_count)
+        return block_count;
+    if (received + next <= SD_WRITE_RING_DEPTH)
+        return 0;
+    return received + next - SD_WRITE_RING_DEPTH;
 }
 
-// Helper function to check if a block is being read
-static inline bool is_block_in_progress(volatile sd_op_t* op, uint32_t block_num) {
-    return (op->block_num == block_num && op->state == SD_OP_IN_PROGRESS);
-}
+// Received blocks core 0 writes next from slot written % SD_WRITE_RING_DEPTH
+static inline uint32_t write_drain_count(uint32_t written, uint32_t received) {
+    uint32_t slot = written % SD_WRITE_RING_DEPTH;
+    uint32_t count = received - written;
 
-// Helper function to schedule a new read
-static inline void schedule_read(volatile sd_op_t* op, uint32_t block_num) {
-    op->block_num = block_num;
-    op->state = SD_OP_REQUESTED;
+    // A single multi-block write never wraps around the end of the ring
+    if (count > SD_WRITE_RING_DEPTH - slot)
+        count = SD_WRITE_RING_DEPTH - slot;
+    return count;
 }
 
-// Helper function to clear an operation
-static inline void clear_op(volatile sd_op_t* op) {
-    op->state = SD_OP_IDLE;
+// Blocks core 0 may read next from a snapshot of the request, into slot filled % SD_READ_RING_DEPTH
+static inline uint32_t read_fill_count(uint32_t filled, uint32_t consumed, uint32_t held, uint32_t block_count) {
+    uint32_t slot = filled % SD_READ_RING_DEPTH;
+    uint32_t count = block_count - filled;
+    // The slots core 1 took last may still be on the wire
+    uint32_t space = consumed + SD_READ_RING_DEPTH - held - filled;
+
+    if (count > space)
+        count = space;
+    if (count > SD_READ_BURST)
+        count = SD_READ_BURST;
+    // A single multi-block read never wraps around the end of the ring
+    if (count > SD_READ_RING_DEPTH - slot)
+        count = SD_READ_RING_DEPTH - slot;
+    return count;
 }
 
 // ------ Core 1: Request Handler ------
-// Initiates a read request for multiple sectors with read-ahead optimization
+// Initiates a read request for multiple sectors, the ring is filled ahead on core 0
 // Note: This must only be called from Core 1 as it manages request state
 // Note: No error handling for critical section failures - system assumed stable
 void __time_critical_func(gc_mmceman_block_request_read_sector)(uint32_t sector, uint16_t count) {
@@ -74,127 +126,96 @@ void __time_critical_func(gc_mmceman_block_request_read_sector)(uint32_t sector,
 
     memset(&sd_write_op, 0, sizeof(sd_write_op_t));
     critical_section_enter_blocking(&sd_ops_crit);
-    read_sectors_remaining = count;
-
-    // Check if block is already in position 0
-    if (is_block_ready(sd_read_front, sector)
-        || is_block_in_progress(sd_read_front, sector)) {
-        // Block is being read or ready in position 0
-
-        // Schedule read ahead only if we have more sectors to read
-        if (count - 1  > 0) {
-            if (!is_block_ready(sd_read_back, sector + 1)
-                && !is_block_in_progress(sd_read_back, sector + 1)) {
-            schedule_read(sd_read_back, sector + 1);
-            }
-        } else {
-            // Cancel any read-ahead if this was the last sector
-            //if (sd_read_ops[1].request == 1 && sd_read_ops[1].result == 0) {
-            if (sd_read_back->state == SD_OP_REQUESTED || sd_read_back->state == SD_OP_IN_PROGRESS) {
-                clear_op(sd_read_back);
-            }
-        }
-        critical_section_exit(&sd_ops_crit);
-        return;
-    }
-
-    // Check if requested block is in read ahead position
-    if (is_block_ready(sd_read_back, sector)
-        || is_block_in_progress(sd_read_back, sector)) {
-        swap_ops(&sd_read_front, &sd_read_back);
 
-        // Schedule new read ahead only if we have more sectors to read
-        if (count - 1 > 0) {
-            schedule_read(sd_read_back, sector + 1);
-        }
-
-        critical_section_exit(&sd_ops_crit);
-        return;
-    }
-
-    // Block not available in either position, schedule new reads
-    schedule_read(sd_read_front, sector);
-
-    // Schedule read ahead only if we have more than one sector to read
-    if (count  > 1) {
-        schedule_read(sd_read_back, sector + 1);
+    if (sector == sd_read_op.start_block + sd_read_op.consumed) {
+        // Continues where the last request stopped, keep what is buffered already
+        sd_read_op.block_count = sd_read_op.consumed + count;
+        if (sd_read_op.filled > sd_read_op.block_count)
+            sd_read_op.filled = sd_read_op.block_count;
     } else {
-        // Cancel any existing read-ahead
-        clear_op(sd_read_back);
+        sd_read_op.generation++;
+        sd_read_op.start_block = sector;
+        sd_read_op.block_count = count;
+        sd_read_op.filled = 0;
+        sd_read_op.consumed = 0;
     }
+    // Whatever was handed out before has been sent by now
+    sd_read_op.held = 0;
 
     critical_section_exit(&sd_ops_crit);
 }
 
 bool __time_critical_func(gc_mmceman_block_data_ready)(void) {
-    bool ready = false;
-    critical_section_enter_blocking(&sd_ops_crit);
-    ready = (sd_read_front->state == SD_OP_READY);
-    critical_section_exit(&sd_ops_crit);
-    return ready;
+    return sd_read_op.filled > sd_read_op.consumed;
 }
 
 void __time_critical_func(gc_mmceman_block_swap_in_next)(void) {
-    critical_section_enter_blocking(&sd_ops_crit);
-    swap_ops(&sd_read_front, &sd_read_back);
-    if ((read_sectors_remaining > 1)) {
-        schedule_read(sd_read_back, sd_read_front->block_num + 1);
-    } else {
-        clear_op(sd_read_back);
-    }
-    critical_section_exit(&sd_ops_crit);
+    // Nothing to swap, the ring moves on when the next block is taken
 }
 
 void __time_critical_func(gc_mmceman_block_read_data)(uint8_t** buffer) {
-    // If data is ready in position 0
-    if (sd_read_front->state == SD_OP_READY) {
-        uint32_t next_block = sd_read_front->block_num + 1;
-        *buffer = sd_read_front->buffer;
-        read_sectors_remaining--;
-        sd_read_front->state = SD_OP_CONSUMED;
-
-        if (read_sectors_remaining > 0) {
-            if (sd_read_back->block_num != next_block) {
-                critical_section_enter_blocking(&sd_ops_crit);
-                if (sd_read_back->state == SD_OP_REQUESTED || sd_read_back->state == SD_OP_IN_PROGRESS) {
-                    clear_op(sd_read_back);
-                }
-                // Schedule read for the correct next block if needed
-                schedule_read(sd_read_back, next_block);
-                critical_section_exit(&sd_ops_crit);
-            }
-        } else {
-            critical_section_enter_blocking(&sd_ops_crit);
-            clear_op(sd_read_back);
-            critical_section_exit(&sd_ops_crit);
-        }
+    if (sd_read_op.filled > sd_read_op.consumed) {
+        *buffer = sd_read_ring[sd_read_op.consumed % SD_READ_RING_DEPTH];
+        // held before consumed, core 0 must never see the ring emptier than it is
+        sd_read_op.held = 1;
+        sd_read_op.consumed++;
     } else {
         *buffer = NULL;
     }
+}
 
+// Hands out the next max blocks (or the rest of the request) at once, only when all of them are buffered
+// Returns the number of blocks, 0 if they are not ready yet
+uint32_t __time_critical_func(gc_mmceman_block_read_burst)(uint8_t** buffers, uint32_t max) {
+    uint32_t count = read_remaining();
+    if (count > max)
+        count = max;
+    if ((count == 0) || (sd_read_op.filled - sd_read_op.consumed < count))
+        return 0;
+
+    for (uint32_t i = 0; i < count; i++)
+        buffers[i] = sd_read_ring[(sd_read_op.consumed + i) % SD_READ_RING_DEPTH];
+    sd_read_op.held = count;
+    sd_read_op.consumed += count;
+    return count;
 }
 
 void __time_critical_func(gc_mmceman_block_request_write_sector)(uint32_t sector, uint16_t count) {
     if (count == 0) return;
 
     critical_section_enter_blocking(&sd_ops_crit);
-    read_sectors_remaining = 0;
+    // Anything still buffered for reading is stale once the card is written
+    sd_read_op.generation++;
+    sd_read_op.block_count = sd_read_op.consumed;
+    sd_read_op.filled = sd_read_op.consumed;
 
     sd_write_op.start_block = sector;
     sd_write_op.block_count = count;
+    sd_write_op.received = 0;
     sd_write_op.blocks_written = 0;
-    sd_write_op.request = 0;
     sd_write_op.result = 0;
     critical_section_exit(&sd_ops_crit);
 }
 
 uint8_t* __time_critical_func(gc_mmceman_get_write_block)(void) {
-    //critical_section_enter_blocking(&sd_ops_crit);
-    //sd_write_op.request = 0;
-    //sd_write_op.result = 0;
-    //critical_section_exit(&sd_ops_crit);
+    return sd_write_ring[sd_write_op.received % SD_WRITE_RING_DEPTH];
+}
+
+// Slots for the next max blocks (or the rest of the request), room for them was waited for already
+uint32_t __time_critical_func(gc_mmceman_get_write_blocks)(uint8_t** buffers, uint32_t max) {
+    uint32_t count = sd_write_op.block_count - sd_write_op.received;
+    if (count > max)
+        count = max;
+
+    for (uint32_t i = 0; i < count; i++)
+        buffers[i] = sd_write_ring[(sd_write_op.received + i) % SD_WRITE_RING_DEPTH];
+    return count;
+}
 
-    return (uint8_t*)sd_write_buffer;
+// Failed sector writes for the host, saturated to fit the status byte
+uint8_t __time_critical_func(gc_mmceman_block_get_write_errors)(void) {
+    uint32_t errors = write_errors;
+    return (uint8_t)((errors > 0xFF) ? 0xFF : errors);
 }
 
 bool __time_critical_func(gc_mmceman_block_get_sd_mode)(void) {
@@ -218,7 +239,7 @@ bool gc_mmceman_block_read_idle(void)
 {
     bool ret = false;
     critical_section_enter_blocking(&sd_ops_crit);
-    ret = (read_sectors_remaining == 0);
+    ret = (read_remaining() == 0);
     critical_section_exit(&sd_ops_crit);
     return ret;
 }
@@ -227,93 +248,154 @@ bool gc_mmceman_block_write_idle(void)
 {
     bool ret = false;
     critical_section_enter_blocking(&sd_ops_crit);
-    ret = (sd_write_op.block_count == sd_write_op.blocks_written);
+    ret = (sd_write_op.block_count == sd_write_op.blocks_written) || (sd_write_op.result < 0);
     critical_section_exit(&sd_ops_crit);
     return ret;
 }
 
+// Hands count blocks the DMA just received to core 0, then waits until there is room for the next
+// next ones, if the ring is full. The last blocks of a request return once the whole request is on the card
+void __time_critical_func(gc_mmceman_block_write_blocks)(uint32_t count, uint32_t next) {
+    if (sd_write_op.received + count > sd_write_op.block_count)
+        count = sd_write_op.block_count - sd_write_op.received;
+    if (count == 0)
+        return;
+
+    sd_write_op.received += count;
+
+    uint32_t wait_for = write_wait_for(sd_write_op.received, next, sd_write_op.block_count);
+    while ((sd_write_op.blocks_written < wait_for) && (sd_write_op.result >= 0)) {
+        tight_loop_contents();
+    }
+}
+
 void __time_critical_func(gc_mmceman_block_write_data)(void) {
+    gc_mmceman_block_write_blocks(1, 1);
+}
+
+// ------ Core 0: SD Card Task ------
+
+static bool gc_mmceman_block_read_task(void) {
+    uint32_t generation, block_num, slot, count;
+
     critical_section_enter_blocking(&sd_ops_crit);
-    if (sd_write_op.block_count > sd_write_op.blocks_written) {
-        if (sd_write_op.request == 0 && sd_write_op.result == 0) {
-            sd_write_op.result = 0; // Reset result before writing
-            sd_write_op.request = 1; // Mark data as ready to be written
-        }
+    generation = sd_read_op.generation;
+    block_num = sd_read_op.start_block + sd_read_op.filled;
+    slot = sd_read_op.filled % SD_READ_RING_DEPTH;
+    count = read_fill_count(sd_read_op.filled, sd_read_op.consumed, sd_read_op.held, sd_read_op.block_count);
+    critical_section_exit(&sd_ops_crit);
+
+    if (count == 0)
+        return false;
+
+    if (generation != sd_read_stat_generation) {
+        sd_read_stat_generation = generation;
+        sd_read_stat_start = time_us_64();
+    }
+
+    // Execute the read outside the critical section, staged writes and the PSRAM cache may have the front already
+    bool read_success = true;
+    uint32_t cached = gc_mmceman_write_behind_read(block_num, sd_read_ring[slot], count);
+    if (cached == 0) {
+        // The SD card has stale data for anything still staged
+        count = gc_mmceman_write_behind_clean(block_num, count);
+        cached = gc_mmceman_sd_cache_read(block_num, sd_read_ring[slot], count);
+    }
+    if (cached > 0) {
+        count = cached;
     } else {
-        critical_section_exit(&sd_ops_crit);
-        return;
+        read_success = sd_read_sectors(block_num, sd_read_ring[slot], count);
+        if (read_success)
+            gc_mmceman_sd_cache_fill(block_num, sd_read_ring[slot], count);
     }
+    //DPRINTF("Read sector %u+%u %s\n", block_num, count, read_success ? "successful": "failed");
+
+    bool done = false;
+    critical_section_enter_blocking(&sd_ops_crit);
+    // Only update if this is still the same request, a failed read is simply retried
+    if (read_success && (sd_read_op.generation == generation)) {
+        sd_read_op.filled += count;
+        if (sd_read_op.filled > sd_read_op.block_count)
+            sd_read_op.filled = sd_read_op.block_count;
+        done = (sd_read_op.filled == sd_read_op.block_count) && (sd_read_op.block_count >= SD_REPORT_MIN);
+    }
+    count = sd_read_op.block_count;
     critical_section_exit(&sd_ops_crit);
 
-    while (sd_write_op.result != 1) {
-        tight_loop_contents();
+    if (done) {
+        uint32_t us = (uint32_t)(time_us_64() - sd_read_stat_start);
+        log(LOG_INFO, "block read of %u sectors at %u kB/s\n", count,
+            (uint32_t)((uint64_t)count * SD_BLOCK_SIZE * 1000000U / 1024U / (us ? us : 1)));
+        (void)us;
     }
+    return true;
+}
+
+static bool gc_mmceman_block_write_task(void) {
+    uint32_t block_num, slot, count, written;
+
     critical_section_enter_blocking(&sd_ops_crit);
-    sd_write_op.result = 0; // Reset result before writing
-    sd_write_op.request = 0; // Mark data as cleared
+    written = sd_write_op.blocks_written;
+    block_num = sd_write_op.start_block + written;
+    count = write_drain_count(written, sd_write_op.received);
+    bool failed = (sd_write_op.result < 0);
     critical_section_exit(&sd_ops_crit);
-}
 
-// ------ Core 0: SD Card Task ------
+    if (failed || (count == 0))
+        return false;
 
-static void gc_mmceman_block_read_task(void) {
-    for (int i = 0; i < 2; i++) {
-        bool has_request = false;
-        uint8_t* buffer;
-        uint32_t block_num;
+    slot = written % SD_WRITE_RING_DEPTH;
+    if (written == 0)
+        sd_write_stat_start = time_us_64();
 
-        critical_section_enter_blocking(&sd_ops_crit);
-        if (sd_read_ops[i].state == SD_OP_REQUESTED) {
-            has_request = true;
-            block_num = sd_read_ops[i].block_num;
-            buffer = sd_read_ops[i].buffer;
-            sd_read_ops[i].state = SD_OP_IN_PROGRESS;
+    if (gc_mmceman_write_behind_is_active()) {
+        // Acknowledged once it is in PSRAM, if the log is full make room first
+        if (!gc_mmceman_write_behind_stage(block_num, sd_write_ring[slot], count)) {
+            gc_mmceman_write_behind_task(false);
+            return true;
         }
+        critical_section_enter_blocking(&sd_ops_crit);
+        sd_write_op.blocks_written = written + count;
+        if (sd_write_op.blocks_written == sd_write_op.block_count)
+            sd_write_op.result = 1;
         critical_section_exit(&sd_ops_crit);
+        return true;
+    }
 
-        if (has_request) {
-            // Execute the read outside the critical section
-            bool read_success = sd_read_sector(block_num, (uint8_t*)buffer);
-            //DPRINTF("Read sector %u %s\n", block_num, read_success ? "successful": "failed");
-
-            critical_section_enter_blocking(&sd_ops_crit);
-            // Only update if this is still the same request
-            if (sd_read_ops[i].state == SD_OP_IN_PROGRESS && sd_read_ops[i].block_num == block_num) {
-                sd_read_ops[i].state = read_success ? SD_OP_READY : SD_OP_REQUESTED;
-            }
-            critical_section_exit(&sd_ops_crit);
-        }
+    bool write_success = false;
+    for (int attempt = 0; !write_success && (attempt <= SD_WRITE_RETRIES); attempt++)
+        write_success = sd_write_sectors(block_num, sd_write_ring[slot], count);
+    //DPRINTF("Write sector %u+%u %s\n", block_num, count, write_success ? "successful": "failed");
+
+    if (!write_success) {
+        // Drop the rest of the request instead of hanging, the cube sees it in the access mode status
+        log(LOG_ERROR, "block write of sectors %u+%u failed\n", block_num, count);
+        critical_section_enter_blocking(&sd_ops_crit);
+        sd_write_op.result = -1;
+        uint32_t dropped = sd_write_op.block_count - written;
+        critical_section_exit(&sd_ops_crit);
+        gc_mmceman_block_write_error(dropped);
+        // Whatever made it to the card is unknown
+        gc_mmceman_sd_cache_invalidate(block_num, count);
+        return true;
     }
-}
+    gc_mmceman_sd_cache_invalidate(block_num, count);
 
-static void gc_mmceman_block_write_task(void) {
-    uint32_t block_num = 0;
-    bool write_req = false;
     critical_section_enter_blocking(&sd_ops_crit);
-    if (sd_write_op.request == 1) {
-        block_num = sd_write_op.start_block + sd_write_op.blocks_written;
-        write_req = true;
-    }
+    sd_write_op.blocks_written = written + count;
+    bool done = (sd_write_op.blocks_written == sd_write_op.block_count);
+    if (done)
+        sd_write_op.result = 1;
+    count = sd_write_op.block_count;
     critical_section_exit(&sd_ops_crit);
-    if (write_req) {
-        bool write_success = sd_write_sector(block_num, (uint8_t*)sd_write_buffer);
-        //DPRINTF("Write sector %u %s\n", block_num, write_success ? "successful": "failed");
-
-        if (write_success) {
-            critical_section_enter_blocking(&sd_ops_crit);
-            sd_write_op.blocks_written++;
-            sd_write_op.result = 1; // All blocks written successfully
-            sd_write_op.request = 0;
-            critical_section_exit(&sd_ops_crit);
-        } else {
-            DPRINTF("Write failed!!\n");
-            critical_section_enter_blocking(&sd_ops_crit);
-            sd_write_op.result = -1; // Write failed
-            sd_write_op.request = 0;
-            critical_section_exit(&sd_ops_crit);
-        }
-    }
 
+    if (done && (count >= SD_REPORT_MIN)) {
+        uint32_t us = (uint32_t)(time_us_64() - sd_write_stat_start);
+        log(LOG_INFO, "block write of %u sectors at %u kB/s\n", count,
+            (uint32_t)((uint64_t)count * SD_BLOCK_SIZE * 1000000U / 1024U / (us ? us : 1)));
+        (void)us;
+    }
+    return true;
 }
 
 
@@ -322,9 +404,19 @@ static void gc_mmceman_block_write_task(void) {
 // Note: No retry mechanism for failed reads - higher level must handle
 // Note: Assumes SD card is initialized and ready
 void gc_mmceman_block_task(void) {
-    gc_mmceman_block_read_task();
-    gc_mmceman_block_write_task();
+    bool busy = gc_mmceman_block_read_task();
+    busy |= gc_mmceman_block_write_task();
+
+    // Write back and prefetch only while the cube is not waiting for anything
+    if (!busy)
+        busy = gc_mmceman_write_behind_task(!gc_mmceman_block_write_idle());
+    if (!busy)
+        gc_mmceman_sd_cache_task();
+}
 
+// Counts sectors lost by a failed write, the host sees them with the access mode
+void gc_mmceman_block_write_error(uint32_t count) {
+    write_errors += count;
 }
 
 void gc_mmceman_block_init(void) {
@@ -333,14 +425,8 @@ void gc_mmceman_block_init(void) {
     critical_section_init(&sd_ops_crit);
 
     // Zero all operation state including request/result flags
-    memset(sd_read_ops, 0, sizeof(sd_read_ops));
+    memset(&sd_read_op, 0, sizeof(sd_read_op));
     memset(&sd_write_op, 0, sizeof(sd_write_op));
-    // Set up buffer pointers
-    sd_read_ops[0].buffer = sd_buffers[0];
-    sd_read_ops[1].buffer = sd_buffers[1];
-
-    sd_read_front = &sd_read_ops[0];
-    sd_read_back = &sd_read_ops[1];
 
     sd_mode = false;
 }
@@ -348,14 +434,15 @@ void gc_mmceman_block_init(void) {
 bool gc_mmceman_block_idle(void) {
     bool ret = false;
     critical_section_enter_blocking(&sd_ops_crit);
-    ret = (read_sectors_remaining == 0) && (sd_write_op.block_count == sd_write_op.blocks_written);
+    ret = (read_remaining() == 0)
+          && ((sd_write_op.block_count == sd_write_op.blocks_written) || (sd_write_op.result < 0));
     critical_section_exit(&sd_ops_crit);
     return ret;
 }
 
 void gc_mmceman_block_finish_transfer(void) {
-    while ((read_sectors_remaining > 0)
-            || (sd_write_op.blocks_written < sd_write_op.block_count)) {
+    while ((read_remaining() > 0)
+            || ((sd_write_op.blocks_written < sd_write_op.block_count) && (sd_write_op.result >= 0))) {
         gc_mmceman_block_task();
     }
 }
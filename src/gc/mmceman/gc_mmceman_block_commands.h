@@ -5,19 +5,26 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+// Most blocks moved by one burst transfer, at most half of the buffer rings
+#define MMCEMAN_BLOCK_BURST_MAX 8
+
 // Initialize block commands system
 // ------ Core 1------
 extern void gc_mmceman_block_request_read_sector(uint32_t sector, uint16_t count);
 extern bool gc_mmceman_block_data_ready(void);
 extern void gc_mmceman_block_swap_in_next(void);
 extern void gc_mmceman_block_read_data(uint8_t** buffer);
+extern uint32_t gc_mmceman_block_read_burst(uint8_t** buffers, uint32_t max);
 extern void gc_mmceman_block_request_write_sector(uint32_t sector, uint16_t count);
 extern void gc_mmceman_block_write_data(void);
+extern void gc_mmceman_block_write_blocks(uint32_t count, uint32_t next);
 extern uint8_t* gc_mmceman_get_write_block(void);
+extern uint32_t gc_mmceman_get_write_blocks(uint8_t** buffers, uint32_t max);
 extern bool gc_mmceman_block_get_sd_mode(void);
 extern void gc_mmceman_block_set_sd_mode(bool mode);
 extern bool gc_mmceman_block_read_idle(void);
 extern bool gc_mmceman_block_write_idle(void);
+extern uint8_t gc_mmceman_block_get_write_errors(void);
 
 
 
@@ -26,5 +33,6 @@ extern void gc_mmceman_block_task(void);
 extern void gc_mmceman_block_init(void);
 extern bool gc_mmceman_block_idle(void);
 extern void gc_mmceman_block_finish_transfer(void);
+extern void gc_mmceman_block_write_error(uint32_t count);
 
 #endif // GC_MMCEMAN_BLOCK_COMMANDS_H
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include "gc_mmceman_fs_commands.h"
+#include "mmceman/gc_mmceman.h"
+#include "gc_cardman.h"
+#include "pico/platform.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "sd.h"
+
+#if LOG_LEVEL_MMCEMAN_FS == 0
+    #define log(x...)
+#else
+    #define log(level, fmt, x...) LOG_PRINT(LOG_LEVEL_MMCEMAN_FS, level, fmt, ##x)
+#endif
+
+// Files the cube may have open at once, same as the SD wrapper
+#define FS_MAX_FDS 16
+
+typedef enum {
+    FS_OP_NONE,
+    FS_OP_OPEN,
+    FS_OP_CLOSE,
+    FS_OP_SEEK,
+    FS_OP_STAT,
+    FS_OP_READDIR,
+    FS_OP_READ,
+    FS_OP_WRITE
+} fs_op_type_t;
+
+typedef struct fs_op_Tag {
+    volatile uint8_t type;  // Set last by core 1, cleared by core 0 once the result is in
+    uint8_t fd;
+    uint8_t flags;
+    uint8_t whence;
+    int32_t offset;
+    uint32_t length;
+    volatile int32_t result;
+} fs_op_t;
+
+/*
+* Reads and writes stream through two chunk buffers. Core 0 fills (or drains)
+* one while core 1 sends (or receives) the other, full is set by the producer
+* and cleared by the consumer, each side keeps its own index.
+*/
+typedef struct fs_chunk_Tag {
+    volatile uint16_t length;
+    volatile bool full;
+} fs_chunk_t;
+
+static fs_op_t fs_op;
+static char fs_path[MMCEMAN_FS_PATH_MAX];
+static gc_mmceman_fs_entry_t fs_entry;
+
+// Only what the cube opened itself may be used by it, never the card image
+static bool fs_owned[FS_MAX_FDS];
+static int fs_dir_iter[FS_MAX_FDS];
+
+static uint8_t fs_buffers[2][MMCEMAN_FS_CHUNK_SIZE];
+static fs_chunk_t fs_chunks[2];
+static volatile bool fs_stream_end;
+static volatile bool fs_abort;
+static uint8_t fs_core0_idx, fs_core1_idx;
+static uint32_t fs_core0_left, fs_core1_left, fs_transferred;
+static bool fs_write_error;
+
+// ------ Core 1 ------
+
+// A new command ends a read or write stream the cube walked away from
+static void __time_critical_func(fs_finish_previous)(void) {
+    if ((fs_op.type == FS_OP_READ) || (fs_op.type == FS_OP_WRITE))
+        fs_abort = true;
+    while (fs_op.type != FS_OP_NONE) {
+        tight_loop_contents();
+    }
+    fs_abort = false;
+}
+
+static void __time_critical_func(fs_request)(fs_op_type_t type) {
+    fs_op.result = -1;
+    fs_op.type = (uint8_t)type;
+}
+
+static void __time_critical_func(fs_stream_reset)(uint8_t fd, uint32_t length) {
+    fs_chunks[0].full = fs_chunks[1].full = false;
+    fs_core0_idx = fs_core1_idx = 0;
+    fs_core0_left = fs_core1_left = length;
+    fs_transferred = 0;
+    fs_write_error = false;
+    fs_stream_end = false;
+    fs_op.fd = fd;
+    fs_op.length = length;
+}
+
+// Core 0 may still read fs_path for the previous request, it is only taken over once that is done
+static void __time_critical_func(fs_set_path)(const char *path) {
+    fs_finish_previous();
+    strncpy(fs_path, path, sizeof(fs_path) - 1);
+    fs_path[sizeof(fs_path) - 1] = 0x00;
+}
+
+void __time_critical_func(gc_mmceman_fs_open)(uint8_t flags, const char *path) {
+    fs_set_path(path);
+    fs_op.flags = flags;
+    fs_request(FS_OP_OPEN);
+}
+
+void __time_critical_func(gc_mmceman_fs_close)(uint8_t fd) {
+    fs_finish_previous();
+    fs_op.fd = fd;
+    fs_request(FS_OP_CLOSE);
+}
+
+void __time_critical_func(gc_mmceman_fs_seek)(uint8_t fd, int32_t offset, uint8_t whence) {
+    fs_finish_previous();
+    fs_op.fd = fd;
+    fs_op.offset = offset;
+    fs_op.whence = whence;
+    fs_request(FS_OP_SEEK);
+}
+
+void __time_critical_func(gc_mmceman_fs_stat)(const char *path) {
+    fs_set_path(path);
+    fs_request(FS_OP_STAT);
+}
+
+void __time_critical_func(gc_mmceman_fs_readdir)(uint8_t fd) {
+    fs_finish_previous();
+    fs_op.fd = fd;
+    fs_request(FS_OP_READDIR);
+}
+
+void __time_critical_func(gc_mmceman_fs_read_start)(uint8_t fd, uint32_t length) {
+    fs_finish_previous();
+    fs_stream_reset(fd, length);
+    fs_request(FS_OP_READ);
+}
+
+// Next chunk to send, length 0 once the stream is over, NULL if it isn't there yet
+uint8_t* __time_critical_func(gc_mmceman_fs_read_chunk)(uint16_t* length) {
+    if (fs_chunks[fs_core1_idx].full) {
+        *length = fs_chunks[fs_core1_idx].length;
+        return fs_buffers[fs_core1_idx];
+    }
+    if (fs_stream_end) {
+        *length = 0;
+        return fs_buffers[fs_core1_idx];
+    }
+    return NULL;
+}
+
+// The chunk from gc_mmceman_fs_read_chunk is sent, core 0 may refill it
+void __time_critical_func(gc_mmceman_fs_read_release)(void) {
+    if (fs_chunks[fs_core1_idx].full) {
+        fs_chunks[fs_core1_idx].full = false;
+        fs_core1_idx ^= 1;
+    }
+}
+
+bool __time_critical_func(gc_mmceman_fs_read_ready)(void) {
+    return fs_chunks[fs_core1_idx].full || fs_stream_end;
+}
+
+void __time_critical_func(gc_mmceman_fs_write_start)(uint8_t fd, uint32_t length) {
+    fs_finish_previous();
+    fs_stream_reset(fd, length);
+    fs_request(FS_OP_WRITE);
+}
+
+uint8_t* __time_critical_func(gc_mmceman_fs_write_buffer)(void) {
+    return fs_buffers[fs_core1_idx];
+}
+
+// The buffer from gc_mmceman_fs_write_buffer holds the next chunk, hand it to core 0
+void __time_critical_func(gc_mmceman_fs_write_chunk)(void) {
+    if ((fs_core1_left == 0) || fs_chunks[fs_core1_idx].full)
+        return;
+
+    uint16_t length = (fs_core1_left < MMCEMAN_FS_CHUNK_SIZE) ? (uint16_t)fs_core1_left : MMCEMAN_FS_CHUNK_SIZE;
+    fs_core1_left -= length;
+    fs_chunks[fs_core1_idx].length = length;
+    fs_chunks[fs_core1_idx].full = true;
+    fs_core1_idx ^= 1;
+}
+
+// Ready for the next chunk, or after the last one, done writing
+bool __time_critical_func(gc_mmceman_fs_write_ready)(void) {
+    if (fs_core1_left > 0)
+        return !fs_chunks[fs_core1_idx].full;
+    return fs_op.type == FS_OP_NONE;
+}
+
+bool __time_critical_func(gc_mmceman_fs_busy)(void) {
+    return fs_op.type != FS_OP_NONE;
+}
+
+int32_t __time_critical_func(gc_mmceman_fs_result)(void) {
+    return fs_op.result;
+}
+
+const gc_mmceman_fs_entry_t* __time_critical_func(gc_mmceman_fs_entry)(void) {
+    return &fs_entry;
+}
+
+// ------ Core 0 ------
+
+static bool fs_is_owned(uint8_t fd) {
+    return (fd < FS_MAX_FDS) && fs_owned[fd];
+}
+
+static void fs_fill_entry(int fd) {
+    memset(&fs_entry, 0, sizeof(fs_entry));
+    fs_entry.type = sd_is_dir(fd) ? 1 : 0;
+    fs_entry.size = fs_entry.type ? 0 : (uint32_t)sd_filesize(fd);
+    sd_get_name(fd, fs_entry.name, sizeof(fs_entry.name));
+}
+
+/*
+* The card folders belong to cardman, the mounted image and its journal are in
+* there. FAT names don't care about case, empty and "." components are skipped
+* and ".." is refused outright, so no spelling of a path gets in.
+*/
+static bool fs_path_allowed(const char *path) {
+    const char *home = CARD_HOME_GC;
+    bool in_home = true;
+
+    while (*path) {
+        size_t len = strcspn(path, "/");
+        if ((len == 2) && (strncmp(path, "..", 2) == 0))
+            return false;
+        if ((len > 0) && !((len == 1) && (*path == '.')) && *home) {
+            size_t home_len = strcspn(home, "/");
+            if ((len != home_len) || (strncasecmp(path, home, len) != 0))
+                in_home = false;
+            home += home_len + (home[home_len] == '/');
+        }
+        path += len + (path[len] == '/');
+    }
+    return !(in_home && (*home == 0x00));
+}
+
+static int32_t fs_do_open(void) {
+    if (!fs_path_allowed(fs_path)) {
+        log(LOG_WARN, "open %s refused, card folder\n", fs_path);
+        return -1;
+    }
+
+    int oflag = O_RDONLY;
+    if ((fs_op.flags & MMCEMAN_FS_O_READ) && (fs_op.flags & MMCEMAN_FS_O_WRITE))
+        oflag = O_RDWR;
+    else if (fs_op.flags & MMCEMAN_FS_O_WRITE)
+        oflag = O_WRONLY;
+    if (fs_op.flags & MMCEMAN_FS_O_CREATE)
+        oflag |= O_CREAT;
+    if (fs_op.flags & MMCEMAN_FS_O_TRUNC)
+        oflag |= O_TRUNC;
+    if (fs_op.flags & MMCEMAN_FS_O_APPEND)
+        oflag |= O_APPEND;
+
+    int fd = sd_open(fs_path, oflag);
+    if (fd < 0)
+        return -1;
+    if (fd >= FS_MAX_FDS) {
+        sd_close(fd);
+        return -1;
+    }
+
+    fs_owned[fd] = true;
+    fs_dir_iter[fd] = -1;
+    log(LOG_INFO, "open %s (%02x) = %d\n", fs_path, fs_op.flags, fd);
+    return fd;
+}
+
+static int32_t fs_do_close(void) {
+    if (!fs_is_owned(fs_op.fd))
+        return -1;
+
+    if (fs_dir_iter[fs_op.fd] >= 0)
+        sd_close(fs_dir_iter[fs_op.fd]);
+    fs_owned[fs_op.fd] = false;
+    return (sd_close(fs_op.fd) == 0) ? 0 : -1;
+}
+
+static int32_t fs_do_seek(void) {
+    if (!fs_is_owned(fs_op.fd) || (sd_seek(fs_op.fd, fs_op.offset, fs_op.whence) != 0))
+        return -1;
+    return (int32_t)sd_tell(fs_op.fd);
+}
+
+static int32_t fs_do_stat(void) {
+    int fd = sd_open(fs_path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    fs_fill_entry(fd);
+    sd_close(fd);
+    return 0;
+}
+
+// Returns 1 with the next entry, 0 at the end of the directory
+static int32_t fs_do_readdir(void) {
+    if (!fs_is_owned(fs_op.fd) || !sd_is_dir(fs_op.fd))
+        return -1;
+
+    int it = sd_iterate_dir(fs_op.fd, fs_dir_iter[fs_op.fd]);
+    fs_dir_iter[fs_op.fd] = it;
+    if (it < 0)
+        return 0;
+
+    fs_fill_entry(it);
+    return 1;
+}
+
+// Keeps both chunk buffers full ahead of core 1
+static bool fs_do_read(void) {
+    while (!fs_abort && (fs_core0_left > 0) && !fs_chunks[fs_core0_idx].full) {
+        size_t want = (fs_core0_left < MMCEMAN_FS_CHUNK_SIZE) ? fs_core0_left : MMCEMAN_FS_CHUNK_SIZE;
+        int got = sd_read(fs_op.fd, fs_buffers[fs_core0_idx], want);
+        if (got <= 0) {
+            fs_core0_left = 0;
+            break;
+        }
+
+        fs_chunks[fs_core0_idx].length = (uint16_t)got;
+        fs_chunks[fs_core0_idx].full = true;
+        fs_core0_idx ^= 1;
+        fs_transferred += (uint32_t)got;
+        // A short read is the end of the file
+        fs_core0_left = ((size_t)got < want) ? 0 : fs_core0_left - (uint32_t)got;
+    }
+
+    if (fs_abort || (fs_core0_left == 0)) {
+        fs_stream_end = true;
+        fs_op.result = (int32_t)fs_transferred;
+        return true;
+    }
+    return false;
+}
+
+static bool fs_do_write(void) {
+    while (!fs_abort && fs_chunks[fs_core0_idx].full) {
+        uint16_t length = fs_chunks[fs_core0_idx].length;
+        int put = fs_write_error ? -1 : sd_write(fs_op.fd, fs_buffers[fs_core0_idx], length);
+        if (put != length)
+            fs_write_error = true;
+        else
+            fs_transferred += length;
+
+        fs_chunks[fs_core0_idx].full = false;
+        fs_core0_idx ^= 1;
+        fs_core0_left -= length;
+    }
+
+    if (fs_abort || (fs_core0_left == 0)) {
+        if (fs_write_error) {
+            log(LOG_ERROR, "write to %u failed after %u bytes\n", fs_op.fd, fs_transferred);
+        }
+        fs_op.result = fs_write_error ? -1 : (int32_t)fs_transferred;
+        return true;
+    }
+    return false;
+}
+
+// Carries out what core 1 asked for, streams go on over several calls
+void gc_mmceman_fs_task(void) {
+    bool done = true;
+    int32_t result = -1;
+
+    if (fs_op.type == FS_OP_NONE)
+        return;
+
+    // The file system is gone while the cube has exclusive SD access
+    if (gc_cardman_is_sd_mode()) {
+        fs_stream_end = true;
+        fs_op.result = -1;
+        fs_op.type = FS_OP_NONE;
+        return;
+    }
+
+    switch (fs_op.type) {
+        case FS_OP_OPEN:    result = fs_do_open(); break;
+        case FS_OP_CLOSE:   result = fs_do_close(); break;
+        case FS_OP_SEEK:    result = fs_do_seek(); break;
+        case FS_OP_STAT:    result = fs_do_stat(); break;
+        case FS_OP_READDIR: result = fs_do_readdir(); break;
+        case FS_OP_READ:
+            if (!fs_is_owned(fs_op.fd)) {
+                fs_stream_end = true;
+                break;
+            }
+            done = fs_do_read();
+            result = fs_op.result;
+            break;
+        case FS_OP_WRITE:
+            if (!fs_is_owned(fs_op.fd))
+                break;
+            done = fs_do_write();
+            result = fs_op.result;
+            break;
+        default: break;
+    }
+
+    if (done) {
+        fs_op.result = result;
+        fs_op.type = FS_OP_NONE;
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* data moved by one read or write chunk transaction */
+#define MMCEMAN_FS_CHUNK_SIZE   512
+#define MMCEMAN_FS_PATH_MAX     256
+#define MMCEMAN_FS_NAME_MAX     64
+
+#define MMCEMAN_FS_O_READ       0x01
+#define MMCEMAN_FS_O_WRITE      0x02
+#define MMCEMAN_FS_O_CREATE     0x04
+#define MMCEMAN_FS_O_TRUNC      0x08
+#define MMCEMAN_FS_O_APPEND     0x10
+
+typedef struct {
+    uint8_t type;       // 0 file, 1 directory
+    uint32_t size;
+    char name[MMCEMAN_FS_NAME_MAX];
+} gc_mmceman_fs_entry_t;
+
+// ------ Core 1 ------
+extern void gc_mmceman_fs_open(uint8_t flags, const char *path);
+extern void gc_mmceman_fs_close(uint8_t fd);
+extern void gc_mmceman_fs_seek(uint8_t fd, int32_t offset, uint8_t whence);
+extern void gc_mmceman_fs_stat(const char *path);
+extern void gc_mmceman_fs_readdir(uint8_t fd);
+extern void gc_mmceman_fs_read_start(uint8_t fd, uint32_t length);
+extern uint8_t* gc_mmceman_fs_read_chunk(uint16_t* length);
+extern void gc_mmceman_fs_read_release(void);
+extern bool gc_mmceman_fs_read_ready(void);
+extern void gc_mmceman_fs_write_start(uint8_t fd, uint32_t length);
+extern uint8_t* gc_mmceman_fs_write_buffer(void);
+extern void gc_mmceman_fs_write_chunk(void);
+extern bool gc_mmceman_fs_write_ready(void);
+extern bool gc_mmceman_fs_busy(void);
+extern int32_t gc_mmceman_fs_result(void);
+extern const gc_mmceman_fs_entry_t* gc_mmceman_fs_entry(void);
+
+// ------ Core 0 ------
+extern void gc_mmceman_fs_task(void);
@@ -0,0 +1,211 @@
+#include "gc_mmceman_sd_cache.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "psram/psram.h"
+#include "sd.h"
+
+#if LOG_LEVEL_MMCEMAN == 0
+    #define log(x...)
+#else
+    #define log(level, fmt, x...) LOG_PRINT(LOG_LEVEL_MMCEMAN, level, fmt, ##x)
+#endif
+
+#define SD_SECTOR_SIZE      (512)
+
+/* the first 6 MB of PSRAM, in lines of 16 sectors, two ways per set */
+#define CACHE_PSRAM_BASE    (0)
+#define CACHE_PSRAM_SIZE    (6 * 1024 * 1024)
+#define LINE_SECTORS        (16)
+#define LINE_SIZE           (LINE_SECTORS * SD_SECTOR_SIZE)
+#define CACHE_WAYS          (2)
+#define CACHE_SETS          (CACHE_PSRAM_SIZE / LINE_SIZE / CACHE_WAYS)
+
+/* a stream this long in a row is prefetched up to PREFETCH_SECTORS ahead of the cube */
+#define STREAM_MIN_SECTORS  (64)
+#define PREFETCH_SECTORS    (2 * 1024 * 1024 / SD_SECTOR_SIZE)
+#define PREFETCH_BURST      (8)
+
+typedef struct {
+    uint32_t tag;       // sector / LINE_SECTORS
+    uint16_t valid;     // one bit per sector, 0 for an empty line
+} sd_cache_line_t;
+
+static sd_cache_line_t lines[CACHE_SETS][CACHE_WAYS];
+static uint8_t victim[CACHE_SETS];
+static bool enabled;
+
+static uint32_t stream_next;
+static uint32_t stream_run;
+static uint32_t prefetch_pos;
+static uint8_t prefetch_buf[PREFETCH_BURST * SD_SECTOR_SIZE];
+
+static uint32_t hits, misses, prefetched;
+
+static inline uint32_t line_addr(uint32_t set, uint32_t way) {
+    return CACHE_PSRAM_BASE + (set * CACHE_WAYS + way) * LINE_SIZE;
+}
+
+static inline uint16_t range_mask(uint32_t first, uint32_t count) {
+    return (uint16_t)(((1U << count) - 1U) << first);
+}
+
+static int lookup(uint32_t tag) {
+    uint32_t set = tag % CACHE_SETS;
+    for (int way = 0; way < CACHE_WAYS; way++) {
+        if (lines[set][way].valid && (lines[set][way].tag == tag))
+            return way;
+    }
+    return -1;
+}
+
+/* sectors [first, first + count) that lie in the same line, at most */
+static inline uint32_t chunk_of(uint32_t sector, uint32_t count) {
+    uint32_t n = LINE_SECTORS - sector % LINE_SECTORS;
+    return (n < count) ? n : count;
+}
+
+/* a range that starts in the last stretch behind the stream end continues it */
+static void note_access(uint32_t sector, uint32_t count) {
+    if ((sector <= stream_next) && (sector + STREAM_MIN_SECTORS > stream_next)) {
+        if (sector + count > stream_next) {
+            stream_run += sector + count - stream_next;
+            stream_next = sector + count;
+        }
+    } else {
+        stream_run = count;
+        stream_next = sector + count;
+    }
+}
+
+void gc_mmceman_sd_cache_enable(void) {
+    memset(lines, 0, sizeof(lines));
+    memset(victim, 0, sizeof(victim));
+    stream_next = stream_run = prefetch_pos = 0;
+    hits = misses = prefetched = 0;
+    enabled = true;
+}
+
+void gc_mmceman_sd_cache_disable(void) {
+    if (!enabled)
+        return;
+
+    enabled = false;
+    if (hits + misses) {
+        DPRINTF("SD cache: %u hits, %u misses (%u%%), %u kB prefetched\n", hits, misses,
+                (uint32_t)((100ULL * hits) / (hits + misses)), prefetched / 2);
+    }
+}
+
+/* copies the leading cached sectors of the range to dst, returns how many there were */
+uint32_t gc_mmceman_sd_cache_read(uint32_t sector, uint8_t *dst, uint32_t count) {
+    uint32_t done = 0;
+
+    if (!enabled || (count == 0))
+        return 0;
+    note_access(sector, count);
+
+    while (done < count) {
+        uint32_t tag = (sector + done) / LINE_SECTORS;
+        uint32_t first = (sector + done) % LINE_SECTORS;
+        uint32_t n = chunk_of(sector + done, count - done);
+        int way = lookup(tag);
+        if (way < 0)
+            break;
+
+        /* only the run of valid sectors at the front */
+        uint16_t valid = lines[tag % CACHE_SETS][way].valid >> first;
+        uint32_t avail = (uint32_t)__builtin_ctz(~(uint32_t)valid);
+        if (avail < n)
+            n = avail;
+        if (n == 0)
+            break;
+
+        psram_read_dma(line_addr(tag % CACHE_SETS, (uint32_t)way) + first * SD_SECTOR_SIZE,
+                       &dst[done * SD_SECTOR_SIZE], n * SD_SECTOR_SIZE, NULL);
+        psram_wait_for_dma();
+        victim[tag % CACHE_SETS] = (uint8_t)(way ^ 1);
+        done += n;
+    }
+
+    hits += done;
+    misses += count - done;
+    return done;
+}
+
+/* puts sectors just read from SD into the cache, evicting whatever was there */
+void gc_mmceman_sd_cache_fill(uint32_t sector, const uint8_t *src, uint32_t count) {
+    if (!enabled)
+        return;
+
+    while (count) {
+        uint32_t tag = sector / LINE_SECTORS;
+        uint32_t set = tag % CACHE_SETS;
+        uint32_t first = sector % LINE_SECTORS;
+        uint32_t n = chunk_of(sector, count);
+        int way = lookup(tag);
+        if (way < 0) {
+            way = victim[set];
+            lines[set][way].tag = tag;
+            lines[set][way].valid = 0;
+        }
+
+        psram_write_dma(line_addr(set, (uint32_t)way) + first * SD_SECTOR_SIZE, (void*)src, n * SD_SECTOR_SIZE, NULL);
+        psram_wait_for_dma();
+        lines[set][way].valid |= range_mask(first, n);
+        victim[set] = (uint8_t)(way ^ 1);
+
+        sector += n;
+        src += n * SD_SECTOR_SIZE;
+        count -= n;
+    }
+}
+
+void gc_mmceman_sd_cache_invalidate(uint32_t sector, uint32_t count) {
+    if (!enabled)
+        return;
+
+    while (count) {
+        uint32_t tag = sector / LINE_SECTORS;
+        uint32_t n = chunk_of(sector, count);
+        int way = lookup(tag);
+        if (way >= 0)
+            lines[tag % CACHE_SETS][way].valid &= (uint16_t)~range_mask(sector % LINE_SECTORS, n);
+
+        sector += n;
+        count -= n;
+    }
+}
+
+/* prefetches one burst of a running stream, returns false if there was nothing to do */
+bool gc_mmceman_sd_cache_task(void) {
+    if (!enabled || (stream_run < STREAM_MIN_SECTORS))
+        return false;
+
+    if ((prefetch_pos < stream_next) || (prefetch_pos > stream_next + PREFETCH_SECTORS))
+        prefetch_pos = stream_next;
+
+    /* skip what is in already */
+    while (prefetch_pos < stream_next + PREFETCH_SECTORS) {
+        int way = lookup(prefetch_pos / LINE_SECTORS);
+        if ((way < 0) || !(lines[(prefetch_pos / LINE_SECTORS) % CACHE_SETS][way].valid & (1U << (prefetch_pos % LINE_SECTORS))))
+            break;
+        prefetch_pos++;
+    }
+    if (prefetch_pos >= stream_next + PREFETCH_SECTORS)
+        return false;
+
+    uint32_t n = chunk_of(prefetch_pos, PREFETCH_BURST);
+    if (!sd_read_sectors(prefetch_pos, prefetch_buf, n)) {
+        log(LOG_WARN, "SD cache prefetch of %u+%u failed\n", prefetch_pos, n);
+        stream_run = 0;
+        return false;
+    }
+
+    gc_mmceman_sd_cache_fill(prefetch_pos, prefetch_buf, n);
+    prefetch_pos += n;
+    prefetched += n;
+    return true;
+}
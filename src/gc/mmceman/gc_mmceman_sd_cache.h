@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+* While the cube has exclusive SD access the card image is closed and the PSRAM
+* is free. It then caches SD sectors: everything read goes in, sequential
+* streams are prefetched ahead in the background, block writes invalidate.
+*/
+
+// Core 0
+void gc_mmceman_sd_cache_enable(void);
+void gc_mmceman_sd_cache_disable(void);
+uint32_t gc_mmceman_sd_cache_read(uint32_t sector, uint8_t *dst, uint32_t count);
+void gc_mmceman_sd_cache_fill(uint32_t sector, const uint8_t *src, uint32_t count);
+void gc_mmceman_sd_cache_invalidate(uint32_t sector, uint32_t count);
+bool gc_mmceman_sd_cache_task(void);
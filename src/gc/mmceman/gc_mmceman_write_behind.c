@@ -0,0 +1,197 @@
+#include "gc_mmceman_write_behind.h"
+#include "gc_mmceman_block_commands.h"
+#include "gc_mmceman_sd_cache.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "debug.h"
+#include "psram/psram.h"
+#include "sd.h"
+
+#if LOG_LEVEL_MMCEMAN == 0
+    #define log(x...)
+#else
+    #define log(level, fmt, x...) LOG_PRINT(LOG_LEVEL_MMCEMAN, level, fmt, ##x)
+#endif
+
+#define SD_SECTOR_SIZE      (512)
+
+/* the upper 2 MB of PSRAM, above the SD cache */
+#define LOG_PSRAM_BASE      (6 * 1024 * 1024)
+#define LOG_SECTORS         (2 * 1024 * 1024 / SD_SECTOR_SIZE)
+#define MAX_RUNS            (64)
+/* sectors written to SD at once */
+#define DRAIN_BURST         (16)
+/* longest run, appending to a longer one starts a new run */
+#define MAX_RUN_SECTORS     (256)
+/* retries of a failed batch before it is given up and reported */
+#define DRAIN_RETRIES       (2)
+
+/*
+* Staged sectors form runs, each contiguous on the SD card and in the log.
+* Log positions only grow, the PSRAM slot is the position modulo LOG_SECTORS.
+* A run never wraps around the end of the log, the slots up to it are skipped.
+*/
+typedef struct {
+    uint32_t sector;
+    uint32_t pos;
+    uint32_t count;
+} wb_run_t;
+
+static wb_run_t runs[MAX_RUNS];
+static uint32_t runs_head, runs_tail;
+static uint32_t log_head, log_tail;
+static bool active;
+
+static uint8_t drain_buf[DRAIN_BURST * SD_SECTOR_SIZE];
+static uint32_t staged, drained, drain_errors;
+
+static inline uint32_t log_addr(uint32_t pos) {
+    return LOG_PSRAM_BASE + (pos % LOG_SECTORS) * SD_SECTOR_SIZE;
+}
+
+/* returns the log position of the newest staged copy of a sector, or -1 */
+static int64_t find_pending(uint32_t sector) {
+    for (uint32_t i = runs_head; i != runs_tail; i--) {
+        const wb_run_t *run = &runs[(i - 1) % MAX_RUNS];
+        if ((sector >= run->sector) && (sector - run->sector < run->count))
+            return run->pos + (sector - run->sector);
+    }
+    return -1;
+}
+
+void gc_mmceman_write_behind_enable(void) {
+    runs_head = runs_tail = 0;
+    log_head = log_tail = 0;
+    staged = drained = drain_errors = 0;
+    active = true;
+}
+
+/* everything staged goes to SD before the PSRAM is handed back */
+void gc_mmceman_write_behind_disable(void) {
+    if (!active)
+        return;
+
+    while (gc_mmceman_write_behind_task(false)) {};
+    active = false;
+    sd_sync_cache();
+
+    if (staged) {
+        DPRINTF("Write-behind: %u sectors staged, %u written, %u errors\n", staged, drained, drain_errors);
+    }
+}
+
+bool gc_mmceman_write_behind_is_active(void) {
+    return active;
+}
+
+/* returns false if there is no room, one drain pass makes some */
+bool gc_mmceman_write_behind_stage(uint32_t sector, const uint8_t *src, uint32_t count) {
+    uint32_t pos = log_head;
+
+    if (!active)
+        return false;
+    if ((pos % LOG_SECTORS) + count > LOG_SECTORS)
+        pos += LOG_SECTORS - pos % LOG_SECTORS;
+    if (pos + count - log_tail > LOG_SECTORS)
+        return false;
+
+    wb_run_t *last = (runs_head != runs_tail) ? &runs[(runs_head - 1) % MAX_RUNS] : NULL;
+    bool extend = last && (pos == last->pos + last->count) && (sector == last->sector + last->count)
+                  && (last->count + count <= MAX_RUN_SECTORS);
+    if (!extend && (runs_head - runs_tail == MAX_RUNS))
+        return false;
+
+    psram_write_dma(log_addr(pos), (void*)src, count * SD_SECTOR_SIZE, NULL);
+    psram_wait_for_dma();
+
+    if (extend) {
+        last->count += count;
+    } else {
+        runs[runs_head % MAX_RUNS] = (wb_run_t){ .sector = sector, .pos = pos, .count = count };
+        runs_head++;
+    }
+    log_head = pos + count;
+    staged += count;
+
+    /* an older copy in the read cache is stale now */
+    gc_mmceman_sd_cache_invalidate(sector, count);
+    return true;
+}
+
+/* copies the leading staged sectors of the range to dst, returns how many there were */
+uint32_t gc_mmceman_write_behind_read(uint32_t sector, uint8_t *dst, uint32_t count) {
+    uint32_t done = 0;
+
+    if (!active)
+        return 0;
+
+    while (done < count) {
+        int64_t pos = find_pending(sector + done);
+        if (pos < 0)
+            break;
+
+        /* sectors at consecutive log positions go in one transfer */
+        uint32_t n = 1;
+        while ((done + n < count) && ((uint32_t)pos + n) % LOG_SECTORS
+               && (find_pending(sector + done + n) == pos + n))
+            n++;
+
+        psram_read_dma(log_addr((uint32_t)pos), &dst[done * SD_SECTOR_SIZE], n * SD_SECTOR_SIZE, NULL);
+        psram_wait_for_dma();
+        done += n;
+    }
+    return done;
+}
+
+/* returns how many leading sectors of the range have nothing staged */
+uint32_t gc_mmceman_write_behind_clean(uint32_t sector, uint32_t count) {
+    uint32_t n = 0;
+
+    if (!active)
+        return count;
+
+    while ((n < count) && (find_pending(sector + n) < 0))
+        n++;
+    return n;
+}
+
+/* writes one batch of the oldest run to SD, returns false if there was nothing to do */
+bool gc_mmceman_write_behind_task(bool writing) {
+    if (!active || (runs_head == runs_tail))
+        return false;
+    /* while the cube is still writing, let runs grow unless the log fills up */
+    if (writing && (log_head - log_tail < LOG_SECTORS / 2))
+        return false;
+
+    wb_run_t *run = &runs[runs_tail % MAX_RUNS];
+    uint32_t n = (run->count < DRAIN_BURST) ? run->count : DRAIN_BURST;
+
+    psram_read_dma(log_addr(run->pos), drain_buf, n * SD_SECTOR_SIZE, NULL);
+    psram_wait_for_dma();
+    bool ok = false;
+    for (int attempt = 0; !ok && (attempt <= DRAIN_RETRIES); attempt++)
+        ok = sd_write_sectors(run->sector, drain_buf, n);
+    if (!ok) {
+        /* the cube was told it is written already, drop it rather than blocking the log and report it later */
+        log(LOG_ERROR, "write-behind of sectors %u+%u failed\n", run->sector, n);
+        drain_errors++;
+        gc_mmceman_block_write_error(n);
+    } else {
+        drained += n;
+    }
+    /* a prefetch may have read the old data in the meantime */
+    gc_mmceman_sd_cache_invalidate(run->sector, n);
+
+    run->sector += n;
+    run->pos += n;
+    run->count -= n;
+    log_tail = run->pos;
+    if (run->count == 0)
+        runs_tail++;
+    if (runs_head == runs_tail)
+        log_tail = log_head;
+
+    return true;
+}
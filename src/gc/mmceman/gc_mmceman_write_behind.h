@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+* Optional write-behind for block writes in SD access mode: sectors are staged
+* in a log in the upper 2 MB of PSRAM, which is acknowledged to the cube right
+* away and written to SD in multi-block batches in the background.
+*/
+
+// Core 0
+void gc_mmceman_write_behind_enable(void);
+void gc_mmceman_write_behind_disable(void);
+bool gc_mmceman_write_behind_is_active(void);
+bool gc_mmceman_write_behind_stage(uint32_t sector, const uint8_t *src, uint32_t count);
+uint32_t gc_mmceman_write_behind_read(uint32_t sector, uint8_t *dst, uint32_t count);
+uint32_t gc_mmceman_write_behind_clean(uint32_t sector, uint32_t count);
+bool gc_mmceman_write_behind_task(bool writing);
@@ -123,6 +123,11 @@ int main() {
     printf("\n\n\nStarted! Clock %d; bus priority 0x%X\n", (int)clock_get_hz(clk_sys), (unsigned)bus_ctrl_hw->priority);
     printf("FlipperMCE Version %s\n", flippermce_version);
     printf("FlipperMCE HW Variant: %s\n", flippermce_variant);
+#if DEBUG_USB_UART
+    /* from the linker script, everything in between is taken by static data */
+    extern char __end__, __StackLimit;
+    printf("SRAM left after static data: %u bytes\n", (unsigned)(&__StackLimit - &__end__));
+#endif
 
     settings_init();
 
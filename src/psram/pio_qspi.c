@@ -93,7 +93,7 @@ static volatile bool dma_active = false;
 
 static void (*dma_done_cb)(void);
 
-void __time_critical_func(pio_qspi_write8_dma)(const pio_spi_inst_t *spi, uint32_t addr, uint8_t *src, size_t srclen, void (*cb)(void)) {
+static void __time_critical_func(pio_qspi_write8_dma_internal)(const pio_spi_inst_t *spi, uint32_t addr, const uint8_t *src, size_t srclen, bool increment, void (*cb)(void)) {
     io_rw_8 *txfifo = (io_rw_8 *) &spi->pio->txf[spi->sm];
     io_rw_8 *rxfifo = (io_rw_8 *) &spi->pio->rxf[spi->sm];
 
@@ -113,7 +113,7 @@ void __time_critical_func(pio_qspi_write8_dma)(const pio_spi_inst_t *spi, uint32
 
     static uint8_t zero = 0;
     channel_config_set_write_increment(&dma_tx_data_conf, false);
-    channel_config_set_read_increment(&dma_tx_data_conf, true);
+    channel_config_set_read_increment(&dma_tx_data_conf, increment);
     dma_channel_configure((uint8_t)PIO_SPI_DMA_TX_DATA_CHAN, &dma_tx_data_conf, txfifo, src, srclen, false);
 
     channel_config_set_write_increment(&dma_tx_cmd_conf, false);
@@ -128,6 +128,16 @@ void __time_critical_func(pio_qspi_write8_dma)(const pio_spi_inst_t *spi, uint32
     dma_start_channel_mask(1 << PIO_SPI_DMA_TX_CMD_CHAN | 1 << PIO_SPI_DMA_RX_DATA_CHAN);
 }
 
+void __time_critical_func(pio_qspi_write8_dma)(const pio_spi_inst_t *spi, uint32_t addr, uint8_t *src, size_t srclen, void (*cb)(void)) {
+    pio_qspi_write8_dma_internal(spi, addr, src, srclen, true, cb);
+}
+
+void __time_critical_func(pio_qspi_fill8_dma)(const pio_spi_inst_t *spi, uint32_t addr, uint8_t value, size_t len, void (*cb)(void)) {
+    static uint8_t fill;
+    fill = value;
+    pio_qspi_write8_dma_internal(spi, addr, &fill, len, false, cb);
+}
+
 void __time_critical_func(pio_qspi_read8_dma)(const pio_spi_inst_t *spi, uint32_t addr, uint8_t *dst, size_t dstlen, void (*cb)(void)) {
     io_rw_8 *txfifo = (io_rw_8 *) &spi->pio->txf[spi->sm];
     io_rw_8 *rxfifo = (io_rw_8 *) &spi->pio->rxf[spi->sm];
@@ -177,9 +187,11 @@ static void __time_critical_func(dma_rx_done)(void) {
         gpio_put(PSRAM_CS, 1);
         //dma_unclaim_mask(1 << PIO_SPI_DMA_TX_DATA_CHAN | 1 << PIO_SPI_DMA_TX_CMD_CHAN | 1 << PIO_SPI_DMA_RX_DATA_CHAN | 1 << PIO_SPI_DMA_RX_CMD_CHAN );
 
+        /* the next transfer may be set up as soon as dma_active is cleared */
+        void (*cb)(void) = dma_done_cb;
         dma_active = false;
-        if (dma_done_cb)
-            dma_done_cb();
+        if (cb)
+            cb();
     }
 }
 
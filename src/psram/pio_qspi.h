@@ -30,6 +30,8 @@ void pio_qspi_write8_read8_blocking(const pio_spi_inst_t *spi, uint8_t *cmd, uin
 
 void pio_qspi_write8_dma(const pio_spi_inst_t *spi, uint32_t addr, uint8_t *dst, size_t dstlen, void (*cb)(void));
 
+void pio_qspi_fill8_dma(const pio_spi_inst_t *spi, uint32_t addr, uint8_t value, size_t len, void (*cb)(void));
+
 void pio_qspi_read8_dma(const pio_spi_inst_t *spi, uint32_t addr, uint8_t *src, size_t srclen, void (*cb)(void));
 
 void pio_qspi_dma_init(const pio_spi_inst_t *spi);
@@ -19,6 +19,7 @@ static pio_spi_inst_t spi = {
 };
 
 static critical_section_t crit_psram;
+static volatile uint32_t read_dma_len;
 
 
 #define SPI_OP(stmt) \
@@ -66,25 +67,66 @@ static test_t psram_tests[] = {
 
 #define NUM_TESTS ((double)sizeof(psram_tests)/sizeof(*psram_tests))
 
+/*
+* Both cores start transfers, but only core 0 takes the completion irq. Waiting for the
+* bus inside the critical section would keep that irq off on core 0 forever, so wait
+* outside and only claim the bus once it's idle.
+*/
+static void __time_critical_func(psram_claim)(void) {
+    while (1) {
+        while (pio_qspi_dma_active()) {tight_loop_contents();};
+        critical_section_enter_blocking(&crit_psram);
+        if (!pio_qspi_dma_active())
+            return;
+        critical_section_exit(&crit_psram);
+    }
+}
+
+bool __time_critical_func(psram_dma_active)(void) {
+    return pio_qspi_dma_active();
+}
+
 void __time_critical_func(psram_read_dma)(uint32_t addr, void *vbuf, size_t sz, void (*cb)(void)) {
     uint8_t *buf = vbuf;
-    critical_section_enter_blocking(&crit_psram);
+    psram_claim();
     gpio_put(spi.cs_pin, 0);
+    read_dma_len = sz;
     pio_qspi_read8_dma(&spi, addr, buf, sz, cb);
     critical_section_exit(&crit_psram);
 }
 
 void __time_critical_func(psram_write_dma)(uint32_t addr, void *vbuf, size_t sz, void (*cb)(void)) {
+    uint8_t *buf = vbuf;
+    psram_claim();
+    gpio_put(spi.cs_pin, 0);
+    pio_qspi_write8_dma(&spi, addr, buf, sz, cb);
+    critical_section_exit(&crit_psram);
+}
+
+/* same as psram_write_dma, but gives up instead of waiting for a transfer in progress - safe from irqs */
+bool __time_critical_func(psram_try_write_dma)(uint32_t addr, void *vbuf, size_t sz, void (*cb)(void)) {
     uint8_t *buf = vbuf;
     critical_section_enter_blocking(&crit_psram);
+    if (pio_qspi_dma_active()) {
+        critical_section_exit(&crit_psram);
+        return false;
+    }
     gpio_put(spi.cs_pin, 0);
     pio_qspi_write8_dma(&spi, addr, buf, sz, cb);
     critical_section_exit(&crit_psram);
+    return true;
+}
+
+void __time_critical_func(psram_fill_dma)(uint32_t addr, uint8_t value, size_t sz, void (*cb)(void)) {
+    psram_claim();
+    gpio_put(spi.cs_pin, 0);
+    pio_qspi_fill8_dma(&spi, addr, value, sz, cb);
+    critical_section_exit(&crit_psram);
 }
 
 void __time_critical_func(psram_read)(uint32_t addr, void *vbuf, size_t sz) {
     uint8_t *buf = vbuf;
-    critical_section_enter_blocking(&crit_psram);
+    psram_claim();
     gpio_put(spi.cs_pin, 0);
     pio_qspi_read8_blocking(&spi, addr, buf, sz);
     critical_section_exit(&crit_psram);
@@ -93,7 +135,7 @@ void __time_critical_func(psram_read)(uint32_t addr, void *vbuf, size_t sz) {
 
 void __time_critical_func(psram_write)(uint32_t addr, void *vbuf, size_t sz) {
     uint8_t *buf = vbuf;
-    critical_section_enter_blocking(&crit_psram);
+    psram_claim();
     gpio_put(spi.cs_pin, 0);
     pio_qspi_write8_blocking(&spi, addr, buf, sz);
     critical_section_exit(&crit_psram);
@@ -102,7 +144,10 @@ void __time_critical_func(psram_write)(uint32_t addr, void *vbuf, size_t sz) {
 uint32_t psram_write_dma_remaining() {
     return dma_channel_hw_addr((uint8_t)PIO_SPI_DMA_TX_DATA_CHAN)->transfer_count;
 }
-uint32_t psram_read_dma_remaining() {
+/* the data channel only loads its count once the wait cycles chain into it, until then it reads the last transfer's 0 */
+uint32_t __time_critical_func(psram_read_dma_remaining)() {
+    if (dma_channel_is_busy((uint8_t)PIO_SPI_DMA_RX_CMD_CHAN))
+        return read_dma_len;
     return dma_channel_hw_addr((uint8_t)PIO_SPI_DMA_RX_DATA_CHAN)->transfer_count;
 }
 
@@ -188,10 +233,8 @@ void psram_init(void) {
     psram_run_tests();
 
     /* and erase everything to 0xFF */
-    uint8_t erasebuf[512];
-    memset(erasebuf, 0xFF, sizeof(erasebuf));
-    for (uint32_t i = 0; i < 8 * 1024 * 1024; i += 512) {
-        psram_write_dma(i, erasebuf, sizeof(erasebuf), NULL);
+    for (uint32_t i = 0; i < 8 * 1024 * 1024; i += 8192) {
+        psram_fill_dma(i, 0xFF, 8192, NULL);
         psram_wait_for_dma();
     }
 }
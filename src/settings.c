@@ -20,7 +20,8 @@ typedef struct {
     uint16_t gc_card;
     uint8_t last_state;
     uint8_t gc_channel;
-    uint8_t pad[2];
+    uint8_t gc_latency; // read latency in units of 4 bytes, 0 - default
+    uint8_t pad[1];
     uint8_t gc_flags; // TODO: single bit options
     uint8_t sys_flags; // TODO: single bit options: whether gc or gc mode, etc
     uint8_t display_timeout; // display - auto off, in seconds, 0 - off
@@ -33,6 +34,7 @@ typedef struct {
     uint8_t gc_flags;
     uint8_t sys_flags;
     uint8_t gc_cardsize;
+    uint8_t gc_latency;
 } serialized_settings_t;
 
 #define SETTINGS_UPDATE_FIELD(field) settings_update_part(&settings.field, sizeof(settings.field))
@@ -41,6 +43,8 @@ typedef struct {
 #define SETTINGS_GC_FLAGS_CARD_RESTORE     (0b0000001)
 #define SETTINGS_GC_FLAGS_GAME_ID          (0b0000010)
 #define SETTINGS_GC_FLAGS_ENC              (0b0000100)  // Card Encoding Default is Japanese
+#define SETTINGS_GC_FLAGS_JOURNAL          (0b0001000)
+#define SETTINGS_GC_FLAGS_WRITE_BEHIND     (0b0010000)
 #define SETTINGS_SYS_FLAGS_FLIPPED_DISPLAY (0b0000010)
 #define SETTINGS_SYS_FLAGS_SHOW_INFO       (0b0000100)
 
@@ -67,6 +71,19 @@ static int parse_card_configuration(void *user, const char *section, const char
     } else if (MATCH("GC", "Encoding")
         && (strcmp(value, "JAP") != 0) != ((_s->gc_flags & SETTINGS_GC_FLAGS_ENC) > 0)) {
         _s->gc_flags ^= SETTINGS_GC_FLAGS_ENC;
+    } else if (MATCH("GC", "Journal")
+        && DIFFERS(value, ((_s->gc_flags & SETTINGS_GC_FLAGS_JOURNAL) > 0))) {
+        _s->gc_flags ^= SETTINGS_GC_FLAGS_JOURNAL;
+    } else if (MATCH("GC", "WriteBehind")
+        && DIFFERS(value, ((_s->gc_flags & SETTINGS_GC_FLAGS_WRITE_BEHIND) > 0))) {
+        _s->gc_flags ^= SETTINGS_GC_FLAGS_WRITE_BEHIND;
+    } else if (MATCH("GC", "Latency")) {
+        int latency = atoi(value);
+        /* the cube takes powers of two from 4 to 512 bytes, anything else means the default */
+        if ((latency >= 4) && (latency <= 512) && ((latency & (latency - 1)) == 0))
+            _s->gc_latency = (uint8_t)(latency / 4);
+        else
+            _s->gc_latency = 0;
     } else if (MATCH("GC", "CardSize")) {
         int size = atoi(value);
         switch (size) {
@@ -99,7 +116,8 @@ static void settings_deserialize(void) {
 
         serialized_settings_t newSettings = {.gc_flags = settings.gc_flags,
                                              .sys_flags = settings.sys_flags,
-                                             .gc_cardsize = settings.gc_cardsize};
+                                             .gc_cardsize = settings.gc_cardsize,
+                                             .gc_latency = settings.gc_latency};
         serialized_settings = newSettings;
         ini_parse_sd_file(fd, parse_card_configuration, &newSettings);
         sd_close(fd);
@@ -109,6 +127,7 @@ static void settings_deserialize(void) {
             settings.sys_flags       = newSettings.sys_flags;
             settings.gc_flags       = newSettings.gc_flags;
             settings.gc_cardsize    = newSettings.gc_cardsize;
+            settings.gc_latency     = newSettings.gc_latency;
 
             wear_leveling_write(0, &settings, sizeof(settings));
         }
@@ -119,6 +138,7 @@ static void settings_serialize(void) {
     int fd;
     // Only serialize if required
     if (serialized_settings.gc_cardsize == settings.gc_cardsize &&
+        serialized_settings.gc_latency == settings.gc_latency &&
         serialized_settings.gc_flags == settings.gc_flags &&
         serialized_settings.sys_flags == settings.sys_flags) {
         return;
@@ -147,12 +167,22 @@ static void settings_serialize(void) {
         sd_write(fd, line_buffer, written);
         written = (size_t)snprintf(line_buffer, 256, "CardSize=%u\n", settings.gc_cardsize);
         sd_write(fd, line_buffer, written);
+        written = (size_t)snprintf(line_buffer, 256, "Journal=%s\n", ((settings.gc_flags & SETTINGS_GC_FLAGS_JOURNAL) > 0) ? "ON" : "OFF");
+        sd_write(fd, line_buffer, written);
+        written = (size_t)snprintf(line_buffer, 256, "WriteBehind=%s\n", ((settings.gc_flags & SETTINGS_GC_FLAGS_WRITE_BEHIND) > 0) ? "ON" : "OFF");
+        sd_write(fd, line_buffer, written);
+        if (settings.gc_latency)
+            written = (size_t)snprintf(line_buffer, 256, "Latency=%u\n", settings.gc_latency * 4U);
+        else
+            written = (size_t)snprintf(line_buffer, 256, "Latency=DEFAULT\n");
+        sd_write(fd, line_buffer, written);
 
         sd_close(fd);
     }
     serialized_settings.sys_flags       = settings.sys_flags;
     serialized_settings.gc_flags       = settings.gc_flags;
     serialized_settings.gc_cardsize    = settings.gc_cardsize;
+    serialized_settings.gc_latency     = settings.gc_latency;
 }
 
 static void settings_reset(void) {
@@ -288,6 +318,31 @@ void settings_set_gc_game_id(bool enabled) {
     SETTINGS_UPDATE_FIELD(gc_flags);
 }
 
+bool settings_get_gc_journal(void) {
+    return (settings.gc_flags & SETTINGS_GC_FLAGS_JOURNAL);
+}
+
+void settings_set_gc_journal(bool enabled) {
+    if (enabled != settings_get_gc_journal())
+        settings.gc_flags ^= SETTINGS_GC_FLAGS_JOURNAL;
+    SETTINGS_UPDATE_FIELD(gc_flags);
+}
+
+bool settings_get_gc_write_behind(void) {
+    return (settings.gc_flags & SETTINGS_GC_FLAGS_WRITE_BEHIND);
+}
+
+void settings_set_gc_write_behind(bool enabled) {
+    if (enabled != settings_get_gc_write_behind())
+        settings.gc_flags ^= SETTINGS_GC_FLAGS_WRITE_BEHIND;
+    SETTINGS_UPDATE_FIELD(gc_flags);
+}
+
+/* read latency in bytes, 0 if the card default should be used */
+uint16_t settings_get_gc_latency(void) {
+    return (uint16_t)(settings.gc_latency * 4U);
+}
+
 bool settings_get_gc_encoding(void) {
     return (settings.gc_flags & SETTINGS_GC_FLAGS_ENC);
 }
@@ -24,6 +24,11 @@ bool settings_get_gc_game_id(void);
 void settings_set_gc_game_id(bool enabled);
 bool settings_get_gc_encoding(void);
 void settings_set_gc_encoding(bool enabled);
+bool settings_get_gc_journal(void);
+void settings_set_gc_journal(bool enabled);
+bool settings_get_gc_write_behind(void);
+void settings_set_gc_write_behind(bool enabled);
+uint16_t settings_get_gc_latency(void);
 
 #define IDX_MIN 1
 #define IDX_BOOT 0
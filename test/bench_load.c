@@ -0,0 +1,120 @@
+/*
+* How long the card image takes from a host file into the modelled PSRAM, for
+* a few SD and PSRAM speeds. The first case runs both at host speed, what it
+* takes is the cost of the model itself. For the others the time on top of
+* that is printed next to the time the SD card alone was busy: the less the
+* load grows over the SD time, the more of the PSRAM writes the double
+* buffered load hides behind the SD reads.
+*
+* Each case boots the firmware once, in a process of its own, and hands its
+* load time back through a pipe.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gc_cardman.h"
+
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define CARD_MBIT       16
+#define CARD_SIZE       (CARD_MBIT * 1024 * 1024 / 8)
+#define WAIT_US         60000000
+
+typedef struct {
+    const char *name;
+    uint32_t sd_call_us;
+    uint32_t sd_sector_us;
+    uint32_t psram_bytes_per_us;    /* 0 for as fast as the model goes */
+} load_case_t;
+
+static const load_case_t cases[] = {
+    { "model alone",            0,   0,  0 },
+    { "slow SD",              200, 100,  0 },
+    { "SD and PSRAM even",    100,  25, 20 },
+    { "slow PSRAM",            50,  10,  8 },
+};
+
+static uint8_t image[CARD_SIZE];
+
+static int run_case(const load_case_t *c, int report_fd, uint64_t base_us) {
+    const char *root = sim_fw_tmpdir();
+
+    for (uint32_t i = 0; i < CARD_SIZE; i++)
+        image[i] = (uint8_t)((i * 13) ^ (i >> 9));
+    FILE *f = fopen(sim_fw_card_image(root), "wb");
+    if (!f || fwrite(image, 1, CARD_SIZE, f) != CARD_SIZE)
+        return 1;
+    fclose(f);
+
+    sim_settings.cardsize = CARD_MBIT;
+    sim_sd_set_delay(c->sd_call_us, c->sd_sector_us);
+    sim_fw_boot(root);
+    sim_psram_set_rate(c->psram_bytes_per_us);
+
+    /* cardman leaves idle when it opens the image and goes back once all of it is in PSRAM */
+    uint64_t deadline = sim_now_us() + WAIT_US;
+    while (gc_cardman_is_idle()) {
+        if (sim_now_us() > deadline)
+            return 1;
+        sim_yield();
+    }
+    uint64_t start = sim_now_us();
+    uint64_t sd_start = sim_sd_busy_us();
+    while (!gc_cardman_is_idle()) {
+        if (sim_now_us() > deadline)
+            return 1;
+        sim_yield();
+    }
+    uint64_t load_us = sim_now_us() - start;
+    uint64_t sd_us = sim_sd_busy_us() - sd_start;
+
+    if (memcmp(sim_psram(), image, CARD_SIZE) != 0) {
+        fprintf(stderr, "%s: PSRAM differs from the image\n", c->name);
+        return 1;
+    }
+
+    printf("%-20s %7.1f ms  %6.2f MB/s", c->name, load_us / 1e3, CARD_SIZE / (double)load_us);
+    if (base_us)
+        printf("  %+8.1f ms over the model, SD busy %7.1f ms", ((double)load_us - (double)base_us) / 1e3, sd_us / 1e3);
+    printf("\n");
+    fflush(stdout);
+    if (write(report_fd, &load_us, sizeof(load_us)) != sizeof(load_us))
+        return 1;
+
+    sim_fw_cleanup();
+    return 0;
+}
+
+int main(void) {
+    uint64_t base_us = 0;
+    int failed = 0;
+
+    printf("loading a %u kB card, host model\n", CARD_SIZE / 1024);
+    fflush(stdout);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        int status, fds[2];
+        uint64_t load_us = 0;
+
+        if (pipe(fds) != 0)
+            return 1;
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(run_case(&cases[i], fds[1], base_us));
+        close(fds[1]);
+        if (read(fds[0], &load_us, sizeof(load_us)) != sizeof(load_us))
+            load_us = 0;
+        close(fds[0]);
+        if ((pid < 0) || (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || WEXITSTATUS(status) || !load_us) {
+            fprintf(stderr, "%s failed\n", cases[i].name);
+            failed = 1;
+        }
+        if (i == 0)
+            base_us = load_us;
+    }
+    return failed;
+}
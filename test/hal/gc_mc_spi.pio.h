@@ -0,0 +1,28 @@
+/*
+* Stand-in for the header generated from card_emu/gc_mc_spi.pio. The programs
+* are not run, the init functions tell the model which state machine plays
+* which part of the EXI bus.
+*/
+#pragma once
+
+#include "hardware/pio.h"
+
+#define PIN_GC_INT 16
+#define PIN_GC_SEL 17
+#define PIN_GC_CLK 18
+#define PIN_GC_DI 19
+#define PIN_GC_DO 20
+
+extern const pio_program_t cmd_reader_program;
+extern const pio_program_t dat_writer_program;
+extern const pio_program_t clock_probe_program;
+
+void cmd_reader_program_init(PIO pio, uint sm, uint offset);
+void dat_writer_program_init(PIO pio, uint sm, uint offset);
+void clock_probe_program_init(PIO pio, uint sm, uint offset);
+
+static inline void dat_writer_set_packed(PIO pio, uint sm, bool packed) {
+    hw_write_masked(&pio->sm[sm].shiftctrl,
+                    (packed ? 0u : 8u) << PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB,
+                    PIO_SM0_SHIFTCTRL_PULL_THRESH_BITS);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "pico/platform.h"
+
+typedef volatile uint32_t io_rw_32;
+typedef const volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
+typedef volatile uint16_t io_rw_16;
+typedef volatile uint8_t io_rw_8;
+
+/* goes through the model, it has to see the PIO shift control change */
+void hw_write_masked(io_rw_32 *addr, uint32_t values, uint32_t write_mask);
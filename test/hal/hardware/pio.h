@@ -0,0 +1,104 @@
+#pragma once
+
+#include "hardware/address_mapped.h"
+#include "hardware/gpio.h"
+
+#define NUM_PIO_STATE_MACHINES 4
+
+#define PIO_SM0_SHIFTCTRL_AUTOPUSH_BITS 0x00010000u
+#define PIO_SM0_SHIFTCTRL_AUTOPULL_BITS 0x00020000u
+#define PIO_SM0_SHIFTCTRL_PUSH_THRESH_LSB 20u
+#define PIO_SM0_SHIFTCTRL_PUSH_THRESH_BITS 0x01f00000u
+#define PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB 25u
+#define PIO_SM0_SHIFTCTRL_PULL_THRESH_BITS 0x3e000000u
+
+typedef struct {
+    io_rw_32 clkdiv;
+    io_rw_32 execctrl;
+    io_rw_32 shiftctrl;
+    io_ro_32 addr;
+    io_rw_32 instr;
+    io_rw_32 pinctrl;
+} pio_sm_hw_t;
+
+/*
+* Register layout of the chip. The FIFO registers are only addresses for the
+* model: DMA to and from them moves FIFO data, CPU accesses go through the
+* functions below or are picked up by the PSRAM device (see sim_io.c).
+*/
+typedef struct {
+    io_rw_32 ctrl;
+    io_ro_32 fstat;
+    io_rw_32 fdebug;
+    io_ro_32 flevel;
+    io_wo_32 txf[NUM_PIO_STATE_MACHINES];
+    io_ro_32 rxf[NUM_PIO_STATE_MACHINES];
+    io_rw_32 irq;
+    io_wo_32 irq_force;
+    io_rw_32 input_sync_bypass;
+    io_ro_32 dbg_padout;
+    io_ro_32 dbg_padoe;
+    io_ro_32 dbg_cfginfo;
+    io_wo_32 instr_mem[32];
+    pio_sm_hw_t sm[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio[2];
+#define pio0 (&sim_pio[0])
+#define pio1 (&sim_pio[1])
+
+typedef struct {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+enum pio_src_dest {
+    pio_pins = 0u,
+    pio_x = 1u,
+    pio_y = 2u,
+    pio_null = 3u,
+};
+
+static inline uint pio_get_index(PIO pio) {
+    return pio == pio1 ? 1 : 0;
+}
+
+static inline uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return (pio_get_index(pio) << 3) + sm + (is_tx ? 0 : NUM_PIO_STATE_MACHINES);
+}
+
+static inline uint pio_encode_jmp(uint addr) {
+    return 0x0000u | (addr & 0x1fu);
+}
+
+static inline uint pio_encode_out(enum pio_src_dest dest, uint count) {
+    return 0x6000u | ((uint)dest << 5) | (count & 0x1fu);
+}
+
+static inline uint pio_encode_pull(bool if_empty, bool block) {
+    return 0x8080u | (if_empty ? 0x40u : 0u) | (block ? 0x20u : 0u);
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_sm_unclaim(PIO pio, uint sm);
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled);
+void pio_restart_sm_mask(PIO pio, uint32_t mask);
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask);
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "hardware/address_mapped.h"
+
+typedef struct {
+    io_rw_32 inte[4];
+    io_rw_32 intf[4];
+    io_ro_32 ints[4];
+} io_irq_ctrl_hw_t;
+
+/* only the interrupt registers, the card reads and acknowledges them directly */
+typedef struct {
+    io_rw_32 intr[4];
+    io_irq_ctrl_hw_t proc0_irq_ctrl;
+    io_irq_ctrl_hw_t proc1_irq_ctrl;
+} iobank0_hw_t;
+
+extern iobank0_hw_t sim_iobank0;
+#define iobank0_hw (&sim_iobank0)
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "hardware/address_mapped.h"
+
+typedef volatile uint32_t spin_lock_t;
+
+spin_lock_t *spin_lock_init(uint lock_num);
+int spin_lock_claim_unused(bool required);
+void spin_lock_unsafe_blocking(spin_lock_t *lock);
+void spin_unlock_unsafe(spin_lock_t *lock);
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(uint32_t status);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "hardware/address_mapped.h"
+
+typedef uint64_t absolute_time_t;
+
+typedef struct {
+    io_rw_32 timerawh;
+    io_rw_32 timerawl;
+} timer_hw_t;
+
+/* the raw registers are refreshed on every access */
+timer_hw_t *sim_timer_hw(void);
+#define timer_hw (sim_timer_hw())
+
+#define NUM_TIMERS 4
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_unclaim(uint alarm_num);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t);
+void hardware_alarm_cancel(uint alarm_num);
+void busy_wait_us_32(uint32_t delay_us);
@@ -0,0 +1,5 @@
+/* only the types gui.h refers to, the GUI itself is not built for the host */
+#pragma once
+
+typedef struct _lv_obj_t lv_obj_t;
+typedef struct _lv_event_t lv_event_t;
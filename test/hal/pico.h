@@ -0,0 +1,7 @@
+/*
+* Host stand-in for the Pico SDK, just enough of it for the card sources to
+* build and run against the model in sim_core.c and sim_io.c.
+*/
+#pragma once
+
+#include "pico/platform.h"
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "hardware/sync.h"
+
+typedef struct {
+    spin_lock_t *spin_lock;
+    uint32_t save;
+} critical_section_t;
+
+void critical_section_init(critical_section_t *crit_sec);
+void critical_section_enter_blocking(critical_section_t *crit_sec);
+void critical_section_exit(critical_section_t *crit_sec);
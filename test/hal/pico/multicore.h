@@ -0,0 +1,7 @@
+#pragma once
+
+#include "pico/platform.h"
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);
+void multicore_lockout_victim_init(void);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+#define __time_critical_func(x) x
+#define __not_in_flash_func(x) x
+#define __no_inline_not_in_flash_func(x) __attribute__((noinline)) x
+#define __scratch_x(x)
+#define __scratch_y(x)
+#define __aligned(x) __attribute__((aligned(x)))
+
+#define NUM_CORES 2
+#define NUM_BANK0_GPIOS 30
+
+uint get_core_num(void);
+
+/* lets interrupts in and the other cores run, every busy wait of the firmware ends up here */
+void tight_loop_contents(void);
+
+static inline void __compiler_memory_barrier(void) {
+    __asm__ volatile ("" : : : "memory");
+}
+
+static inline void __dmb(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __mem_fence_acquire(void) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void __mem_fence_release(void) {
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
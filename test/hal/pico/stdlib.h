@@ -0,0 +1,4 @@
+#pragma once
+
+#include "pico/time.h"
+#include "hardware/gpio.h"
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "hardware/timer.h"
+
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+absolute_time_t get_absolute_time(void);
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us) {
+    return time_us_64() + us;
+}
+
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) {
+    return time_us_64() + (uint64_t)ms * 1000;
+}
@@ -0,0 +1,15 @@
+/*
+* Stand-in for the header generated from psram/qspi.pio, the init functions
+* attach the PSRAM device of the model to the state machine.
+*/
+#pragma once
+
+#include "hardware/pio.h"
+
+extern const pio_program_t spi_cpha0_program;
+extern const pio_program_t qspi_cpha0_program;
+
+void pio_spi_init(PIO pio, uint sm, uint prog_offs, uint n_bits, float clkdiv, bool cpha, bool cpol,
+                  uint pin_sck, uint pin_mosi, uint pin_miso);
+void pio_qspi_init(PIO pio, uint sm, uint prog_offs, uint n_bits, float clkdiv, bool cpha, bool cpol,
+                   uint pin_sck, uint pin_dat);
@@ -0,0 +1,6 @@
+/* forced into every file of the host build, for what newlib has and glibc lacks */
+#pragma once
+
+#include <stddef.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
@@ -0,0 +1,598 @@
+/*
+* Host model of the RP2040: cores, interrupts, time, alarms and spin locks.
+* The peripherals are in sim_io.c.
+*/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/critical_section.h"
+#include "pico/multicore.h"
+#include "pico/time.h"
+
+#include "sim_internal.h"
+
+#define CORE_STACK_SIZE     (1024 * 1024)
+#define YIELD_INTERVAL_US   50
+#define TICK_US             20
+#define KICK_US             100
+#define MAX_SHARED          4
+#define NUM_SPIN_LOCKS      32
+
+/* the firmware keeps addresses of buffers in 32 bit registers, core stacks live below 4G */
+#ifndef MAP_32BIT
+#error "the model needs MAP_32BIT for the core stacks"
+#endif
+
+static pthread_mutex_t hal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int t_core = -1;
+static __thread volatile int t_depth;
+static __thread volatile int t_masked;
+static __thread volatile int t_in_irq;
+static __thread uint64_t t_last_yield;
+
+static pthread_t core_thread[NUM_CORES];
+static atomic_bool core_alive[NUM_CORES];
+static atomic_bool core1_kill;
+static void *core_stack[NUM_CORES];
+
+static uint32_t core1_calls;
+
+static atomic_uint irq_pending[NUM_CORES];
+static atomic_uint irq_enabled[NUM_CORES];
+static irq_handler_t irq_exclusive[NUM_IRQS];
+static irq_handler_t irq_shared[NUM_IRQS][MAX_SHARED];
+
+static spin_lock_t spin_locks[NUM_SPIN_LOCKS];
+static uint32_t spin_lock_claimed;
+
+typedef struct {
+    bool claimed;
+    bool armed;
+    uint64_t target;
+    int core;
+    hardware_alarm_callback_t callback;
+} alarm_t;
+
+static alarm_t alarms[NUM_TIMERS];
+
+static struct timespec time_base;
+static bool started;
+
+/* ---- time ---- */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - time_base.tv_sec) * 1000000000ull + (uint64_t)ts.tv_nsec - (uint64_t)time_base.tv_nsec;
+}
+
+uint64_t sim_now_us(void) {
+    return now_ns() / 1000;
+}
+
+uint64_t time_us_64(void) {
+    return sim_now_us();
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)sim_now_us();
+}
+
+timer_hw_t *sim_timer_hw(void) {
+    static __thread timer_hw_t regs;
+    uint64_t now = sim_now_us();
+    regs.timerawh = (uint32_t)(now >> 32);
+    regs.timerawl = (uint32_t)now;
+    return &regs;
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us_64();
+}
+
+/* ---- interrupts ---- */
+
+static void run_handlers(uint irq) {
+    if (irq_exclusive[irq]) {
+        irq_exclusive[irq]();
+        return;
+    }
+    for (int i = 0; i < MAX_SHARED; i++)
+        if (irq_shared[irq][i])
+            irq_shared[irq][i]();
+}
+
+/* runs what is pending and enabled for the core of this thread, lowest number first like the NVIC */
+static void run_irqs(void) {
+    if (t_core < 0 || t_depth || t_masked || t_in_irq)
+        return;
+    t_in_irq = 1;
+    for (;;) {
+        uint32_t ready = atomic_load(&irq_pending[t_core]) & atomic_load(&irq_enabled[t_core]);
+        if (!ready)
+            break;
+        uint irq = (uint)__builtin_ctz(ready);
+        atomic_fetch_and(&irq_pending[t_core], ~(1u << irq));
+
+        sim_hal_enter();
+        uint32_t state = sim_io_irq_begin((uint)t_core, irq);
+        sim_hal_exit();
+
+        run_handlers(irq);
+
+        sim_hal_enter();
+        sim_io_irq_end((uint)t_core, irq, state);
+        sim_hal_exit();
+    }
+    t_in_irq = 0;
+}
+
+static void relax(void) {
+    if (t_core == 1 && t_depth == 0 && atomic_load(&core1_kill))
+        pthread_exit(NULL);
+    run_irqs();
+    sched_yield();
+    t_last_yield = now_ns();
+}
+
+static void on_irq_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    run_irqs();
+    errno = saved;
+}
+
+static void on_kick_signal(int sig) {
+    (void)sig;
+    int saved = errno;
+    if (t_core >= 0 && t_depth == 0)
+        relax();
+    errno = saved;
+}
+
+void sim_irq_pend(uint32_t core_mask, uint irq) {
+    for (int core = 0; core < NUM_CORES; core++) {
+        if (!(core_mask & (1u << core)))
+            continue;
+        atomic_fetch_or(&irq_pending[core], 1u << irq);
+        if ((atomic_load(&irq_enabled[core]) & (1u << irq)) && atomic_load(&core_alive[core]) &&
+            !pthread_equal(core_thread[core], pthread_self()))
+            pthread_kill(core_thread[core], SIGUSR1);
+    }
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    uint core = get_core_num();
+    if (enabled)
+        atomic_fetch_or(&irq_enabled[core], 1u << num);
+    else
+        atomic_fetch_and(&irq_enabled[core], ~(1u << num));
+    run_irqs();
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    irq_exclusive[num] = handler;
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority) {
+    (void)order_priority;
+    for (int i = 0; i < MAX_SHARED; i++) {
+        if (!irq_shared[num][i]) {
+            irq_shared[num][i] = handler;
+            return;
+        }
+    }
+    fprintf(stderr, "sim: out of shared handlers for irq %u\n", num);
+    abort();
+}
+
+void irq_remove_handler(uint num, irq_handler_t handler) {
+    if (irq_exclusive[num] == handler)
+        irq_exclusive[num] = NULL;
+    for (int i = 0; i < MAX_SHARED; i++)
+        if (irq_shared[num][i] == handler)
+            irq_shared[num][i] = NULL;
+}
+
+uint32_t save_and_disable_interrupts(void) {
+    uint32_t status = (uint32_t)t_masked;
+    t_masked = 1;
+    return status;
+}
+
+void restore_interrupts(uint32_t status) {
+    t_masked = (int)status;
+    run_irqs();
+}
+
+/* ---- the HAL lock ---- */
+
+int sim_core(void) {
+    return t_core;
+}
+
+uint get_core_num(void) {
+    return t_core > 0 ? (uint)t_core : 0;
+}
+
+static void check_alarms(void);
+
+void sim_hal_enter(void) {
+    /* depth first, a signal arriving while the lock is taken must not run handlers */
+    if (t_depth++)
+        return;
+    pthread_mutex_lock(&hal_lock);
+    if (t_core == 1)
+        core1_calls++;
+    sim_io_gpio_ack();
+    sim_io_cpu_commit();
+}
+
+uint32_t sim_core1_calls(void) {
+    pthread_mutex_lock(&hal_lock);
+    uint32_t calls = core1_calls;
+    pthread_mutex_unlock(&hal_lock);
+    return calls;
+}
+
+void sim_hal_exit_poll(bool negative) {
+    if (t_depth > 1) {
+        t_depth--;
+        return;
+    }
+    check_alarms();
+    sim_io_service();
+    pthread_mutex_unlock(&hal_lock);
+    t_depth = 0;
+
+    run_irqs();
+    uint64_t now = now_ns();
+    if (negative || now - t_last_yield > YIELD_INTERVAL_US * 1000ull) {
+        sched_yield();
+        t_last_yield = now;
+    }
+}
+
+void sim_hal_exit(void) {
+    sim_hal_exit_poll(false);
+}
+
+void hw_write_masked(io_rw_32 *addr, uint32_t values, uint32_t write_mask) {
+    sim_hal_enter();
+    *addr = (*addr & ~write_mask) | (values & write_mask);
+    sim_hal_exit();
+}
+
+void tight_loop_contents(void) {
+    relax();
+}
+
+void sim_yield(void) {
+    sched_yield();
+}
+
+/* ---- spin locks, critical sections ---- */
+
+spin_lock_t *spin_lock_init(uint lock_num) {
+    spin_locks[lock_num] = 0;
+    return &spin_locks[lock_num];
+}
+
+int spin_lock_claim_unused(bool required) {
+    for (int i = 16; i < NUM_SPIN_LOCKS; i++) {
+        if (!(spin_lock_claimed & (1u << i))) {
+            spin_lock_claimed |= 1u << i;
+            return i;
+        }
+    }
+    if (required) {
+        fprintf(stderr, "sim: out of spin locks\n");
+        abort();
+    }
+    return -1;
+}
+
+void spin_lock_unsafe_blocking(spin_lock_t *lock) {
+    uint32_t expected = 0;
+    while (!__atomic_compare_exchange_n((uint32_t *)lock, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        expected = 0;
+        sched_yield();
+    }
+}
+
+void spin_unlock_unsafe(spin_lock_t *lock) {
+    __atomic_store_n((uint32_t *)lock, 0, __ATOMIC_RELEASE);
+}
+
+void critical_section_init(critical_section_t *crit_sec) {
+    crit_sec->spin_lock = spin_lock_init((uint)spin_lock_claim_unused(true));
+}
+
+void critical_section_enter_blocking(critical_section_t *crit_sec) {
+    uint32_t save = save_and_disable_interrupts();
+    spin_lock_unsafe_blocking(crit_sec->spin_lock);
+    crit_sec->save = save;
+}
+
+void critical_section_exit(critical_section_t *crit_sec) {
+    spin_unlock_unsafe(crit_sec->spin_lock);
+    restore_interrupts(crit_sec->save);
+}
+
+/* ---- alarms ---- */
+
+static void alarm_fire(uint alarm_num) {
+    hardware_alarm_callback_t callback = alarms[alarm_num].callback;
+    if (callback)
+        callback(alarm_num);
+}
+
+static void alarm_irq_0(void) { alarm_fire(0); }
+static void alarm_irq_1(void) { alarm_fire(1); }
+static void alarm_irq_2(void) { alarm_fire(2); }
+static void alarm_irq_3(void) { alarm_fire(3); }
+
+static const irq_handler_t alarm_irqs[NUM_TIMERS] = { alarm_irq_0, alarm_irq_1, alarm_irq_2, alarm_irq_3 };
+
+/* HAL lock held */
+static void check_alarms(void) {
+    uint64_t now = sim_now_us();
+    for (uint i = 0; i < NUM_TIMERS; i++) {
+        if (alarms[i].armed && now >= alarms[i].target) {
+            alarms[i].armed = false;
+            sim_irq_pend(1u << alarms[i].core, TIMER_IRQ_0 + i);
+        }
+    }
+}
+
+int hardware_alarm_claim_unused(bool required) {
+    int found = -1;
+    sim_hal_enter();
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        if (!alarms[i].claimed) {
+            alarms[i].claimed = true;
+            found = i;
+            break;
+        }
+    }
+    sim_hal_exit();
+    if (found < 0 && required) {
+        fprintf(stderr, "sim: out of alarms\n");
+        abort();
+    }
+    return found;
+}
+
+void hardware_alarm_unclaim(uint alarm_num) {
+    sim_hal_enter();
+    alarms[alarm_num].claimed = false;
+    alarms[alarm_num].armed = false;
+    sim_hal_exit();
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback) {
+    sim_hal_enter();
+    alarms[alarm_num].callback = callback;
+    alarms[alarm_num].core = (int)get_core_num();
+    sim_hal_exit();
+    if (callback) {
+        irq_set_exclusive_handler(TIMER_IRQ_0 + alarm_num, alarm_irqs[alarm_num]);
+        irq_set_enabled(TIMER_IRQ_0 + alarm_num, true);
+    } else {
+        irq_set_enabled(TIMER_IRQ_0 + alarm_num, false);
+        irq_remove_handler(TIMER_IRQ_0 + alarm_num, alarm_irqs[alarm_num]);
+    }
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t t) {
+    bool missed;
+    sim_hal_enter();
+    missed = t <= sim_now_us();
+    alarms[alarm_num].armed = !missed;
+    alarms[alarm_num].target = t;
+    sim_hal_exit();
+    return missed;
+}
+
+void hardware_alarm_cancel(uint alarm_num) {
+    sim_hal_enter();
+    alarms[alarm_num].armed = false;
+    atomic_fetch_and(&irq_pending[alarms[alarm_num].core], ~(1u << (TIMER_IRQ_0 + alarm_num)));
+    sim_hal_exit();
+}
+
+/* ---- sleeping ---- */
+
+static void sleep_until_ns(uint64_t deadline) {
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= deadline)
+            break;
+        uint64_t left = deadline - now;
+        struct timespec ts = { 0, (long)(left < 1000000 ? left : 1000000) };
+        nanosleep(&ts, NULL);
+        run_irqs();
+    }
+}
+
+void sleep_us(uint64_t us) {
+    sleep_until_ns(now_ns() + us * 1000);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_until_ns(now_ns() + (uint64_t)ms * 1000000);
+}
+
+void busy_wait_us_32(uint32_t delay_us) {
+    uint64_t deadline = now_ns() + (uint64_t)delay_us * 1000;
+    while (now_ns() < deadline)
+        relax();
+}
+
+/* ---- cores ---- */
+
+typedef struct {
+    int core;
+    void (*entry)(void);
+} core_start_t;
+
+static core_start_t core_start[NUM_CORES];
+
+static void *core_main(void *arg) {
+    core_start_t *start = arg;
+    t_core = start->core;
+    t_last_yield = now_ns();
+    start->entry();
+    atomic_store(&core_alive[t_core], false);
+    return NULL;
+}
+
+static void start_core(int core, void (*entry)(void)) {
+    pthread_attr_t attr;
+
+    if (!core_stack[core]) {
+        core_stack[core] = mmap(NULL, CORE_STACK_SIZE, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+        if (core_stack[core] == MAP_FAILED) {
+            perror("sim: core stack");
+            abort();
+        }
+    }
+    core_start[core].core = core;
+    core_start[core].entry = entry;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, core_stack[core], CORE_STACK_SIZE);
+    atomic_store(&core_alive[core], true);
+    if (pthread_create(&core_thread[core], &attr, core_main, &core_start[core])) {
+        perror("sim: core thread");
+        abort();
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void stop_core1(void) {
+    if (!atomic_load(&core_alive[1]) && !core_thread[1])
+        return;
+    atomic_store(&core1_kill, true);
+    while (atomic_load(&core_alive[1])) {
+        pthread_kill(core_thread[1], SIGUSR2);
+        struct timespec ts = { 0, 20000 };
+        nanosleep(&ts, NULL);
+        if (pthread_tryjoin_np(core_thread[1], NULL) == 0)
+            break;
+    }
+    pthread_join(core_thread[1], NULL);
+    core_thread[1] = 0;
+    atomic_store(&core_alive[1], false);
+    atomic_store(&core1_kill, false);
+    atomic_store(&irq_pending[1], 0);
+    atomic_store(&irq_enabled[1], 0);
+}
+
+void multicore_reset_core1(void) {
+    stop_core1();
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    stop_core1();
+    start_core(1, entry);
+}
+
+void multicore_lockout_victim_init(void) {
+}
+
+static void *tick_main(void *arg) {
+    (void)arg;
+    uint64_t last_kick = 0;
+
+    prctl(PR_SET_TIMERSLACK, 1);
+    for (;;) {
+        struct timespec ts = { 0, TICK_US * 1000 };
+        nanosleep(&ts, NULL);
+
+        sim_hal_enter();
+        sim_hal_exit();
+
+        uint64_t now = sim_now_us();
+        if (now - last_kick >= KICK_US) {
+            last_kick = now;
+            for (int core = 0; core < NUM_CORES; core++)
+                if (atomic_load(&core_alive[core]))
+                    pthread_kill(core_thread[core], SIGUSR2);
+        }
+    }
+    return NULL;
+}
+
+void sim_init(void) {
+    if (!started) {
+        struct sigaction sa;
+        pthread_t tick;
+
+        clock_gettime(CLOCK_MONOTONIC, &time_base);
+        prctl(PR_SET_TIMERSLACK, 1);
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_irq_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &sa, NULL);
+        sa.sa_handler = on_kick_signal;
+        sigaction(SIGUSR2, &sa, NULL);
+
+        pthread_create(&tick, NULL, tick_main, NULL);
+        pthread_detach(tick);
+        started = true;
+    }
+
+    stop_core1();
+    sim_hal_enter();
+    memset(irq_exclusive, 0, sizeof(irq_exclusive));
+    memset(irq_shared, 0, sizeof(irq_shared));
+    memset(alarms, 0, sizeof(alarms));
+    memset((void *)spin_locks, 0, sizeof(spin_locks));
+    spin_lock_claimed = 0;
+    for (int core = 0; core < NUM_CORES; core++) {
+        atomic_store(&irq_pending[core], 0);
+        atomic_store(&irq_enabled[core], 0);
+    }
+    sim_io_reset();
+    sim_hal_exit();
+
+    t_core = 0;
+    core_thread[0] = pthread_self();
+    atomic_store(&core_alive[0], true);
+}
+
+void sim_start_core0(void (*entry)(void)) {
+    if (t_core == 0) {
+        t_core = -1;
+        atomic_store(&core_alive[0], false);
+    }
+    start_core(0, entry);
+}
+
+uint64_t sim_core1_cpu_us(void) {
+    clockid_t clock;
+    struct timespec ts;
+
+    if (!atomic_load(&core_alive[1]) || pthread_getcpuclockid(core_thread[1], &clock))
+        return 0;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
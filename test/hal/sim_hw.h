@@ -0,0 +1,83 @@
+/*
+* Control side of the host model of the RP2040, used by the tests and the cube.
+*
+* The firmware runs on real threads, one per core. Everything that touches the
+* modelled hardware takes one lock, interrupts are delivered to the core thread
+* by a signal and run once the thread is outside of the model. The EXI bus is
+* driven one byte at a time from the test thread, which plays the cube.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+/* resets the model, the calling thread becomes core 0 */
+void sim_init(void);
+
+/* starts core 0 on its own thread, the caller is the cube from then on */
+void sim_start_core0(void (*entry)(void));
+
+/* gives the other threads a turn */
+void sim_yield(void);
+
+uint64_t sim_now_us(void);
+
+/* CPU time core 1 has used so far, in us */
+uint64_t sim_core1_cpu_us(void);
+
+/* ---- GPIO ---- */
+
+bool sim_gpio_level(uint gpio);
+uint32_t sim_gpio_falls(uint gpio);
+bool sim_wait_gpio(uint gpio, bool level, uint32_t timeout_us);
+
+/* ---- PSRAM ---- */
+
+#define SIM_PSRAM_SIZE (8 * 1024 * 1024)
+
+uint8_t *sim_psram(void);
+
+/* bytes per us the PSRAM device moves, 0 for as fast as the model can */
+void sim_psram_set_rate(uint32_t bytes_per_us);
+
+/* stops a quad read right after its command, until released */
+void sim_psram_hold_reads(bool hold);
+
+/* transactions that started with stale bytes in the RX FIFO */
+uint32_t sim_psram_misaligned(void);
+
+/* ---- EXI bus, cube side ---- */
+
+/* the firmware takes this byte from the RX FIFO, wait for room instead of overrunning it */
+#define SIM_EXI_RX      0x01
+/* the byte carries a response, wait until the card has one in the TX FIFO */
+#define SIM_EXI_TX      0x02
+/* clock the next byte straight after this one, before the firmware can react */
+#define SIM_EXI_HOLD    0x04
+
+typedef struct {
+    uint32_t bytes;
+    uint32_t rx_overruns;   /* bytes the cmd reader could not store */
+    uint32_t tx_idle;       /* bytes sent while the card had nothing to send */
+} sim_exi_stats_t;
+
+/* byte time of the bus, 500 ns at the usual 16 MHz EXI clock */
+void sim_exi_set_byte_ns(uint32_t ns);
+
+void sim_exi_select(void);
+
+/* raises SEL and waits until core 1 handled the deselect, false on timeout */
+bool sim_exi_deselect(uint32_t timeout_us);
+
+/* clocks one byte, returns what the card sent or -1 if a wait timed out */
+int sim_exi_byte(uint8_t di, unsigned flags, uint32_t timeout_us);
+
+/* waits until the card consumed every received byte */
+bool sim_exi_wait_rx_drained(uint32_t timeout_us);
+
+/* true once the card has the next byte to send */
+bool sim_exi_tx_ready(void);
+
+void sim_exi_get_stats(sim_exi_stats_t *stats);
@@ -0,0 +1,42 @@
+/* shared between the parts of the host model, not for the tests */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sim_hw.h"
+
+/*
+* Every access to the modelled hardware runs between these two. Nests, the
+* lock is only taken on the outermost level. Interrupts pending for the core
+* of the calling thread run on the way out.
+*/
+void sim_hal_enter(void);
+void sim_hal_exit(void);
+
+/* same, for polls: a negative result lets the other threads run */
+void sim_hal_exit_poll(bool negative);
+
+/* calls into the model core 1 made so far */
+uint32_t sim_core1_calls(void);
+
+/* core of the calling thread, -1 for the cube and the model's own threads */
+int sim_core(void);
+
+/* marks the interrupt pending on the cores in the mask, HAL lock held */
+void sim_irq_pend(uint32_t core_mask, uint irq);
+
+/* runs the DMA and the PSRAM device until nothing moves any more, HAL lock held */
+void sim_io_service(void);
+
+/* picks up FIFO accesses the CPU made behind the model's back, HAL lock held */
+void sim_io_cpu_commit(void);
+
+/* takes the acknowledges the firmware stored into the GPIO interrupt latches, HAL lock held */
+void sim_io_gpio_ack(void);
+
+/* level interrupts that are still asserted after their handler pend again, HAL lock held */
+uint32_t sim_io_irq_begin(uint core, uint irq);
+void sim_io_irq_end(uint core, uint irq, uint32_t state);
+
+void sim_io_reset(void);
@@ -0,0 +1,1189 @@
+/*
+* Host model of the RP2040 peripherals the card uses: GPIO with the bank 0
+* interrupt, the PIO FIFOs, the DMA channels, the PSRAM chip behind pio1 and
+* the EXI side of pio0, driven byte by byte by the cube.
+*
+* The PIO programs are not executed. Each state machine gets a role from the
+* stand-in init functions and the model does what that program would do with
+* its FIFOs. The CPU reads and writes the PSRAM FIFO registers directly, the
+* model can't see those accesses; a poll that tells the CPU it may access the
+* FIFO arms the state machine and the access is carried out at the next call
+* into the model from the same thread, which in pio_qspi.c is always the next
+* poll.
+*/
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "gc_mc_spi.pio.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/structs/iobank0.h"
+#include "qspi.pio.h"
+
+#include "sim_internal.h"
+
+#define FIFO_MAX            8
+/* the chip keeps going while the host has no thread on it, up to this much time is made up at once */
+#define PSRAM_CATCH_UP_US   2000
+#define PSRAM_DEFAULT_RATE  8
+#define PSRAM_MASK          (SIM_PSRAM_SIZE - 1)
+#define EXI_CATCH_UP_BYTES  8
+#define EXI_GAP_US          1000000
+#define EXI_SETTLE_CPU_US   100
+
+pio_hw_t sim_pio[2];
+dma_hw_t sim_dma;
+iobank0_hw_t sim_iobank0;
+
+const pio_program_t cmd_reader_program = { NULL, 4, -1 };
+const pio_program_t dat_writer_program = { NULL, 9, -1 };
+const pio_program_t clock_probe_program = { NULL, 10, -1 };
+const pio_program_t spi_cpha0_program = { NULL, 2, -1 };
+const pio_program_t qspi_cpha0_program = { NULL, 2, -1 };
+
+/* ---- state ---- */
+
+typedef struct {
+    uint32_t buf[FIFO_MAX];
+    uint8_t head;
+    uint8_t count;
+    uint8_t depth;
+} fifo_t;
+
+enum {
+    ROLE_NONE,
+    ROLE_CMD_READER,
+    ROLE_DAT_WRITER,
+    ROLE_CLOCK_PROBE,
+    ROLE_PSRAM,
+};
+
+typedef struct {
+    bool claimed;
+    bool enabled;
+    int role;
+    fifo_t tx;
+    fifo_t rx;
+    uint32_t osr;
+    uint8_t osr_bits;
+} sm_t;
+
+static sm_t sms[2][NUM_PIO_STATE_MACHINES];
+static uint32_t instr_used[2];
+
+typedef struct {
+    uintptr_t read;
+    uintptr_t write;
+    uint32_t count;
+    uint32_t reload;
+    uint32_t ctrl;
+    bool busy;
+} channel_t;
+
+static channel_t channels[NUM_DMA_CHANNELS];
+static uint32_t channels_claimed;
+
+static struct {
+    bool armed;
+    pthread_t thread;
+    bool pop;
+    uint pio;
+    uint sm;
+} cpu_fifo;
+
+static struct {
+    uint8_t *mem;
+    bool selected;
+    bool qpi;
+    uint32_t pos;
+    uint8_t cmd;
+    uint32_t addr;
+    bool hold;
+    uint32_t rate;
+    double credit;
+    uint64_t credit_us;
+    uint32_t misaligned;
+} psram;
+
+static uint32_t gpio_levels;
+static uint32_t gpio_fall_count[NUM_BANK0_GPIOS];
+static uint32_t gpio_rise_count[NUM_BANK0_GPIOS];
+/* raw edge latches; sim_iobank0.intr only takes the write 1 to clear acknowledges */
+static uint32_t io_intr[4];
+static bool io_irq_active[NUM_CORES];
+
+static struct {
+    uint32_t byte_ns;
+    uint64_t next_ns;
+    bool held;
+    bool card_waiting;  /* core 1 found the command FIFO empty since the last deselect */
+    sim_exi_stats_t stats;
+} exi;
+
+/* ---- FIFOs ---- */
+
+static void fifo_reset(fifo_t *f, uint8_t depth) {
+    f->head = 0;
+    f->count = 0;
+    f->depth = depth;
+}
+
+static bool fifo_full(const fifo_t *f) {
+    return f->count >= f->depth;
+}
+
+static bool fifo_push(fifo_t *f, uint32_t v) {
+    if (fifo_full(f))
+        return false;
+    f->buf[(f->head + f->count) % FIFO_MAX] = v;
+    f->count++;
+    return true;
+}
+
+static uint32_t fifo_peek(const fifo_t *f) {
+    return f->count ? f->buf[f->head] : 0;
+}
+
+static uint32_t fifo_pop(fifo_t *f) {
+    uint32_t v = fifo_peek(f);
+    if (f->count) {
+        f->head = (f->head + 1) % FIFO_MAX;
+        f->count--;
+    }
+    return v;
+}
+
+static sm_t *sm_of(PIO pio, uint sm) {
+    return &sms[pio_get_index(pio)][sm];
+}
+
+static sm_t *sm_with_role(int role, uint *pio_out, uint *sm_out) {
+    for (uint p = 0; p < 2; p++) {
+        for (uint s = 0; s < NUM_PIO_STATE_MACHINES; s++) {
+            if (sms[p][s].role == role) {
+                if (pio_out)
+                    *pio_out = p;
+                if (sm_out)
+                    *sm_out = s;
+                return &sms[p][s];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* ---- PSRAM device ---- */
+
+static uint8_t psram_byte(uint8_t in) {
+    uint32_t pos = psram.pos++;
+
+    if (pos == 0) {
+        psram.cmd = in;
+        psram.addr = 0;
+        return 0;
+    }
+
+    if (!psram.qpi) {
+        /* the driver finds the KGD id at these positions of its read id exchange */
+        if (psram.cmd == 0x9F)
+            return pos == 6 ? 0x0D : pos == 7 ? 0x5D : 0;
+        return 0;
+    }
+
+    switch (psram.cmd) {
+        case 0xEB:
+            if (pos <= 3) {
+                psram.addr = (psram.addr << 8) | in;
+                return 0;
+            }
+            if (pos < 7)
+                return 0;
+            return psram.mem[(psram.addr + pos - 7) & PSRAM_MASK];
+        case 0x38:
+            if (pos <= 3) {
+                psram.addr = (psram.addr << 8) | in;
+                return 0;
+            }
+            psram.mem[(psram.addr + pos - 4) & PSRAM_MASK] = in;
+            return 0;
+    }
+    return 0;
+}
+
+static void psram_credit_update(void) {
+    uint64_t now = sim_now_us();
+    if (psram.rate) {
+        psram.credit += (double)(now - psram.credit_us) * psram.rate;
+        if (psram.credit > (double)PSRAM_CATCH_UP_US * psram.rate)
+            psram.credit = (double)PSRAM_CATCH_UP_US * psram.rate;
+    }
+    psram.credit_us = now;
+}
+
+/* moves bytes through the chip while the state machine could, returns whether it did */
+static bool psram_step(bool forced) {
+    sm_t *sm = sm_with_role(ROLE_PSRAM, NULL, NULL);
+    bool moved = false;
+
+    if (!sm || !sm->enabled)
+        return false;
+    while (sm->tx.count && !fifo_full(&sm->rx)) {
+        if (psram.hold && psram.qpi && psram.cmd == 0xEB && psram.pos >= 4)
+            break;
+        if (psram.rate && !forced && psram.credit < 1.0)
+            break;
+        uint8_t in = (uint8_t)fifo_pop(&sm->tx);
+        fifo_push(&sm->rx, psram.selected ? psram_byte(in) : 0);
+        if (psram.rate)
+            psram.credit -= 1.0;
+        moved = true;
+        if (forced)
+            break;
+    }
+    return moved;
+}
+
+static void psram_select(bool selected) {
+    sm_t *sm = sm_with_role(ROLE_PSRAM, NULL, NULL);
+
+    if (selected && !psram.selected) {
+        psram.selected = true;
+        psram.pos = 0;
+        if (sm && sm->rx.count > 1)
+            psram.misaligned++;
+    } else if (!selected && psram.selected) {
+        /* whatever is still queued goes out before CS rises */
+        while (sm && sm->tx.count) {
+            uint8_t in = (uint8_t)fifo_pop(&sm->tx);
+            uint8_t out = psram_byte(in);
+            fifo_push(&sm->rx, out);
+        }
+        if (!psram.qpi && psram.cmd == 0x35 && psram.pos >= 1)
+            psram.qpi = true;
+        psram.selected = false;
+    }
+}
+
+uint8_t *sim_psram(void) {
+    return psram.mem;
+}
+
+void sim_psram_set_rate(uint32_t bytes_per_us) {
+    sim_hal_enter();
+    psram.rate = bytes_per_us;
+    psram.credit = 0;
+    psram.credit_us = sim_now_us();
+    sim_hal_exit();
+}
+
+void sim_psram_hold_reads(bool hold) {
+    sim_hal_enter();
+    psram.hold = hold;
+    sim_hal_exit();
+}
+
+uint32_t sim_psram_misaligned(void) {
+    return psram.misaligned;
+}
+
+static void cpu_fifo_arm(uint pio, uint sm, bool pop) {
+    cpu_fifo.armed = true;
+    cpu_fifo.thread = pthread_self();
+    cpu_fifo.pio = pio;
+    cpu_fifo.sm = sm;
+    cpu_fifo.pop = pop;
+    if (pop)
+        *(volatile uint32_t *)&sim_pio[pio].rxf[sm] = fifo_peek(&sms[pio][sm].rx);
+}
+
+void sim_io_cpu_commit(void) {
+    if (!cpu_fifo.armed || !pthread_equal(cpu_fifo.thread, pthread_self()))
+        return;
+    cpu_fifo.armed = false;
+
+    sm_t *sm = &sms[cpu_fifo.pio][cpu_fifo.sm];
+    if (cpu_fifo.pop)
+        fifo_pop(&sm->rx);
+    fifo_push(&sm->tx, sim_pio[cpu_fifo.pio].txf[cpu_fifo.sm] & 0xFF);
+    /* the CPU waits on every byte, only DMA runs at the rate of the chip */
+    psram_step(true);
+}
+
+/* ---- GPIO ---- */
+
+static io_irq_ctrl_hw_t *irq_ctrl(uint core) {
+    return core ? &sim_iobank0.proc1_irq_ctrl : &sim_iobank0.proc0_irq_ctrl;
+}
+
+static bool io_irq_update(uint core) {
+    io_irq_ctrl_hw_t *ctrl = irq_ctrl(core);
+    bool asserted = false;
+    for (int i = 0; i < 4; i++) {
+        *(volatile uint32_t *)&ctrl->ints[i] = io_intr[i] & ctrl->inte[i];
+        asserted |= ctrl->ints[i] != 0;
+    }
+    return asserted;
+}
+
+static void gpio_set_level(uint gpio, bool value) {
+    bool old = (gpio_levels >> gpio) & 1;
+    if (old == value)
+        return;
+    if (value) {
+        gpio_levels |= 1u << gpio;
+        gpio_rise_count[gpio]++;
+    } else {
+        gpio_levels &= ~(1u << gpio);
+        gpio_fall_count[gpio]++;
+    }
+
+    uint32_t event = value ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    io_intr[gpio / 8] |= event << (4 * (gpio % 8));
+    for (uint core = 0; core < NUM_CORES; core++)
+        if (io_irq_update(core))
+            sim_irq_pend(1u << core, IO_IRQ_BANK0);
+}
+
+void gpio_init(uint gpio) {
+    (void)gpio;
+}
+
+void gpio_put(uint gpio, bool value) {
+    sim_hal_enter();
+    if (gpio == PSRAM_CS)
+        psram_select(!value);
+    gpio_set_level(gpio, value);
+    sim_hal_exit();
+}
+
+bool gpio_get(uint gpio) {
+    return (gpio_levels >> gpio) & 1;
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    (void)gpio;
+    (void)out;
+}
+
+void gpio_disable_pulls(uint gpio) {
+    (void)gpio;
+}
+
+void gpio_set_drive_strength(uint gpio, enum gpio_drive_strength drive) {
+    (void)gpio;
+    (void)drive;
+}
+
+void gpio_set_slew_rate(uint gpio, enum gpio_slew_rate slew) {
+    (void)gpio;
+    (void)slew;
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled) {
+    io_irq_ctrl_hw_t *ctrl = irq_ctrl(get_core_num());
+    uint32_t bits = events << (4 * (gpio % 8));
+
+    sim_hal_enter();
+    /* like the SDK, stale edges are acknowledged first */
+    io_intr[gpio / 8] &= ~bits;
+    if (enabled)
+        ctrl->inte[gpio / 8] |= bits;
+    else
+        ctrl->inte[gpio / 8] &= ~bits;
+    io_irq_update(get_core_num());
+    sim_hal_exit();
+}
+
+bool sim_gpio_level(uint gpio) {
+    return gpio_get(gpio);
+}
+
+uint32_t sim_gpio_falls(uint gpio) {
+    return gpio_fall_count[gpio];
+}
+
+bool sim_wait_gpio(uint gpio, bool level, uint32_t timeout_us) {
+    uint64_t deadline = sim_now_us() + timeout_us;
+    while (gpio_get(gpio) != level) {
+        if (sim_now_us() > deadline)
+            return false;
+        sched_yield();
+    }
+    return true;
+}
+
+/* ---- interrupts raised by the model ---- */
+
+/*
+* The handler acknowledges with a plain store like on the chip, picked up here
+* on the next call into the model. Swapped out atomically, the store happens
+* outside the lock.
+*/
+void sim_io_gpio_ack(void) {
+    bool acked = false;
+    for (int i = 0; i < 4; i++) {
+        uint32_t bits = __atomic_exchange_n((uint32_t *)&sim_iobank0.intr[i], 0, __ATOMIC_ACQ_REL);
+        if (bits) {
+            io_intr[i] &= ~bits;
+            acked = true;
+        }
+    }
+    if (acked)
+        for (uint core = 0; core < NUM_CORES; core++)
+            io_irq_update(core);
+}
+
+uint32_t sim_io_irq_begin(uint core, uint irq) {
+    if (irq == IO_IRQ_BANK0)
+        io_irq_active[core] = true;
+    return 0;
+}
+
+void sim_io_irq_end(uint core, uint irq, uint32_t state) {
+    (void)state;
+    if (irq == DMA_IRQ_0) {
+        if (sim_dma.ints0 & sim_dma.inte0)
+            sim_irq_pend(1u << core, DMA_IRQ_0);
+    } else if (irq == IO_IRQ_BANK0) {
+        /* an edge that came in after the handler looked is still latched */
+        io_irq_active[core] = false;
+        if (io_irq_update(core))
+            sim_irq_pend(1u << core, IO_IRQ_BANK0);
+    }
+}
+
+/* ---- PIO ---- */
+
+void cmd_reader_program_init(PIO pio, uint sm, uint offset) {
+    (void)offset;
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    s->role = ROLE_CMD_READER;
+    s->enabled = false;
+    fifo_reset(&s->tx, 0);
+    fifo_reset(&s->rx, 8);
+    pio->sm[sm].shiftctrl = PIO_SM0_SHIFTCTRL_AUTOPUSH_BITS | (8u << PIO_SM0_SHIFTCTRL_PUSH_THRESH_LSB);
+    sim_hal_exit();
+}
+
+void dat_writer_program_init(PIO pio, uint sm, uint offset) {
+    (void)offset;
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    s->role = ROLE_DAT_WRITER;
+    s->enabled = false;
+    s->osr_bits = 0;
+    fifo_reset(&s->tx, 8);
+    fifo_reset(&s->rx, 0);
+    pio->sm[sm].shiftctrl = PIO_SM0_SHIFTCTRL_AUTOPULL_BITS | (8u << PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB);
+    sim_hal_exit();
+}
+
+void clock_probe_program_init(PIO pio, uint sm, uint offset) {
+    (void)offset;
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    s->role = ROLE_CLOCK_PROBE;
+    s->enabled = false;
+    fifo_reset(&s->tx, 0);
+    fifo_reset(&s->rx, 8);
+    sim_hal_exit();
+}
+
+static void psram_sm_init(PIO pio, uint sm) {
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    s->role = ROLE_PSRAM;
+    fifo_reset(&s->tx, 4);
+    fifo_reset(&s->rx, 4);
+    s->enabled = true;
+    sim_hal_exit();
+}
+
+void pio_spi_init(PIO pio, uint sm, uint prog_offs, uint n_bits, float clkdiv, bool cpha, bool cpol,
+                  uint pin_sck, uint pin_mosi, uint pin_miso) {
+    (void)prog_offs, (void)n_bits, (void)clkdiv, (void)cpha, (void)cpol;
+    (void)pin_sck, (void)pin_mosi, (void)pin_miso;
+    psram_sm_init(pio, sm);
+}
+
+void pio_qspi_init(PIO pio, uint sm, uint prog_offs, uint n_bits, float clkdiv, bool cpha, bool cpol,
+                   uint pin_sck, uint pin_dat) {
+    (void)prog_offs, (void)n_bits, (void)clkdiv, (void)cpha, (void)cpol;
+    (void)pin_sck, (void)pin_dat;
+    psram_sm_init(pio, sm);
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    uint idx = pio_get_index(pio);
+    uint32_t mask = (program->length >= 32) ? 0xFFFFFFFFu : ((1u << program->length) - 1);
+    uint offset;
+
+    sim_hal_enter();
+    for (offset = 0; offset + program->length <= 32; offset++)
+        if (!(instr_used[idx] & (mask << offset)))
+            break;
+    if (offset + program->length > 32) {
+        fprintf(stderr, "sim: no room for a program in pio%u\n", idx);
+        abort();
+    }
+    instr_used[idx] |= mask << offset;
+    sim_hal_exit();
+    return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset) {
+    uint32_t mask = (program->length >= 32) ? 0xFFFFFFFFu : ((1u << program->length) - 1);
+    sim_hal_enter();
+    instr_used[pio_get_index(pio)] &= ~(mask << loaded_offset);
+    sim_hal_exit();
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    int found = -1;
+    sim_hal_enter();
+    for (uint s = 0; s < NUM_PIO_STATE_MACHINES; s++) {
+        if (!sm_of(pio, s)->claimed) {
+            sm_of(pio, s)->claimed = true;
+            found = (int)s;
+            break;
+        }
+    }
+    sim_hal_exit();
+    if (found < 0 && required) {
+        fprintf(stderr, "sim: no free state machine\n");
+        abort();
+    }
+    return found;
+}
+
+void pio_sm_unclaim(PIO pio, uint sm) {
+    sim_hal_enter();
+    sm_of(pio, sm)->claimed = false;
+    sim_hal_exit();
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    sim_hal_enter();
+    sm_of(pio, sm)->enabled = enabled;
+    sim_hal_exit();
+}
+
+void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled) {
+    sim_hal_enter();
+    for (uint s = 0; s < NUM_PIO_STATE_MACHINES; s++)
+        if (mask & (1u << s))
+            sm_of(pio, s)->enabled = enabled;
+    sim_hal_exit();
+}
+
+void pio_restart_sm_mask(PIO pio, uint32_t mask) {
+    sim_hal_enter();
+    for (uint s = 0; s < NUM_PIO_STATE_MACHINES; s++)
+        if (mask & (1u << s))
+            sm_of(pio, s)->osr_bits = 0;
+    sim_hal_exit();
+}
+
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask) {
+    pio_set_sm_mask_enabled(pio, mask, true);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    /* out and pull as used by the drain, both discard one word */
+    if ((instr & 0xE000u) == 0x6000u || (instr & 0xE080u) == 0x8080u) {
+        fifo_pop(&s->tx);
+        s->osr_bits = 0;
+    }
+    sim_hal_exit();
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    s->tx.count = 0;
+    s->rx.count = 0;
+    sim_hal_exit();
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask) {
+    (void)pio, (void)sm, (void)pin_dirs, (void)pin_mask;
+    sim_hal_enter();
+    sim_hal_exit();
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    bool empty = s->rx.count == 0;
+    if (s->role == ROLE_PSRAM && !empty)
+        cpu_fifo_arm(pio_get_index(pio), sm, true);
+    if (s->role == ROLE_CMD_READER && empty && (gpio_levels & (1u << PIN_GC_SEL)))
+        exi.card_waiting = true;
+    sim_hal_exit_poll(empty);
+    return empty;
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm) {
+    sim_hal_enter();
+    bool empty = sm_of(pio, sm)->tx.count == 0;
+    sim_hal_exit();
+    return empty;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    sim_hal_enter();
+    sm_t *s = sm_of(pio, sm);
+    bool full = fifo_full(&s->tx);
+    if (s->role == ROLE_PSRAM && !full)
+        cpu_fifo_arm(pio_get_index(pio), sm, s->rx.count > 0);
+    sim_hal_exit_poll(full);
+    return full;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    sim_hal_enter();
+    uint32_t v = fifo_pop(&sm_of(pio, sm)->rx);
+    sim_hal_exit();
+    return v;
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    while (pio_sm_is_rx_fifo_empty(pio, sm))
+        ;
+    return pio_sm_get(pio, sm);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    sim_hal_enter();
+    fifo_push(&sm_of(pio, sm)->tx, data);
+    sim_hal_exit();
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    for (;;) {
+        sim_hal_enter();
+        sm_t *s = sm_of(pio, sm);
+        bool full = fifo_full(&s->tx);
+        if (!full)
+            fifo_push(&s->tx, data);
+        sim_hal_exit_poll(full);
+        if (!full)
+            return;
+    }
+}
+
+/* ---- DMA ---- */
+
+static void channel_sync(uint ch) {
+    channel_t *c = &channels[ch];
+    dma_channel_hw_t *m = &sim_dma.ch[ch];
+    uint32_t ctrl = c->ctrl | (c->busy ? DMA_CH0_CTRL_TRIG_BUSY_BITS : 0);
+
+    m->read_addr = m->al1_read_addr = m->al2_read_addr = m->al3_read_addr_trig = (uint32_t)c->read;
+    m->write_addr = m->al1_write_addr = m->al2_write_addr_trig = m->al3_write_addr = (uint32_t)c->write;
+    m->transfer_count = m->al1_transfer_count_trig = m->al2_transfer_count = m->al3_transfer_count = c->count;
+    m->ctrl_trig = m->al1_ctrl = m->al2_ctrl = m->al3_ctrl = ctrl;
+}
+
+static void channel_complete(uint ch);
+
+static void channel_trigger(uint ch) {
+    channel_t *c = &channels[ch];
+    if (!(c->ctrl & DMA_CH0_CTRL_TRIG_EN_BITS))
+        return;
+    c->busy = true;
+    c->count = c->reload;
+    channel_sync(ch);
+    if (!c->count)
+        channel_complete(ch);
+}
+
+static void channel_complete(uint ch) {
+    channel_t *c = &channels[ch];
+    uint chain = (c->ctrl & DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS) >> DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB;
+
+    c->busy = false;
+    channel_sync(ch);
+    sim_dma.ints0 |= 1u << ch;
+    if (sim_dma.inte0 & (1u << ch))
+        sim_irq_pend(0x3, DMA_IRQ_0);
+    if (chain != ch)
+        channel_trigger(chain);
+}
+
+static bool in_range(uintptr_t addr, const volatile void *base, size_t size) {
+    return addr >= (uintptr_t)base && addr < (uintptr_t)base + size;
+}
+
+/* register write through the bus, as the burst control channel does */
+static void dma_reg_write(uint ch, uint reg, uint32_t v) {
+    channel_t *c = &channels[ch];
+    bool trigger = false;
+
+    switch (reg) {
+        case 0: case 5: case 10: c->read = v; break;
+        case 15: c->read = v; trigger = true; break;
+        case 1: case 6: case 13: c->write = v; break;
+        case 11: c->write = v; trigger = true; break;
+        case 2: case 9: case 14: c->reload = v; break;
+        case 7: c->reload = v; trigger = true; break;
+        case 3: c->ctrl = v & ~DMA_CH0_CTRL_TRIG_BUSY_BITS; trigger = true; break;
+        case 4: case 8: case 12: c->ctrl = v & ~DMA_CH0_CTRL_TRIG_BUSY_BITS; break;
+    }
+    channel_sync(ch);
+    /* a zero written to a trigger alias is a null trigger, the chain ends there */
+    if (trigger && v)
+        channel_trigger(ch);
+}
+
+static uint32_t bus_read(uintptr_t addr, uint size) {
+    for (uint p = 0; p < 2; p++) {
+        if (in_range(addr, sim_pio[p].rxf, sizeof(sim_pio[p].rxf))) {
+            uintptr_t off = addr - (uintptr_t)sim_pio[p].rxf;
+            uint32_t word = fifo_pop(&sms[p][off / 4].rx);
+            word >>= 8 * (off % 4);
+            return size == 4 ? word : size == 2 ? (word & 0xFFFF) : (word & 0xFF);
+        }
+    }
+    uint32_t v = 0;
+    memcpy(&v, (const void *)addr, size);
+    return v;
+}
+
+static void bus_write(uintptr_t addr, uint32_t v, uint size) {
+    for (uint p = 0; p < 2; p++) {
+        if (in_range(addr, sim_pio[p].txf, sizeof(sim_pio[p].txf))) {
+            uintptr_t off = addr - (uintptr_t)sim_pio[p].txf;
+            /* narrow writes are replicated across the bus lanes */
+            if (size == 1)
+                v = (v & 0xFF) * 0x01010101u;
+            else if (size == 2)
+                v = (v & 0xFFFF) * 0x00010001u;
+            fifo_push(&sms[p][off / 4].tx, v);
+            return;
+        }
+        if (in_range(addr, sim_pio[p].rxf, sizeof(sim_pio[p].rxf)))
+            return;
+    }
+    if (in_range(addr, sim_dma.ch, sizeof(sim_dma.ch))) {
+        uintptr_t off = addr - (uintptr_t)sim_dma.ch;
+        dma_reg_write((uint)(off / sizeof(dma_channel_hw_t)), (uint)(off % sizeof(dma_channel_hw_t)) / 4, v);
+        return;
+    }
+    memcpy((void *)addr, &v, size);
+}
+
+static bool dreq_ready(uint dreq) {
+    if (dreq == DREQ_FORCE)
+        return true;
+    uint p = dreq >> 3;
+    uint s = dreq & 3;
+    if (p > 1)
+        return false;
+    sm_t *sm = &sms[p][s];
+    if ((dreq >> 2) & 1)
+        return sm->rx.count > 0;
+    return sm->tx.depth && !fifo_full(&sm->tx);
+}
+
+static void channel_transfer(uint ch) {
+    channel_t *c = &channels[ch];
+    uint size = 1u << ((c->ctrl & DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+    uint32_t v = bus_read(c->read, size);
+
+    if (c->ctrl & DMA_CH0_CTRL_TRIG_BSWAP_BITS) {
+        if (size == 4)
+            v = __builtin_bswap32(v);
+        else if (size == 2)
+            v = __builtin_bswap16((uint16_t)v);
+    }
+    if (c->ctrl & DMA_CH0_CTRL_TRIG_INCR_READ_BITS)
+        c->read += size;
+    uintptr_t write = c->write;
+    if (c->ctrl & DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS)
+        c->write += size;
+    c->count--;
+    channel_sync(ch);
+    bus_write(write, v, size);
+    if (!c->count)
+        channel_complete(ch);
+}
+
+void sim_io_service(void) {
+    bool progress;
+
+    psram_credit_update();
+    do {
+        progress = false;
+        for (uint ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+            channel_t *c = &channels[ch];
+            uint dreq = (c->ctrl & DMA_CH0_CTRL_TRIG_TREQ_SEL_BITS) >> DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB;
+            if (c->busy && dreq_ready(dreq)) {
+                channel_transfer(ch);
+                progress = true;
+            }
+        }
+        if (psram_step(false))
+            progress = true;
+    } while (progress);
+}
+
+int dma_claim_unused_channel(bool required) {
+    int found = -1;
+    sim_hal_enter();
+    for (uint ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+        if (!(channels_claimed & (1u << ch))) {
+            channels_claimed |= 1u << ch;
+            found = (int)ch;
+            break;
+        }
+    }
+    sim_hal_exit();
+    if (found < 0 && required) {
+        fprintf(stderr, "sim: out of DMA channels\n");
+        abort();
+    }
+    return found;
+}
+
+void dma_channel_claim(uint channel) {
+    dma_claim_mask(1u << channel);
+}
+
+void dma_claim_mask(uint32_t channel_mask) {
+    sim_hal_enter();
+    channels_claimed |= channel_mask;
+    sim_hal_exit();
+}
+
+void dma_channel_unclaim(uint channel) {
+    dma_unclaim_mask(1u << channel);
+}
+
+void dma_unclaim_mask(uint32_t channel_mask) {
+    sim_hal_enter();
+    channels_claimed &= ~channel_mask;
+    sim_hal_exit();
+}
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger) {
+    sim_hal_enter();
+    channels[channel].ctrl = config->ctrl;
+    channel_sync(channel);
+    if (trigger)
+        channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) {
+    sim_hal_enter();
+    channels[channel].read = (uintptr_t)read_addr;
+    channel_sync(channel);
+    if (trigger)
+        channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger) {
+    sim_hal_enter();
+    channels[channel].write = (uintptr_t)write_addr;
+    channel_sync(channel);
+    if (trigger)
+        channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    sim_hal_enter();
+    channels[channel].reload = trans_count;
+    channel_sync(channel);
+    if (trigger)
+        channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) {
+    sim_hal_enter();
+    channel_t *c = &channels[channel];
+    c->write = (uintptr_t)write_addr;
+    c->read = (uintptr_t)read_addr;
+    c->reload = transfer_count;
+    c->ctrl = config->ctrl;
+    channel_sync(channel);
+    if (trigger)
+        channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count) {
+    sim_hal_enter();
+    channels[channel].read = (uintptr_t)read_addr;
+    channels[channel].reload = transfer_count;
+    channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_channel_transfer_to_buffer_now(uint channel, volatile void *write_addr, uint32_t transfer_count) {
+    sim_hal_enter();
+    channels[channel].write = (uintptr_t)write_addr;
+    channels[channel].reload = transfer_count;
+    channel_trigger(channel);
+    sim_hal_exit();
+}
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+    sim_hal_enter();
+    for (uint ch = 0; ch < NUM_DMA_CHANNELS; ch++)
+        if (chan_mask & (1u << ch))
+            channel_trigger(ch);
+    sim_hal_exit();
+}
+
+void dma_channel_start(uint channel) {
+    dma_start_channel_mask(1u << channel);
+}
+
+void dma_channel_abort(uint channel) {
+    sim_hal_enter();
+    channels[channel].busy = false;
+    channel_sync(channel);
+    sim_hal_exit();
+}
+
+bool dma_channel_is_busy(uint channel) {
+    sim_hal_enter();
+    bool busy = channels[channel].busy;
+    sim_hal_exit_poll(busy);
+    return busy;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel) {
+    while (dma_channel_is_busy(channel))
+        ;
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    sim_hal_enter();
+    if (enabled)
+        sim_dma.inte0 |= 1u << channel;
+    else
+        sim_dma.inte0 &= ~(1u << channel);
+    sim_hal_exit();
+}
+
+bool dma_channel_get_irq0_status(uint channel) {
+    return (sim_dma.ints0 >> channel) & 1;
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+    sim_hal_enter();
+    sim_dma.ints0 &= ~(1u << channel);
+    sim_hal_exit();
+}
+
+/* ---- EXI, cube side ---- */
+
+static bool dat_has_byte(const sm_t *dat) {
+    return dat && dat->enabled && (dat->osr_bits >= 8 || dat->tx.count);
+}
+
+static uint8_t dat_next_byte(PIO pio, uint sm_num, sm_t *dat) {
+    if (!dat || !dat->enabled)
+        return 0xFF;
+    if (dat->osr_bits < 8) {
+        if (!dat->tx.count) {
+            exi.stats.tx_idle++;
+            return 0xFF;
+        }
+        uint thresh = (pio->sm[sm_num].shiftctrl & PIO_SM0_SHIFTCTRL_PULL_THRESH_BITS) >> PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB;
+        dat->osr = fifo_pop(&dat->tx);
+        dat->osr_bits = (uint8_t)(thresh ? thresh : 32);
+    }
+    uint8_t out = (uint8_t)(dat->osr >> 24);
+    dat->osr <<= 8;
+    dat->osr_bits -= 8;
+    return out;
+}
+
+void sim_exi_set_byte_ns(uint32_t ns) {
+    exi.byte_ns = ns;
+}
+
+/*
+* The cube leaves microseconds between two transfers, on the RP2040 that is
+* plenty for core 1 to finish the last command. A host thread can be off the
+* CPU for much longer, so the next select waits until core 1 looks for a
+* command again, or a card that never does has had a long while.
+*/
+void sim_exi_select(void) {
+    uint64_t deadline = sim_now_us() + EXI_GAP_US;
+    for (;;) {
+        sim_hal_enter();
+        if (exi.card_waiting || sim_now_us() > deadline)
+            break;
+        sim_hal_exit();
+        sched_yield();
+    }
+    gpio_set_level(PIN_GC_SEL, false);
+    sim_hal_exit();
+    exi.next_ns = sim_now_us() * 1000;
+}
+
+/*
+* SEL rises a few microseconds after the last byte, core 1 has long seen the
+* DMA of the transfer finish by then. A host thread may not have run since,
+* so SEL waits until core 1 looked at the model again, or spun for a while
+* in a loop that doesn't.
+*/
+bool sim_exi_deselect(uint32_t timeout_us) {
+    uint32_t rise = GPIO_IRQ_EDGE_RISE << (4 * (PIN_GC_SEL % 8));
+    uint32_t calls = sim_core1_calls();
+    uint64_t cpu_us = sim_core1_cpu_us();
+    uint64_t settle = sim_now_us() + EXI_GAP_US;
+
+    while (cpu_us && (sim_core1_calls() == calls) && (sim_core1_cpu_us() < cpu_us + EXI_SETTLE_CPU_US)
+           && (sim_now_us() < settle))
+        sched_yield();
+
+    sim_hal_enter();
+    bool wait = sim_iobank0.proc1_irq_ctrl.inte[PIN_GC_SEL / 8] & rise;
+    gpio_set_level(PIN_GC_SEL, true);
+    exi.card_waiting = false;
+    sim_hal_exit();
+
+    /* handled once core 1 acknowledged the edge and left the handler */
+    uint64_t deadline = sim_now_us() + timeout_us;
+    for (;;) {
+        sim_hal_enter();
+        bool pending = (io_intr[PIN_GC_SEL / 8] & rise) || io_irq_active[1];
+        sim_hal_exit();
+        if (!wait || !pending)
+            return true;
+        if (sim_now_us() > deadline)
+            return false;
+        sched_yield();
+    }
+}
+
+int sim_exi_byte(uint8_t di, unsigned flags, uint32_t timeout_us) {
+    uint64_t deadline = sim_now_us() + timeout_us;
+    uint cmd_pio = 0, cmd_sm = 0, dat_pio = 0, dat_sm = 0;
+    bool held = exi.held;
+
+    /* pace the bus, a cube that fell behind clocks back to back until it caught up */
+    if (!held && exi.byte_ns) {
+        while (sim_now_us() * 1000 < exi.next_ns)
+            sched_yield();
+    }
+
+    for (;;) {
+        if (!exi.held)
+            sim_hal_enter();
+        exi.held = false;
+        sm_t *cmd = sm_with_role(ROLE_CMD_READER, &cmd_pio, &cmd_sm);
+        sm_t *dat = sm_with_role(ROLE_DAT_WRITER, &dat_pio, &dat_sm);
+        bool rx_ok = !(flags & SIM_EXI_RX) || (cmd && cmd->enabled && !fifo_full(&cmd->rx));
+        bool tx_ok = !(flags & SIM_EXI_TX) || dat_has_byte(dat);
+        if (rx_ok && tx_ok)
+            break;
+        sim_hal_exit();
+        if (sim_now_us() > deadline)
+            return -1;
+        sched_yield();
+    }
+
+    sm_t *cmd = &sms[cmd_pio][cmd_sm];
+    sm_t *dat = &sms[dat_pio][dat_sm];
+    uint8_t out = dat_next_byte(&sim_pio[dat_pio], dat_sm, dat);
+    bool stored = !gpio_get(PIN_GC_SEL) && cmd->enabled && cmd->role == ROLE_CMD_READER && fifo_push(&cmd->rx, di);
+    if (!stored)
+        exi.stats.rx_overruns++;
+    exi.stats.bytes++;
+    sim_io_service();
+
+    uint64_t now_ns = sim_now_us() * 1000;
+    if (now_ns > exi.next_ns + (uint64_t)EXI_CATCH_UP_BYTES * exi.byte_ns)
+        exi.next_ns = now_ns;
+    exi.next_ns += exi.byte_ns;
+
+    if (flags & SIM_EXI_HOLD)
+        exi.held = true;
+    else
+        sim_hal_exit();
+    return out;
+}
+
+bool sim_exi_wait_rx_drained(uint32_t timeout_us) {
+    uint64_t deadline = sim_now_us() + timeout_us;
+    for (;;) {
+        sim_hal_enter();
+        sm_t *cmd = sm_with_role(ROLE_CMD_READER, NULL, NULL);
+        bool drained = !cmd || cmd->rx.count == 0;
+        sim_hal_exit();
+        if (drained)
+            return true;
+        if (sim_now_us() > deadline)
+            return false;
+        sched_yield();
+    }
+}
+
+bool sim_exi_tx_ready(void) {
+    sim_hal_enter();
+    bool ready = dat_has_byte(sm_with_role(ROLE_DAT_WRITER, NULL, NULL));
+    sim_hal_exit();
+    return ready;
+}
+
+void sim_exi_get_stats(sim_exi_stats_t *stats) {
+    sim_hal_enter();
+    *stats = exi.stats;
+    sim_hal_exit();
+}
+
+/* ---- reset ---- */
+
+void sim_io_reset(void) {
+    static uint8_t *mem;
+
+    if (!mem) {
+        mem = malloc(SIM_PSRAM_SIZE);
+        if (!mem) {
+            fprintf(stderr, "sim: no memory for the PSRAM\n");
+            abort();
+        }
+    }
+    memset(mem, 0, SIM_PSRAM_SIZE);
+
+    memset(sim_pio, 0, sizeof(sim_pio));
+    memset(&sim_dma, 0, sizeof(sim_dma));
+    memset(&sim_iobank0, 0, sizeof(sim_iobank0));
+    memset(sms, 0, sizeof(sms));
+    memset(instr_used, 0, sizeof(instr_used));
+    memset(channels, 0, sizeof(channels));
+    channels_claimed = 0;
+    memset(&cpu_fifo, 0, sizeof(cpu_fifo));
+    memset(&psram, 0, sizeof(psram));
+    psram.mem = mem;
+    psram.rate = PSRAM_DEFAULT_RATE;
+    psram.credit_us = sim_now_us();
+    memset(gpio_fall_count, 0, sizeof(gpio_fall_count));
+    memset(gpio_rise_count, 0, sizeof(gpio_rise_count));
+    memset(io_intr, 0, sizeof(io_intr));
+    memset(io_irq_active, 0, sizeof(io_irq_active));
+    /* SEL idles high, CS too once the driver set it up */
+    gpio_levels = 1u << PIN_GC_SEL;
+    memset(&exi, 0, sizeof(exi));
+    exi.byte_ns = 500;
+}
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gc_mc_spi.pio.h"
+
+#include "cube.h"
+#include "sim_hw.h"
+
+#define CMD_PROBE           0x00
+#define CMD_READ            0x52
+#define CMD_INT_ENABLE      0x81
+#define CMD_STATUS          0x83
+#define CMD_CLEAR_STATUS    0x89
+#define CMD_ERASE_SECTOR    0xF1
+#define CMD_WRITE           0xF2
+#define CMD_MCE             0x8B
+
+#define MCE_GET_DEV_ID          0x00
+#define MCE_SET_ACCESS_MODE     0x02
+#define MCE_BLOCK_START_READ    0x20
+#define MCE_BLOCK_READ          0x21
+#define MCE_BLOCK_START_WRITE   0x22
+#define MCE_BLOCK_WRITE         0x23
+#define MCE_BURST_START_READ    0x24
+#define MCE_BURST_READ          0x25
+#define MCE_BURST_START_WRITE   0x26
+#define MCE_BURST_WRITE         0x27
+
+/* what the IPL sends in its first unlock message, the card only counts the bytes */
+#define UNLOCK_OFFSET       0x7FEC8000u
+#define UNLOCK_LENGTH_0     16
+#define UNLOCK_LENGTH_1     8
+
+static uint32_t latency = 128;
+static bool int_enabled;
+static uint32_t int_falls;
+
+#define TRY(x) do { if ((x) < 0) { fprintf(stderr, "cube: %s timed out at %s:%u\n", __func__, __FILE__, __LINE__); sim_exi_deselect(CUBE_TIMEOUT_US); return false; } } while (0)
+
+static int xfer(uint8_t di, unsigned flags) {
+    return sim_exi_byte(di, flags, CUBE_TIMEOUT_US);
+}
+
+static void begin(void) {
+    int_falls = sim_gpio_falls(PIN_GC_INT);
+    sim_exi_select();
+}
+
+/* every received byte has to be taken before SEL rises, the deselect throws away what is left */
+static bool end_drained(void) {
+    if (!sim_exi_wait_rx_drained(CUBE_TIMEOUT_US)) {
+        fprintf(stderr, "cube: card did not take all bytes\n");
+        sim_exi_deselect(CUBE_TIMEOUT_US);
+        return false;
+    }
+    return sim_exi_deselect(CUBE_TIMEOUT_US);
+}
+
+static bool send_address(uint32_t addr) {
+    TRY(xfer((uint8_t)(addr >> 17), SIM_EXI_RX));
+    TRY(xfer((uint8_t)(addr >> 9), SIM_EXI_RX));
+    TRY(xfer((uint8_t)((addr >> 7) & 0x03), SIM_EXI_RX));
+    TRY(xfer((uint8_t)(addr & 0x7F), SIM_EXI_RX));
+    return true;
+}
+
+static bool send_latency(void) {
+    for (uint32_t i = 0; i < latency; i++)
+        TRY(xfer(0x00, SIM_EXI_RX));
+    return true;
+}
+
+uint32_t cube_id_latency(uint32_t id) {
+    return 4u << ((id >> 8) & 0x07);
+}
+
+bool cube_probe(uint32_t *id) {
+    uint32_t value = 0;
+
+    begin();
+    TRY(xfer(CMD_PROBE, SIM_EXI_RX));
+    TRY(xfer(0x00, SIM_EXI_RX));
+    for (int i = 0; i < 4; i++) {
+        int b = xfer(0x00, SIM_EXI_TX);
+        TRY(b);
+        value = (value << 8) | (uint32_t)b;
+    }
+    if (!sim_exi_deselect(CUBE_TIMEOUT_US))
+        return false;
+
+    latency = cube_id_latency(value);
+    if (id)
+        *id = value;
+    return true;
+}
+
+static bool unlock_stage_0(uint32_t offset, uint32_t length) {
+    begin();
+    TRY(xfer(CMD_READ, SIM_EXI_RX));
+    /* the card takes the offset bits from where a read has its address */
+    if (!send_address(offset >> 12))
+        return false;
+    if (!send_latency())
+        return false;
+    for (uint32_t i = 0; i < length; i++)
+        TRY(xfer(0x00, SIM_EXI_RX));
+    return end_drained();
+}
+
+static bool unlock_stage_1(uint32_t key[CUBE_UNLOCK_KEY_WORDS], cube_timing_t *timing) {
+    uint64_t start = sim_now_us();
+
+    begin();
+    TRY(xfer(CMD_READ, SIM_EXI_RX));
+    for (int i = 0; i < 4; i++)
+        TRY(xfer(0x00, SIM_EXI_RX));
+    uint64_t wait_start = sim_now_us();
+    uint64_t cpu_start = sim_core1_cpu_us();
+    if (!send_latency())
+        return false;
+    /* the card answers each key word while taking the cube's word of the same exchange */
+    for (int i = 0; i < CUBE_UNLOCK_KEY_WORDS * 4; i++) {
+        int b = xfer(0x00, SIM_EXI_RX | SIM_EXI_TX);
+        TRY(b);
+        if (i == 0 && timing) {
+            timing->first_data_us = (uint32_t)(sim_now_us() - wait_start);
+            timing->core1_cpu_us = (uint32_t)(sim_core1_cpu_us() - cpu_start);
+        }
+        key[i / 4] = (key[i / 4] << 8) | (uint32_t)b;
+    }
+    for (int i = 0; i < UNLOCK_LENGTH_1; i++)
+        TRY(xfer(0x00, SIM_EXI_RX));
+    if (!end_drained())
+        return false;
+    if (timing)
+        timing->wall_us = (uint32_t)(sim_now_us() - start);
+    return true;
+}
+
+static bool unlock_stage_n(void) {
+    begin();
+    TRY(xfer(CMD_READ, SIM_EXI_RX));
+    return end_drained();
+}
+
+bool cube_unlock_keys(uint32_t offset, uint32_t length, uint32_t key[CUBE_UNLOCK_KEY_WORDS], cube_timing_t *timing) {
+    uint8_t status;
+
+    if (!unlock_stage_0(offset, length) || !unlock_stage_1(key, timing) || !unlock_stage_n() || !unlock_stage_n())
+        return false;
+    if (!cube_status(&status))
+        return false;
+    if ((status & 0x40) == 0) {
+        fprintf(stderr, "cube: still locked, status %02x\n", status);
+        return false;
+    }
+    return true;
+}
+
+bool cube_unlock(void) {
+    uint32_t key[CUBE_UNLOCK_KEY_WORDS];
+
+    return cube_unlock_keys(UNLOCK_OFFSET, UNLOCK_LENGTH_0, key, NULL);
+}
+
+bool cube_read(uint32_t addr, uint8_t *page, cube_timing_t *timing) {
+    uint64_t start = sim_now_us();
+
+    begin();
+    TRY(xfer(CMD_READ, SIM_EXI_RX));
+    if (!send_address(addr))
+        return false;
+    uint64_t wait_start = sim_now_us();
+    uint64_t cpu_start = sim_core1_cpu_us();
+    if (!send_latency())
+        return false;
+    for (uint32_t i = 0; i < CUBE_PAGE_SIZE; i++) {
+        int b = xfer(0x00, SIM_EXI_TX);
+        TRY(b);
+        if (i == 0 && timing) {
+            timing->first_data_us = (uint32_t)(sim_now_us() - wait_start);
+            timing->core1_cpu_us = (uint32_t)(sim_core1_cpu_us() - cpu_start);
+        }
+        page[i] = (uint8_t)b;
+    }
+    if (!sim_exi_deselect(CUBE_TIMEOUT_US))
+        return false;
+    if (timing)
+        timing->wall_us = (uint32_t)(sim_now_us() - start);
+    return true;
+}
+
+bool cube_write(uint32_t addr, const uint8_t *data, cube_timing_t *timing) {
+    uint64_t start = sim_now_us();
+
+    begin();
+    TRY(xfer(CMD_WRITE, SIM_EXI_RX));
+    if (!send_address(addr))
+        return false;
+    for (uint32_t i = 0; i < CUBE_WRITE_SIZE; i++)
+        TRY(xfer(data[i], SIM_EXI_RX));
+    if (!end_drained())
+        return false;
+    if (int_enabled && !cube_wait_for_int(CUBE_TIMEOUT_US))
+        return false;
+    if (timing) {
+        timing->wall_us = (uint32_t)(sim_now_us() - start);
+        timing->first_data_us = timing->core1_cpu_us = 0;
+    }
+    return true;
+}
+
+bool cube_erase_sector(uint32_t addr, cube_timing_t *timing) {
+    uint64_t start = sim_now_us();
+
+    begin();
+    TRY(xfer(CMD_ERASE_SECTOR, SIM_EXI_RX));
+    TRY(xfer((uint8_t)(addr >> 17), SIM_EXI_RX));
+    TRY(xfer((uint8_t)(addr >> 9), SIM_EXI_RX));
+    if (!end_drained())
+        return false;
+    if (int_enabled && !cube_wait_for_int(CUBE_TIMEOUT_US))
+        return false;
+    if (timing) {
+        timing->wall_us = (uint32_t)(sim_now_us() - start);
+        timing->first_data_us = timing->core1_cpu_us = 0;
+    }
+    return true;
+}
+
+bool cube_int_enable(bool enable) {
+    begin();
+    TRY(xfer(CMD_INT_ENABLE, SIM_EXI_RX));
+    TRY(xfer(enable ? 0x01 : 0x00, SIM_EXI_RX));
+    if (!end_drained())
+        return false;
+    int_enabled = enable;
+    return true;
+}
+
+/* INT is released at the start of every command, a fall since the last select is this command's */
+bool cube_wait_for_int(uint32_t timeout_us) {
+    uint64_t deadline = sim_now_us() + timeout_us;
+
+    while (sim_gpio_falls(PIN_GC_INT) == int_falls) {
+        if (sim_now_us() > deadline) {
+            fprintf(stderr, "cube: no interrupt\n");
+            return false;
+        }
+        sim_yield();
+    }
+    return true;
+}
+
+bool cube_status(uint8_t *status) {
+    begin();
+    /* the second byte is already on the bus when the card sees the command */
+    TRY(xfer(CMD_STATUS, SIM_EXI_RX | SIM_EXI_HOLD));
+    TRY(xfer(0x00, 0));
+    int b = xfer(0x00, SIM_EXI_TX);
+    TRY(b);
+    *status = (uint8_t)b;
+    return sim_exi_deselect(CUBE_TIMEOUT_US);
+}
+
+bool cube_clear_status(void) {
+    begin();
+    TRY(xfer(CMD_CLEAR_STATUS, SIM_EXI_RX));
+    return end_drained();
+}
+
+static bool mce_begin(uint8_t cmd) {
+    begin();
+    TRY(xfer(CMD_MCE, SIM_EXI_RX));
+    TRY(xfer(cmd, SIM_EXI_RX));
+    return true;
+}
+
+bool cube_mce_dev_id(uint8_t *caps, uint8_t *burst_max) {
+    uint8_t id[6];
+
+    if (!mce_begin(MCE_GET_DEV_ID))
+        return false;
+    for (int i = 0; i < 6; i++) {
+        int b = xfer(0x00, SIM_EXI_TX);
+        TRY(b);
+        id[i] = (uint8_t)b;
+    }
+    if (!sim_exi_deselect(CUBE_TIMEOUT_US))
+        return false;
+    if ((id[0] != 0x38) || (id[1] != 0x42)) {
+        fprintf(stderr, "cube: no MMCE device, ID %02x%02x\n", id[0], id[1]);
+        return false;
+    }
+    *caps = id[4];
+    *burst_max = id[5];
+    return true;
+}
+
+bool cube_mce_set_access_mode(bool exclusive) {
+    if (!mce_begin(MCE_SET_ACCESS_MODE))
+        return false;
+    TRY(xfer(exclusive ? 0x01 : 0x00, SIM_EXI_RX));
+    if (!end_drained())
+        return false;
+    return !exclusive || cube_wait_for_int(CUBE_TIMEOUT_US);
+}
+
+static bool mce_start(uint8_t cmd, uint32_t sector, uint16_t count) {
+    if (!mce_begin(cmd))
+        return false;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        TRY(xfer((uint8_t)(sector >> shift), SIM_EXI_RX));
+    TRY(xfer((uint8_t)(count >> 8), SIM_EXI_RX));
+    TRY(xfer((uint8_t)count, SIM_EXI_RX));
+    if (!end_drained())
+        return false;
+    return cube_wait_for_int(CUBE_TIMEOUT_US);
+}
+
+bool cube_mce_read(uint32_t sector, uint16_t count, uint32_t burst_max, uint8_t *data) {
+    uint32_t per_transfer = burst_max ? burst_max : 1;
+
+    if (!mce_start(burst_max ? MCE_BURST_START_READ : MCE_BLOCK_START_READ, sector, count))
+        return false;
+    for (uint32_t done = 0; done < count;) {
+        uint32_t n = (count - done < per_transfer) ? count - done : per_transfer;
+
+        if (!mce_begin(burst_max ? MCE_BURST_READ : MCE_BLOCK_READ))
+            return false;
+        TRY(xfer(0x00, SIM_EXI_RX));
+        for (uint32_t i = 0; i < n * CUBE_BLOCK_SIZE; i++) {
+            int b = xfer(0x00, SIM_EXI_TX);
+            TRY(b);
+            data[done * CUBE_BLOCK_SIZE + i] = (uint8_t)b;
+        }
+        done += n;
+        /* the card raises INT for the next transfer while SEL is still low, by then it has sent all of this one */
+        if ((done < count) && !cube_wait_for_int(CUBE_TIMEOUT_US)) {
+            sim_exi_deselect(CUBE_TIMEOUT_US);
+            return false;
+        }
+        if (sim_exi_tx_ready()) {
+            fprintf(stderr, "cube: card sends more than %u blocks\n", n);
+            sim_exi_deselect(CUBE_TIMEOUT_US);
+            return false;
+        }
+        if (!sim_exi_deselect(CUBE_TIMEOUT_US))
+            return false;
+    }
+    return true;
+}
+
+bool cube_mce_write(uint32_t sector, uint16_t count, uint32_t burst_max, const uint8_t *data) {
+    uint32_t per_transfer = burst_max ? burst_max : 1;
+
+    if (!mce_start(burst_max ? MCE_BURST_START_WRITE : MCE_BLOCK_START_WRITE, sector, count))
+        return false;
+    for (uint32_t done = 0; done < count;) {
+        uint32_t n = (count - done < per_transfer) ? count - done : per_transfer;
+
+        if (!mce_begin(burst_max ? MCE_BURST_WRITE : MCE_BLOCK_WRITE))
+            return false;
+        for (uint32_t i = 0; i < n * CUBE_BLOCK_SIZE; i++)
+            TRY(xfer(data[done * CUBE_BLOCK_SIZE + i], SIM_EXI_RX));
+        /* the last INT only comes once all of the request is on the card */
+        if (!end_drained() || !cube_wait_for_int(CUBE_TIMEOUT_US))
+            return false;
+        done += n;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+/*
+* The console side of the EXI bus: the commands the IPL and the games send,
+* clocked byte by byte into the model like the cube does on the real bus.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CUBE_PAGE_SIZE      512
+#define CUBE_WRITE_SIZE     128
+#define CUBE_SECTOR_SIZE    0x2000
+#define CUBE_TIMEOUT_US     2000000
+#define CUBE_UNLOCK_KEY_WORDS 5
+#define CUBE_BLOCK_SIZE     512
+
+typedef struct {
+    uint32_t wall_us;           /* select to deselect */
+    uint32_t first_data_us;     /* end of the address until the first data byte was ready */
+    uint32_t core1_cpu_us;      /* CPU time core 1 spent in that window */
+} cube_timing_t;
+
+/* latency in bytes the card announces in its ID, as the IPL works it out */
+uint32_t cube_id_latency(uint32_t id);
+
+bool cube_probe(uint32_t *id);
+
+/* the four message exchange of the IPL, leaves the card in state 0x41 */
+bool cube_unlock(void);
+
+/*
+* The same with the first message at offset, bits 12 to 30, followed by length
+* bytes. Returns the key words the card answers the second message with, the
+* timing is that of the second message. Once unlocked, the card only starts
+* over for offsets 0x7FEC8000 to 0x7FECF000.
+*/
+bool cube_unlock_keys(uint32_t offset, uint32_t length, uint32_t key[CUBE_UNLOCK_KEY_WORDS], cube_timing_t *timing);
+
+bool cube_read(uint32_t addr, uint8_t *page, cube_timing_t *timing);
+bool cube_write(uint32_t addr, const uint8_t *data, cube_timing_t *timing);
+bool cube_erase_sector(uint32_t addr, cube_timing_t *timing);
+
+/* INT of writes and erases, wait_for_int waits for the card to pull it low */
+bool cube_int_enable(bool enable);
+bool cube_wait_for_int(uint32_t timeout_us);
+
+bool cube_status(uint8_t *status);
+bool cube_clear_status(void);
+
+/* the MMCE commands behind 0x8B, as a loader sends them */
+bool cube_mce_dev_id(uint8_t *caps, uint8_t *burst_max);
+bool cube_mce_set_access_mode(bool exclusive);
+
+/*
+* Moves count blocks from sector on, one block per transfer with burst_max 0,
+* else in bursts of burst_max blocks and the rest. Waits for the INT of every
+* transfer and fails if the card still has data on the bus after one.
+*/
+bool cube_mce_read(uint32_t sector, uint16_t count, uint32_t burst_max, uint8_t *data);
+bool cube_mce_write(uint32_t sector, uint16_t count, uint32_t burst_max, const uint8_t *data);
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pico/time.h"
+#include "sd.h"
+
+#include "sd_dir.h"
+
+#define NUM_FILES 16
+#define SECTOR_SIZE 512
+#define MAX_EXTENTS 32
+#define EXTENT_ALIGN (8u * 1024 * 1024 / SECTOR_SIZE)
+
+typedef struct {
+    bool open;
+    bool is_dir;
+    int fd;
+    DIR *dir;
+    char path[PATH_MAX];
+    char name[256];
+} sim_file_t;
+
+typedef struct {
+    char path[PATH_MAX];
+    uint32_t first;
+    uint32_t sectors;
+} extent_t;
+
+static char root[PATH_MAX] = ".";
+static sim_file_t files[NUM_FILES];
+static extent_t extents[MAX_EXTENTS];
+static int num_extents;
+static uint32_t next_extent = SIM_SD_EXTENT_BASE;
+static int raw_fd = -1;
+static uint32_t delay_call_us, delay_sector_us;
+static uint32_t sectors_read, sectors_written;
+static uint64_t busy_us;
+
+static void delay(size_t bytes) {
+    uint64_t us = delay_call_us + (uint64_t)delay_sector_us * ((bytes + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    if (us) {
+        sleep_us(us);
+        busy_us += us;
+    }
+}
+
+const char *sim_sd_host_path(const char *path) {
+    static __thread char full[2 * PATH_MAX];
+    while (*path == '/')
+        path++;
+    snprintf(full, sizeof(full), "%s/%s", root, path);
+    /* the card has no trailing slashes either */
+    size_t len = strlen(full);
+    while (len > 1 && full[len - 1] == '/')
+        full[--len] = 0;
+    return full;
+}
+
+void sim_sd_set_root(const char *dir) {
+    for (int fd = 0; fd < NUM_FILES; fd++)
+        sd_close(fd);
+    snprintf(root, sizeof(root), "%s", dir);
+    memset(extents, 0, sizeof(extents));
+    num_extents = 0;
+    next_extent = SIM_SD_EXTENT_BASE;
+    if (raw_fd >= 0)
+        close(raw_fd);
+    raw_fd = -1;
+    sectors_read = sectors_written = 0;
+    busy_us = 0;
+}
+
+void sim_sd_set_delay(uint32_t per_call_us, uint32_t per_sector_us) {
+    delay_call_us = per_call_us;
+    delay_sector_us = per_sector_us;
+}
+
+uint32_t sim_sd_sectors_read(void) {
+    return sectors_read;
+}
+
+uint32_t sim_sd_sectors_written(void) {
+    return sectors_written;
+}
+
+uint64_t sim_sd_busy_us(void) {
+    return busy_us;
+}
+
+void sd_init(bool reinit) {
+    (void)reinit;
+}
+
+void sd_unmount(void) {
+}
+
+static bool valid(int fd) {
+    return fd >= 0 && fd < NUM_FILES && files[fd].open;
+}
+
+static int open_into(int fd, const char *host, int oflag) {
+    struct stat st;
+    sim_file_t *f = &files[fd];
+
+    memset(f, 0, sizeof(*f));
+    if (stat(host, &st) == 0 && S_ISDIR(st.st_mode)) {
+        f->dir = opendir(host);
+        if (!f->dir)
+            return -1;
+        f->is_dir = true;
+        f->fd = -1;
+    } else {
+        f->fd = open(host, oflag, 0644);
+        if (f->fd < 0)
+            return -1;
+    }
+    f->open = true;
+    snprintf(f->path, sizeof(f->path), "%s", host);
+    const char *slash = strrchr(host, '/');
+    snprintf(f->name, sizeof(f->name), "%s", slash ? slash + 1 : host);
+    return fd;
+}
+
+int sd_open(const char *path, int oflag) {
+    const char *host = sim_sd_host_path(path);
+
+    if (!sd_exists(path) && (oflag & O_CREAT) == 0)
+        return -1;
+    for (int fd = 0; fd < NUM_FILES; fd++)
+        if (!files[fd].open)
+            return open_into(fd, host, oflag);
+    return -1;
+}
+
+int sd_close(int fd) {
+    if (!valid(fd))
+        return -1;
+    if (files[fd].dir)
+        closedir(files[fd].dir);
+    if (files[fd].fd >= 0)
+        close(files[fd].fd);
+    files[fd].open = false;
+    return 0;
+}
+
+void sd_flush(int fd) {
+    (void)fd;
+}
+
+int sd_read(int fd, void *buf, size_t count) {
+    if (!valid(fd) || files[fd].is_dir)
+        return -1;
+    delay(count);
+    ssize_t got = read(files[fd].fd, buf, count);
+    if (got > 0)
+        sectors_read += (uint32_t)(got + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    return (int)got;
+}
+
+int sd_write(int fd, void *buf, size_t count) {
+    if (!valid(fd) || files[fd].is_dir)
+        return -1;
+    delay(count);
+    ssize_t put = write(files[fd].fd, buf, count);
+    if (put > 0)
+        sectors_written += (uint32_t)(put + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    return (int)put;
+}
+
+int sd_seek(int fd, int32_t offset, int whence) {
+    if (!valid(fd) || files[fd].is_dir)
+        return -1;
+    return lseek(files[fd].fd, offset, whence) < 0;
+}
+
+uint32_t sd_tell(int fd) {
+    if (!valid(fd) || files[fd].is_dir)
+        return (uint32_t)-1;
+    return (uint32_t)lseek(files[fd].fd, 0, SEEK_CUR);
+}
+
+static extent_t *extent_of(const char *host) {
+    for (int i = 0; i < num_extents; i++)
+        if (strcmp(extents[i].path, host) == 0)
+            return &extents[i];
+    return NULL;
+}
+
+static extent_t *extent_assign(const char *host, uint32_t size) {
+    extent_t *e = extent_of(host);
+    uint32_t sectors = (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+    if (e && e->sectors >= sectors)
+        return e;
+    if (!e) {
+        if (num_extents == MAX_EXTENTS)
+            return NULL;
+        e = &extents[num_extents++];
+        snprintf(e->path, sizeof(e->path), "%s", host);
+    }
+    /* a grown file moves, like a fresh allocation would */
+    e->first = next_extent;
+    e->sectors = sectors;
+    next_extent += (sectors + EXTENT_ALIGN - 1) / EXTENT_ALIGN * EXTENT_ALIGN;
+    return e;
+}
+
+int sd_preallocate(int fd, uint32_t size) {
+    if (!valid(fd) || files[fd].is_dir)
+        return -1;
+    return extent_assign(files[fd].path, size) == NULL;
+}
+
+int sd_contiguous_range(int fd, uint32_t *first_sector, uint32_t *last_sector) {
+    if (!valid(fd) || files[fd].is_dir)
+        return -1;
+    int size = sd_filesize(fd);
+    if (size <= 0)
+        return 1;
+    extent_t *e = extent_assign(files[fd].path, (uint32_t)size);
+    if (!e)
+        return 1;
+    *first_sector = e->first;
+    *last_sector = e->first + e->sectors - 1;
+    return 0;
+}
+
+int sd_filesize(int fd) {
+    struct stat st;
+    if (!valid(fd) || files[fd].is_dir || fstat(files[fd].fd, &st))
+        return -1;
+    return (int)st.st_size;
+}
+
+int sd_mkdir(const char *path) {
+    if (sd_exists(path))
+        return 0;
+    return mkdir(sim_sd_host_path(path), 0755) != 0;
+}
+
+int sd_exists(const char *path) {
+    return access(sim_sd_host_path(path), F_OK) == 0;
+}
+
+int sd_rmdir(const char *path) {
+    return rmdir(sim_sd_host_path(path)) != 0;
+}
+
+int sd_remove(const char *path) {
+    return unlink(sim_sd_host_path(path)) != 0;
+}
+
+int sd_iterate_dir(int dir, int it) {
+    struct dirent *ent;
+
+    if (!valid(dir) || !files[dir].is_dir)
+        return -1;
+    if (it == -1) {
+        for (it = 0; it < NUM_FILES; ++it)
+            if (!files[it].open)
+                break;
+        if (it == NUM_FILES)
+            return -1;
+    } else {
+        sd_close(it);
+    }
+
+    while ((ent = readdir(files[dir].dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        char host[PATH_MAX];
+        snprintf(host, sizeof(host), "%s/%s", files[dir].path, ent->d_name);
+        if (open_into(it, host, O_RDONLY) >= 0)
+            return it;
+    }
+    return -1;
+}
+
+size_t sd_get_name(int fd, char *name, size_t size) {
+    if (!valid(fd))
+        return 0;
+    size_t len = strlen(files[fd].name);
+    if (len >= size)
+        return 0;
+    memcpy(name, files[fd].name, len + 1);
+    return len;
+}
+
+bool sd_is_dir(int fd) {
+    return valid(fd) && files[fd].is_dir;
+}
+
+int sd_fd_is_open(int fd) {
+    return valid(fd);
+}
+
+static int raw_file(void) {
+    if (raw_fd < 0) {
+        char tmpl[] = "/tmp/sim_sd_rawXXXXXX";
+        raw_fd = mkstemp(tmpl);
+        if (raw_fd >= 0)
+            unlink(tmpl);
+    }
+    return raw_fd;
+}
+
+/* host file and offset behind a sector */
+static int sector_file(uint32_t sector, off_t *offset) {
+    for (int i = 0; i < num_extents; i++) {
+        extent_t *e = &extents[i];
+        if (sector >= e->first && sector < e->first + e->sectors) {
+            for (int fd = 0; fd < NUM_FILES; fd++) {
+                if (files[fd].open && !files[fd].is_dir && strcmp(files[fd].path, e->path) == 0) {
+                    *offset = (off_t)(sector - e->first) * SECTOR_SIZE;
+                    return files[fd].fd;
+                }
+            }
+            return -1;
+        }
+    }
+    *offset = (off_t)sector * SECTOR_SIZE;
+    return raw_file();
+}
+
+static bool sectors_io(uint32_t sector, uint8_t *buf, size_t count, bool write) {
+    delay(count * SECTOR_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        off_t offset;
+        int fd = sector_file(sector + (uint32_t)i, &offset);
+        if (fd < 0)
+            return false;
+        if (write) {
+            if (pwrite(fd, buf + i * SECTOR_SIZE, SECTOR_SIZE, offset) != SECTOR_SIZE)
+                return false;
+            sectors_written++;
+        } else {
+            ssize_t got = pread(fd, buf + i * SECTOR_SIZE, SECTOR_SIZE, offset);
+            if (got < 0)
+                return false;
+            /* preallocated but never written reads as zeros */
+            memset(buf + i * SECTOR_SIZE + got, 0, SECTOR_SIZE - (size_t)got);
+            sectors_read++;
+        }
+    }
+    return true;
+}
+
+bool sd_read_sector(uint32_t sector, uint8_t *dst) {
+    return sectors_io(sector, dst, 1, false);
+}
+
+bool sd_write_sector(uint32_t sector, const uint8_t *src) {
+    return sectors_io(sector, (uint8_t *)src, 1, true);
+}
+
+bool sd_read_sectors(uint32_t sector, uint8_t *dst, size_t count) {
+    return sectors_io(sector, dst, count, false);
+}
+
+bool sd_write_sectors(uint32_t sector, const uint8_t *src, size_t count) {
+    return sectors_io(sector, (uint8_t *)src, count, true);
+}
+
+bool sd_sync_cache(void) {
+    return get_core_num() == 0;
+}
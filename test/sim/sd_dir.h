@@ -0,0 +1,27 @@
+/*
+* Directory backed stand-in for the SdFat wrapper (sd.h). Paths resolve below
+* a host directory. Files that get preallocated or asked for their sector range
+* are given a contiguous extent on a fake LBA space, sector access there goes
+* to the host file; sectors below the extents are a scratch block device.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#define SIM_SD_EXTENT_BASE 0x400000u
+
+/* points the card at a host directory, closes everything that was open */
+void sim_sd_set_root(const char *dir);
+
+/* makes every call cost per_call_us plus per_sector_us for each 512 bytes moved */
+void sim_sd_set_delay(uint32_t per_call_us, uint32_t per_sector_us);
+
+/* sectors moved since the root was set */
+uint32_t sim_sd_sectors_read(void);
+uint32_t sim_sd_sectors_written(void);
+
+/* time the delays of sim_sd_set_delay have cost so far */
+uint64_t sim_sd_busy_us(void);
+
+/* host path of a card path, for the tests to look at the result */
+const char *sim_sd_host_path(const char *path);
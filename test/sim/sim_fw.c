@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "card_config.h"
+#include "card_emu/gc_memory_card.h"
+#include "gc_mc_spi.pio.h"
+#include "debug.h"
+#include "game_db/game_db.h"
+#include "gc.h"
+#include "gui.h"
+#include "input.h"
+#include "oled.h"
+#include "psram/psram.h"
+#include "settings.h"
+
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+sim_settings_t sim_settings = {
+    .cardsize = 4,
+    .encoding = true,
+};
+
+/* ---- settings ---- */
+
+static struct {
+    uint8_t state;
+    int card;
+    int chan;
+    char folder[MAX_FOLDER_NAME_LENGTH + 1];
+} last_card;
+
+bool settings_get_gc_card_restore(void) { return sim_settings.card_restore; }
+uint8_t settings_get_gc_cardsize(void) { return sim_settings.cardsize; }
+bool settings_get_gc_encoding(void) { return sim_settings.encoding; }
+bool settings_get_gc_game_id(void) { return sim_settings.game_id; }
+bool settings_get_gc_journal(void) { return sim_settings.journal; }
+bool settings_get_gc_write_behind(void) { return sim_settings.write_behind; }
+uint16_t settings_get_gc_latency(void) { return sim_settings.latency; }
+
+void settings_get_gc_last_card(uint8_t *state, int *card, int *chan, char *folder_name) {
+    *state = last_card.state;
+    *card = last_card.card;
+    *chan = last_card.chan;
+    strcpy(folder_name, last_card.folder);
+}
+
+void settings_set_gc_last_card(uint8_t state, int card, int chan, char *folder_name) {
+    last_card.state = state;
+    last_card.card = card;
+    last_card.chan = chan;
+    snprintf(last_card.folder, sizeof(last_card.folder), "%s", folder_name);
+}
+
+/* ---- card config, no ini files: everything falls back to the settings ---- */
+
+uint8_t card_config_get_max_channels(const char *card_folder, const char *card_base) {
+    (void)card_folder, (void)card_base;
+    return 8;
+}
+
+uint8_t card_config_get_gc_cardsize(const char *card_folder, const char *card_base) {
+    (void)card_folder, (void)card_base;
+    return 0;
+}
+
+void card_config_get_flush_policy(const char *card_folder, const char *card_base, uint16_t *lockout_ms,
+                                  uint16_t *time_slice_ms) {
+    (void)card_folder, (void)card_base;
+    *lockout_ms = 0;
+    *time_slice_ms = 0;
+}
+
+uint16_t card_config_get_gc_latency(const char *card_folder, const char *card_base) {
+    (void)card_folder, (void)card_base;
+    return 0;
+}
+
+void card_config_get_card_folder(const char *game_id, char *card_folder, size_t card_folder_max_len) {
+    (void)game_id;
+    if (card_folder_max_len)
+        card_folder[0] = 0;
+}
+
+/* ---- game db ---- */
+
+void game_db_extract_game_id(const char *const game_id, char *const game_id_out) {
+    strcpy(game_id_out, game_id);
+}
+
+void game_db_get_current_id(const char **const id, const char **region) {
+    *id = "";
+    *region = "";
+}
+
+void game_db_get_current_region(const char **region) {
+    *region = "";
+}
+
+void game_db_update_game(const char *const game_id) {
+    (void)game_id;
+}
+
+/* ---- GUI and input ---- */
+
+void gui_init(void) {}
+void gui_task(void) {}
+void gui_request_refresh(void) {}
+void gui_do_gc_card_switch(void) {}
+void gui_activate_sd_mode(void) {}
+void input_task(void) {}
+int input_is_any_down(void) { return 0; }
+void oled_task(void) {}
+
+/* ---- debug ---- */
+
+const char *log_level_str[] = { " ", "[ERROR]", "[WARN] ", "[INFO] ", "[TRACE]" };
+
+void buffered_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+void fatal(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "fatal: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    abort();
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = 0;
+    }
+    return len;
+}
+
+/* ---- boot ---- */
+
+static void core0_main(void) {
+    psram_init();
+    gc_init();
+    /* main() polls more than this, one pass per turn keeps the other threads going on a single CPU */
+    while (1) {
+        gc_task();
+        sim_yield();
+    }
+}
+
+void sim_fw_boot(const char *sd_root) {
+    sim_init();
+    sim_sd_set_root(sd_root);
+    memset(&last_card, 0, sizeof(last_card));
+    sim_start_core0(core0_main);
+}
+
+const char *sim_fw_card_image(const char *sd_root) {
+    static char path[256];
+    static const char *const dirs[] = { "MemoryCards", "MemoryCards/GC", "MemoryCards/GC/Card1" };
+
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", sd_root, dirs[i]);
+        mkdir(path, 0755);
+    }
+    snprintf(path, sizeof(path), "%s/MemoryCards/GC/Card1/Card1-1.raw", sd_root);
+    return path;
+}
+
+/* INT goes low for the first time when the main loop starts, CONNECTED is high from then on */
+bool sim_fw_wait_ready(uint32_t timeout_us) {
+    uint64_t deadline = sim_now_us() + timeout_us;
+    while (!(sim_gpio_level(PIN_MC_CONNECTED) && sim_gpio_falls(PIN_GC_INT) > 0)) {
+        if (sim_now_us() > deadline)
+            return false;
+        sim_yield();
+    }
+    return true;
+}
+
+static char tmpdir[64];
+
+const char *sim_fw_tmpdir(void) {
+    snprintf(tmpdir, sizeof(tmpdir), "/tmp/gc_simXXXXXX");
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        abort();
+    }
+    return tmpdir;
+}
+
+void sim_fw_cleanup(void) {
+    char cmd[96];
+    if (!tmpdir[0])
+        return;
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", tmpdir);
+    if (system(cmd) != 0)
+        fprintf(stderr, "cannot remove %s\n", tmpdir);
+    tmpdir[0] = 0;
+}
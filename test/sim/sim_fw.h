@@ -0,0 +1,37 @@
+/*
+* Boots the firmware in the host model the way main() does in GC mode and
+* stands in for the modules the card emulation only calls into (settings,
+* card config, game db, GUI, input).
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint8_t cardsize;       /* MBit, like the settings store it */
+    uint16_t latency;       /* 0 for the default */
+    bool encoding;
+    bool journal;
+    bool write_behind;
+    bool card_restore;
+    bool game_id;
+} sim_settings_t;
+
+extern sim_settings_t sim_settings;
+
+/* resets the model, points the SD card at sd_root and starts core 0 */
+void sim_fw_boot(const char *sd_root);
+
+/*
+* Host path of the image the firmware opens first (Card1, channel 1), with
+* its directories created so a test can put an image there before booting.
+*/
+const char *sim_fw_card_image(const char *sd_root);
+
+/* waits until the card left its boot handshake and answers the cube */
+bool sim_fw_wait_ready(uint32_t timeout_us);
+
+/* a fresh directory under /tmp for the SD card, removed again by sim_fw_cleanup */
+const char *sim_fw_tmpdir(void);
+void sim_fw_cleanup(void);
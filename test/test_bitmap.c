@@ -0,0 +1,222 @@
+/*
+* The sector bitmap the dirty map and the load run on. Random ranges are set
+* and cleared against a plain array of bools, then count, test and
+* find_next have to agree with it.
+*
+* Then marks and pops 1, 100 and 16384 scattered sectors in the bitmap and
+* in the min-heap the dirty map used before, both have to hand out every
+* sector in ascending order, and prints the time of each. Host time, good
+* for comparing the two, not for what the RP2040 does.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gc_bitmap.h"
+
+#define OPS             20000
+#define FINDS           64
+#define BENCH_NS        20000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); exit(1); } } while (0)
+
+static gc_bitmap_t map;
+static bool ref[GC_BITMAP_BITS];
+static uint32_t ref_count;
+static uint32_t rng = 0x9E3779B9;
+
+/* xorshift32 */
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void ref_range(uint32_t first, uint32_t count, bool value) {
+    for (uint32_t i = first; (i < first + count) && (i < GC_BITMAP_BITS); i++) {
+        ref_count += value && !ref[i];
+        ref_count -= !value && ref[i];
+        ref[i] = value;
+    }
+}
+
+static int32_t ref_find_next(uint32_t from) {
+    for (uint32_t i = from; i < GC_BITMAP_BITS; i++)
+        if (ref[i])
+            return (int32_t)i;
+    return -1;
+}
+
+static void check_against_ref(void) {
+    CHECK(gc_bitmap_count(&map) == ref_count);
+    for (uint32_t i = 0; i < FINDS; i++) {
+        uint32_t from = next_random() % (GC_BITMAP_BITS + 8);
+        int32_t bit = gc_bitmap_find_next(&map, from);
+        if (bit != ref_find_next(from)) {
+            fprintf(stderr, "find_next(%u) is %d, expected %d\n", from, bit, ref_find_next(from));
+            exit(1);
+        }
+        if (bit >= 0)
+            CHECK(gc_bitmap_test(&map, (uint32_t)bit));
+    }
+}
+
+static void test_ranges(void) {
+    gc_bitmap_clear_all(&map);
+    CHECK(gc_bitmap_find_next(&map, 0) == -1);
+
+    /* the whole map and its ends */
+    gc_bitmap_set_range(&map, 0, GC_BITMAP_BITS);
+    ref_range(0, GC_BITMAP_BITS, true);
+    check_against_ref();
+    gc_bitmap_clear_range(&map, 1, GC_BITMAP_BITS);
+    ref_range(1, GC_BITMAP_BITS, false);
+    check_against_ref();
+    gc_bitmap_clear(&map, 0);
+    gc_bitmap_set(&map, GC_BITMAP_BITS - 1);
+    gc_bitmap_set(&map, GC_BITMAP_BITS);
+    ref_range(0, 1, false);
+    ref_range(GC_BITMAP_BITS - 1, 1, true);
+    check_against_ref();
+
+    /* short and long runs across leaf and summary words, mostly sparse */
+    for (uint32_t op = 0; op < OPS; op++) {
+        uint32_t r = next_random();
+        uint32_t first = next_random() % GC_BITMAP_BITS;
+        uint32_t count = (r & 1) ? 1 + (r >> 8) % 40 : (r >> 8) % 2100;
+        if ((r >> 4) % 3 == 0) {
+            gc_bitmap_set_range(&map, first, count);
+            ref_range(first, count, true);
+        } else {
+            gc_bitmap_clear_range(&map, first, count);
+            ref_range(first, count, false);
+        }
+        if (op % 64 == 0)
+            check_against_ref();
+    }
+    check_against_ref();
+
+    /* popping everything in order, the way the flush walks it */
+    uint32_t cursor = 0, popped = 0;
+    int32_t bit;
+    while ((bit = gc_bitmap_find_next(&map, cursor)) >= 0) {
+        CHECK(ref[bit]);
+        ref[bit] = false;
+        gc_bitmap_clear(&map, (uint32_t)bit);
+        cursor = (uint32_t)bit + 1;
+        popped++;
+    }
+    CHECK(popped == ref_count);
+    CHECK(gc_bitmap_count(&map) == 0);
+    ref_count = 0;
+}
+
+/* the dirty map before the bitmap */
+static uint16_t heap[GC_BITMAP_BITS];
+static uint32_t heap_size;
+
+static void heap_push(uint16_t sector) {
+    uint32_t cur = heap_size++;
+    heap[cur] = sector;
+    while (cur && (heap[cur] < heap[(cur - 1) / 2])) {
+        uint16_t tmp = heap[cur];
+        heap[cur] = heap[(cur - 1) / 2];
+        heap[(cur - 1) / 2] = tmp;
+        cur = (cur - 1) / 2;
+    }
+}
+
+static uint16_t heap_pop(void) {
+    uint16_t ret = heap[0];
+    uint32_t i = 0;
+
+    heap[0] = heap[--heap_size];
+    while (1) {
+        uint32_t best = i, l = 2 * i + 1, r = 2 * i + 2;
+        if ((l < heap_size) && (heap[l] < heap[best]))
+            best = l;
+        if ((r < heap_size) && (heap[r] < heap[best]))
+            best = r;
+        if (best == i)
+            break;
+        uint16_t tmp = heap[i];
+        heap[i] = heap[best];
+        heap[best] = tmp;
+        i = best;
+    }
+    return ret;
+}
+
+/* 7919 is odd, so this visits n distinct sectors in scattered order */
+static uint32_t scattered(uint32_t i) {
+    return (i * 7919U + 13U) % GC_BITMAP_BITS;
+}
+
+static uint32_t mark_pop_bitmap(uint32_t n) {
+    uint32_t cursor = 0, sum = 0;
+
+    for (uint32_t i = 0; i < n; i++)
+        gc_bitmap_set(&map, scattered(i));
+    CHECK(gc_bitmap_count(&map) == n);
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t bit = gc_bitmap_find_next(&map, cursor);
+        CHECK(bit >= (int32_t)cursor);
+        gc_bitmap_clear(&map, (uint32_t)bit);
+        sum += (uint32_t)bit;
+        cursor = (uint32_t)bit + 1;
+    }
+    CHECK(gc_bitmap_find_next(&map, 0) == -1);
+    return sum;
+}
+
+static uint32_t mark_pop_heap(uint32_t n) {
+    uint32_t sum = 0;
+    int32_t prev = -1;
+
+    for (uint32_t i = 0; i < n; i++)
+        heap_push((uint16_t)scattered(i));
+    for (uint32_t i = 0; i < n; i++) {
+        uint16_t sector = heap_pop();
+        CHECK((int32_t)sector > prev);
+        sum += sector;
+        prev = sector;
+    }
+    return sum;
+}
+
+/* ns per mark and pop of n sectors, repeated until the time is well above the clock */
+static uint32_t bench(uint32_t (*mark_pop)(uint32_t), uint32_t n, uint32_t *sum) {
+    uint32_t rounds = 0;
+    uint64_t start = now_ns(), elapsed;
+
+    do {
+        *sum = mark_pop(n);
+        rounds++;
+    } while ((elapsed = now_ns() - start) < BENCH_NS);
+    return (uint32_t)(elapsed / rounds);
+}
+
+int main(void) {
+    static const uint32_t sizes[] = { 1, 100, GC_BITMAP_BITS };
+
+    test_ranges();
+    printf("bitmap: %u random range ops match the reference\n", OPS);
+
+    gc_bitmap_clear_all(&map);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t n = sizes[s], map_sum, heap_sum;
+        uint32_t map_ns = bench(mark_pop_bitmap, n, &map_sum);
+        uint32_t heap_ns = bench(mark_pop_heap, n, &heap_sum);
+        CHECK(map_sum == heap_sum);
+        printf("mark/pop %5u sectors: bitmap %9u ns, heap %9u ns\n", n, map_ns, heap_ns);
+    }
+    return 0;
+}
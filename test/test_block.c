@@ -0,0 +1,217 @@
+/*
+* The MMCE block command rings against the host SD card. Core 0 runs
+* gc_mmceman_block_task on its own thread with a slow SD card behind it, the
+* test is core 1 and moves the blocks the way the command handlers do: one at
+* a time and in bursts, over requests several times the ring. Every block has
+* to carry its sector, a burst core 1 still holds must not be refilled while
+* it is on the wire, and core 1 must not receive into a slot before core 0
+* has written it to the card.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmceman/gc_mmceman_block_commands.h"
+#include "sd.h"
+
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define BLOCK_SIZE      512
+#define RING_DEPTH      16      /* SD_READ_RING_DEPTH and SD_WRITE_RING_DEPTH of the block commands */
+#define SD_CALL_US      40
+#define SD_SECTOR_US    10
+#define HOLD_US         2000
+#define WAIT_US         2000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+/* every sector starts with its number and how often it was written, the rest depends on both */
+static void fill_sector(uint8_t *buf, uint32_t sector, uint32_t version) {
+    memcpy(buf, &sector, sizeof(sector));
+    memcpy(buf + sizeof(sector), &version, sizeof(version));
+    for (uint32_t i = sizeof(sector) + sizeof(version); i < BLOCK_SIZE; i++)
+        buf[i] = (uint8_t)(sector * 13 + version * 101 + i * 7 + (i >> 8));
+}
+
+static void check_sector(const uint8_t *buf, uint32_t sector, uint32_t version) {
+    uint8_t want[BLOCK_SIZE];
+
+    fill_sector(want, sector, version);
+    if (memcmp(buf, want, BLOCK_SIZE) != 0) {
+        uint32_t got[2];
+        memcpy(got, buf, sizeof(got));
+        fprintf(stderr, "block of sector %u version %u holds sector %u version %u\n", sector, version, got[0], got[1]);
+        fail();
+    }
+}
+
+static void core0_main(void) {
+    for (;;) {
+        gc_mmceman_block_task();
+        sim_yield();
+    }
+}
+
+static void sleep_us(uint32_t us) {
+    uint64_t until = sim_now_us() + us;
+    while (sim_now_us() < until)
+        sim_yield();
+}
+
+/* the next n blocks of the request, one by one or as one burst */
+static uint32_t take_blocks(uint8_t **buffers, uint32_t n) {
+    uint64_t deadline = sim_now_us() + WAIT_US;
+
+    for (;;) {
+        uint32_t got = 0;
+        if (n == 1) {
+            gc_mmceman_block_read_data(&buffers[0]);
+            got = buffers[0] ? 1 : 0;
+        } else {
+            got = gc_mmceman_block_read_burst(buffers, n);
+        }
+        if (got)
+            return got;
+        CHECK(sim_now_us() < deadline);
+        sim_yield();
+    }
+}
+
+/*
+* Takes count blocks from sector on, alternating single blocks and bursts.
+* Every few bursts core 1 keeps them for a while, core 0 fills the rest of
+* the ring meanwhile and has to leave them alone.
+*/
+static void read_blocks(uint32_t sector, uint32_t count, uint32_t version) {
+    uint8_t *buffers[MMCEMAN_BLOCK_BURST_MAX];
+    uint32_t taken = 0;
+
+    for (uint32_t round = 0; taken < count; round++) {
+        uint32_t n = (round % 3) ? MMCEMAN_BLOCK_BURST_MAX : 1;
+        if (n > count - taken)
+            n = count - taken;
+        uint32_t got = take_blocks(buffers, n);
+        CHECK(got <= n && taken + got <= count);
+        for (uint32_t i = 0; i < got; i++)
+            check_sector(buffers[i], sector + taken + i, version);
+
+        if (round % 4 == 2) {
+            sleep_us(HOLD_US);
+            for (uint32_t i = 0; i < got; i++)
+                check_sector(buffers[i], sector + taken + i, version);
+        }
+        taken += got;
+    }
+}
+
+static void test_read_ring(void) {
+    uint8_t *buffer;
+
+    /* far more than the ring, it wraps several times */
+    gc_mmceman_block_request_read_sector(1000, 5 * RING_DEPTH + 3);
+    read_blocks(1000, 5 * RING_DEPTH + 3, 0);
+    CHECK(gc_mmceman_block_read_idle());
+    gc_mmceman_block_read_data(&buffer);
+    CHECK(buffer == NULL);
+
+    /* a request that goes on where the last one stopped keeps the ring */
+    gc_mmceman_block_request_read_sector(2000, 20);
+    read_blocks(2000, 7, 0);
+    gc_mmceman_block_request_read_sector(2007, 30);
+    read_blocks(2007, 30, 0);
+    CHECK(gc_mmceman_block_read_idle());
+
+    /* one that jumps elsewhere throws away what was read ahead for the old one */
+    gc_mmceman_block_request_read_sector(3000, 40);
+    read_blocks(3000, 3, 0);
+    sleep_us(HOLD_US);
+    gc_mmceman_block_request_read_sector(500, 2 * RING_DEPTH);
+    read_blocks(500, 2 * RING_DEPTH, 0);
+    CHECK(gc_mmceman_block_read_idle());
+}
+
+/*
+* Receives count blocks for sector on, alternating single blocks and bursts.
+* Each round fills the slots it was handed, then waits in write_blocks until
+* there is room for the next round, the way the command handler does it.
+*/
+static void write_blocks(uint32_t sector, uint32_t count, uint32_t version) {
+    uint8_t *buffers[MMCEMAN_BLOCK_BURST_MAX];
+    uint32_t received = 0;
+
+    gc_mmceman_block_request_write_sector(sector, (uint16_t)count);
+    for (uint32_t round = 0; received < count; round++) {
+        uint32_t n = gc_mmceman_get_write_blocks(buffers, (round % 2) ? MMCEMAN_BLOCK_BURST_MAX : 1);
+        CHECK(n > 0);
+        for (uint32_t i = 0; i < n; i++)
+            fill_sector(buffers[i], sector + received + i, version);
+        received += n;
+        gc_mmceman_block_write_blocks(n, (round % 2) ? 1 : MMCEMAN_BLOCK_BURST_MAX);
+    }
+}
+
+static void check_card(uint32_t sector, uint32_t count, uint32_t version) {
+    uint8_t buf[BLOCK_SIZE];
+
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(sd_read_sector(sector + i, buf));
+        check_sector(buf, sector + i, version);
+    }
+}
+
+static void test_write_ring(void) {
+    uint32_t written = sim_sd_sectors_written();
+
+    /* the last blocks only come back once all of the request is on the card */
+    write_blocks(5000, 5 * RING_DEPTH + 5, 1);
+    CHECK(gc_mmceman_block_write_idle());
+    CHECK(gc_mmceman_block_get_write_errors() == 0);
+    CHECK(sim_sd_sectors_written() - written == 5 * RING_DEPTH + 5);
+    check_card(5000, 5 * RING_DEPTH + 5, 1);
+
+    /* shorter than the ring, and over part of the last one */
+    write_blocks(5040, 9, 2);
+    check_card(5040, 9, 2);
+
+    /* what the reads buffered before is gone, they get what was written */
+    gc_mmceman_block_request_read_sector(5030, 30);
+    read_blocks(5030, 10, 1);
+    read_blocks(5040, 9, 2);
+    write_blocks(5049, 3, 3);
+    gc_mmceman_block_request_read_sector(5049, 6);
+    read_blocks(5049, 3, 3);
+    read_blocks(5052, 3, 1);
+    CHECK(gc_mmceman_block_read_idle());
+}
+
+int main(void) {
+    static uint8_t buf[BLOCK_SIZE];
+    const char *root = sim_fw_tmpdir();
+
+    sim_init();
+    sim_sd_set_root(root);
+    for (uint32_t sector = 0; sector < 4096; sector++) {
+        fill_sector(buf, sector, 0);
+        CHECK(sd_write_sector(sector, buf));
+    }
+    uint32_t written = sim_sd_sectors_written();
+    sim_sd_set_delay(SD_CALL_US, SD_SECTOR_US);
+
+    gc_mmceman_block_init();
+    sim_start_core0(core0_main);
+
+    test_read_ring();
+    printf("block read ring ok, %u sectors read from SD\n", sim_sd_sectors_read());
+    test_write_ring();
+    printf("block write ring ok, %u sectors written to SD\n", sim_sd_sectors_written() - written);
+
+    sim_fw_cleanup();
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+* The MMCE block commands over EXI, one block per transfer and in bursts. The
+* card is switched to exclusive mode, the cube writes blocks with one protocol
+* and reads them back with both, for counts below, on and past a burst and
+* longer than the buffer rings. Every block has to come back with its sector
+* and version, and a burst must end where the cube expects it to.
+*
+* Then prints the throughput of both protocols with the SD card at host speed,
+* what is left is the cost of the transfers and their handshakes. Host time of
+* a model, only good for comparing the two.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc_cardman.h"
+#include "mmceman/gc_mmceman_block_commands.h"
+
+#include "cube.h"
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define EXI_BYTE_NS     300     /* about 27 MHz */
+#define SD_CALL_US      40
+#define SD_SECTOR_US    10
+#define RING_DEPTH      16      /* SD_READ_RING_DEPTH and SD_WRITE_RING_DEPTH of the block commands */
+#define MAX_BLOCKS      (5 * RING_DEPTH + 3)
+#define BENCH_BLOCKS    256
+#define WAIT_US         20000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+static uint8_t data[BENCH_BLOCKS * CUBE_BLOCK_SIZE];
+static uint8_t burst_max;
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+/* every block starts with its sector and how often it was written, the rest depends on both */
+static void fill_blocks(uint8_t *buf, uint32_t sector, uint32_t count, uint32_t version) {
+    for (uint32_t b = 0; b < count; b++, buf += CUBE_BLOCK_SIZE) {
+        uint32_t s = sector + b;
+        memcpy(buf, &s, sizeof(s));
+        memcpy(buf + sizeof(s), &version, sizeof(version));
+        for (uint32_t i = sizeof(s) + sizeof(version); i < CUBE_BLOCK_SIZE; i++)
+            buf[i] = (uint8_t)(s * 13 + version * 101 + i * 7 + (i >> 8));
+    }
+}
+
+static void check_blocks(const uint8_t *buf, uint32_t sector, uint32_t count, uint32_t version) {
+    static uint8_t want[BENCH_BLOCKS * CUBE_BLOCK_SIZE];
+
+    fill_blocks(want, sector, count, version);
+    for (uint32_t b = 0; b < count; b++) {
+        if (memcmp(buf + b * CUBE_BLOCK_SIZE, want + b * CUBE_BLOCK_SIZE, CUBE_BLOCK_SIZE) != 0) {
+            uint32_t got[2];
+            memcpy(got, buf + b * CUBE_BLOCK_SIZE, sizeof(got));
+            fprintf(stderr, "block of sector %u version %u holds sector %u version %u\n", sector + b, version, got[0],
+                    got[1]);
+            fail();
+        }
+    }
+}
+
+/* written one way, read back both ways */
+static void test_blocks(uint32_t sector, uint16_t count, uint32_t version, bool burst_write) {
+    fill_blocks(data, sector, count, version);
+    CHECK(cube_mce_write(sector, count, burst_write ? burst_max : 0, data));
+
+    memset(data, 0, count * CUBE_BLOCK_SIZE);
+    CHECK(cube_mce_read(sector, count, 0, data));
+    check_blocks(data, sector, count, version);
+    memset(data, 0, count * CUBE_BLOCK_SIZE);
+    CHECK(cube_mce_read(sector, count, burst_max, data));
+    check_blocks(data, sector, count, version);
+}
+
+static uint32_t kb_per_s(uint64_t start_us) {
+    uint64_t us = sim_now_us() - start_us;
+    return (uint32_t)((uint64_t)BENCH_BLOCKS * CUBE_BLOCK_SIZE * 1000000 / 1024 / (us ? us : 1));
+}
+
+static void bench(const char *name, uint32_t max) {
+    uint64_t start = sim_now_us();
+    fill_blocks(data, 8000, BENCH_BLOCKS, 1);
+    CHECK(cube_mce_write(8000, BENCH_BLOCKS, max, data));
+    uint32_t write_kbs = kb_per_s(start);
+
+    start = sim_now_us();
+    CHECK(cube_mce_read(8000, BENCH_BLOCKS, max, data));
+    uint32_t read_kbs = kb_per_s(start);
+    check_blocks(data, 8000, BENCH_BLOCKS, 1);
+
+    printf("%-14s read %5u kB/s, write %5u kB/s\n", name, read_kbs, write_kbs);
+}
+
+int main(void) {
+    static const uint16_t counts[] = { 1, 5, MMCEMAN_BLOCK_BURST_MAX, 4 * MMCEMAN_BLOCK_BURST_MAX + 3, MAX_BLOCKS };
+    uint8_t caps;
+
+    const char *root = sim_fw_tmpdir();
+    sim_fw_boot(root);
+    sim_exi_set_byte_ns(EXI_BYTE_NS);
+    CHECK(sim_fw_wait_ready(WAIT_US));
+
+    /* loaders only use the bursts when the card announces them */
+    CHECK(cube_mce_dev_id(&caps, &burst_max));
+    CHECK((caps & 0xF0) == 0xB0 && (caps & 0x01));
+    CHECK(burst_max == MMCEMAN_BLOCK_BURST_MAX);
+
+    uint64_t deadline = sim_now_us() + WAIT_US;
+    while (!gc_cardman_is_idle()) {
+        CHECK(sim_now_us() < deadline);
+        sim_yield();
+    }
+    CHECK(cube_mce_set_access_mode(true));
+
+    sim_sd_set_delay(SD_CALL_US, SD_SECTOR_US);
+    for (uint32_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        test_blocks(1000 + i * 200, counts[i], 1, i % 2);
+        /* and over it again the other way */
+        test_blocks(1000 + i * 200, counts[i], 2, !(i % 2));
+    }
+    CHECK(gc_mmceman_block_get_write_errors() == 0);
+    printf("MMCE blocks: %u requests match, per block and in bursts of %u\n",
+           (uint32_t)(2 * sizeof(counts) / sizeof(counts[0])), burst_max);
+
+    sim_sd_set_delay(0, 0);
+    bench("per block", 0);
+    bench("bursts", burst_max);
+
+    sim_fw_cleanup();
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+* Boots the card in the host model on an image in a host directory and plays
+* the cube against it: probe, unlock, then reads, writes and erases that are
+* checked against the image. Prints how long each command took next to the
+* budget the latency gives a read, GC_MC_LATENCY_CYCLES byte times of the bus.
+*
+* The numbers are host time of a model, good for comparing two builds on the
+* same machine, not for what the RP2040 does.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "card_emu/gc_mc_internal.h"
+
+#include "cube.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define CARD_SIZE       0x80000
+#define EXI_BYTE_NS     500
+#define READS           64
+#define WARMUP_READS    16
+#define WRITES          32
+#define ERASES          4
+#define BOOT_WAIT_US    20000000
+#define FLUSH_WAIT_US   20000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+static uint8_t image[CARD_SIZE];
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+static uint8_t pattern(uint32_t pos) {
+    return (uint8_t)((pos * 7) ^ (pos >> 9));
+}
+
+static void make_image(const char *root) {
+    for (uint32_t i = 0; i < CARD_SIZE; i++)
+        image[i] = pattern(i);
+    image[37] = 1; /* encoded card, the INT of a write comes from the alarm */
+
+    FILE *f = fopen(sim_fw_card_image(root), "wb");
+    CHECK(f != NULL);
+    CHECK(fwrite(image, 1, CARD_SIZE, f) == CARD_SIZE);
+    fclose(f);
+}
+
+static bool image_on_sd_matches(const char *path) {
+    static uint8_t sd[CARD_SIZE];
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    size_t n = fread(sd, 1, CARD_SIZE, f);
+    fclose(f);
+    return n == CARD_SIZE && memcmp(sd, image, CARD_SIZE) == 0;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const char *what, uint32_t *us, uint32_t n, uint32_t budget_us) {
+    uint32_t over = 0;
+
+    qsort(us, n, sizeof(*us), cmp_u32);
+    for (uint32_t i = 0; i < n; i++)
+        over += us[i] > budget_us;
+    printf("%-18s %3u x  median %6u  p90 %6u  max %6u us", what, n, us[n / 2], us[(n * 9) / 10], us[n - 1]);
+    if (budget_us)
+        printf("  budget %u us (%u bytes), %u over, median %u bytes",
+               budget_us, GC_MC_LATENCY_CYCLES, over, us[n / 2] * 1000 / EXI_BYTE_NS);
+    printf("\n");
+}
+
+/* a page that is spread over the card and crosses sector boundaries now and then */
+static uint32_t page_addr(uint32_t i) {
+    return ((i * 0x2A00u) % CARD_SIZE) & ~(uint32_t)(CUBE_PAGE_SIZE - 1);
+}
+
+int main(void) {
+    uint32_t read_wall[READS], read_first[READS], read_cpu[READS];
+    uint32_t write_wall[WRITES], erase_wall[ERASES];
+    uint8_t page[CUBE_PAGE_SIZE];
+    uint8_t data[CUBE_WRITE_SIZE];
+    cube_timing_t t;
+    uint32_t id;
+
+    const char *root = sim_fw_tmpdir();
+    make_image(root);
+    sim_fw_boot(root);
+    sim_exi_set_byte_ns(EXI_BYTE_NS);
+    CHECK(sim_fw_wait_ready(BOOT_WAIT_US));
+
+    CHECK(cube_probe(&id));
+    printf("card id %08x, %u latency bytes\n", id, cube_id_latency(id));
+    CHECK(cube_id_latency(id) == GC_MC_LATENCY_CYCLES);
+    CHECK(cube_unlock());
+    CHECK(cube_int_enable(true));
+
+    /* the first reads can still race the load of the image, they are checked but not timed */
+    for (uint32_t i = 0; i < WARMUP_READS; i++) {
+        uint32_t addr = page_addr(READS + i);
+        CHECK(cube_read(addr, page, NULL));
+        CHECK(memcmp(page, &image[addr], CUBE_PAGE_SIZE) == 0);
+    }
+
+    for (uint32_t i = 0; i < READS; i++) {
+        uint32_t addr = page_addr(i);
+        CHECK(cube_read(addr, page, &t));
+        CHECK(memcmp(page, &image[addr], CUBE_PAGE_SIZE) == 0);
+        read_wall[i] = t.wall_us;
+        read_first[i] = t.first_data_us;
+        read_cpu[i] = t.core1_cpu_us;
+    }
+
+    for (uint32_t i = 0; i < WRITES; i++) {
+        uint32_t addr = page_addr(i * 3 + 1) + (i % 4) * CUBE_WRITE_SIZE;
+        for (uint32_t j = 0; j < CUBE_WRITE_SIZE; j++)
+            data[j] = (uint8_t)(i + j * 13);
+        CHECK(cube_write(addr, data, &t));
+        memcpy(&image[addr], data, CUBE_WRITE_SIZE);
+        write_wall[i] = t.wall_us;
+
+        uint32_t base = addr & ~(uint32_t)(CUBE_PAGE_SIZE - 1);
+        CHECK(cube_read(base, page, NULL));
+        CHECK(memcmp(page, &image[base], CUBE_PAGE_SIZE) == 0);
+    }
+
+    for (uint32_t i = 0; i < ERASES; i++) {
+        uint32_t addr = CARD_SIZE - (i + 1) * 3 * CUBE_SECTOR_SIZE;
+        CHECK(cube_erase_sector(addr, &t));
+        memset(&image[addr], 0xFF, CUBE_SECTOR_SIZE);
+        erase_wall[i] = t.wall_us;
+
+        CHECK(cube_read(addr + CUBE_SECTOR_SIZE - CUBE_PAGE_SIZE, page, NULL));
+        CHECK(memcmp(page, &image[addr + CUBE_SECTOR_SIZE - CUBE_PAGE_SIZE], CUBE_PAGE_SIZE) == 0);
+    }
+
+    uint8_t status;
+    CHECK(cube_status(&status));
+    CHECK(status & 0x40);
+
+    /* everything the cube changed ends up in the image on the SD card */
+    uint64_t deadline = sim_now_us() + FLUSH_WAIT_US;
+    while (!image_on_sd_matches(sim_fw_card_image(root)))
+        CHECK(sim_now_us() < deadline);
+
+    sim_exi_stats_t stats;
+    sim_exi_get_stats(&stats);
+
+    uint32_t budget_us = GC_MC_LATENCY_CYCLES * EXI_BYTE_NS / 1000;
+    printf("host model, %u ns per EXI byte\n", EXI_BYTE_NS);
+    report("read, first data", read_first, READS, budget_us);
+    report("read, core 1 cpu", read_cpu, READS, budget_us);
+    report("read", read_wall, READS, 0);
+    report("write", write_wall, WRITES, 0);
+    report("erase", erase_wall, ERASES, 0);
+    printf("%u bytes on the bus, %u with the card idle\n", stats.bytes, stats.tx_idle);
+
+    sim_fw_cleanup();
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+* The MMCE file commands against a host directory. Core 0 runs
+* gc_mmceman_fs_task on its own thread, the test is core 1 and goes through
+* the same calls the command handlers make: the request handoff, both chunk
+* streams, ending a stream with the next command and the descriptor checks.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmceman/gc_mmceman_fs_commands.h"
+#include "sd.h"
+
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define TEST_PATH   "/.mmce_fs_test"
+#define TEST_SIZE   (2 * MMCEMAN_FS_CHUNK_SIZE + 276)
+#define FS_MAX_FDS  16      /* descriptors the commands hand out */
+#define WAIT_US     2000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+static uint8_t test_byte(uint32_t i) {
+    return (uint8_t)(i * 7 + (i >> 8));
+}
+
+static void core0_main(void) {
+    for (;;) {
+        gc_mmceman_fs_task();
+        sim_yield();
+    }
+}
+
+/* what mc_fs_wait_result waits for before it pulls INT */
+static int32_t result(void) {
+    uint64_t deadline = sim_now_us() + WAIT_US;
+    while (gc_mmceman_fs_busy()) {
+        CHECK(sim_now_us() < deadline);
+        sim_yield();
+    }
+    return gc_mmceman_fs_result();
+}
+
+static int32_t fs_open(const char *path, uint8_t flags) {
+    gc_mmceman_fs_open(flags, path);
+    return result();
+}
+
+static int32_t fs_stat(const char *path) {
+    gc_mmceman_fs_stat(path);
+    return result();
+}
+
+static uint8_t *next_chunk(uint16_t *length) {
+    uint64_t deadline = sim_now_us() + WAIT_US;
+    uint8_t *data;
+    while ((data = gc_mmceman_fs_read_chunk(length)) == NULL) {
+        CHECK(sim_now_us() < deadline);
+        sim_yield();
+    }
+    return data;
+}
+
+static uint32_t read_stream(uint8_t fd, uint32_t length, uint32_t offset) {
+    uint32_t got = 0;
+    uint16_t chunk;
+    uint8_t *data;
+
+    gc_mmceman_fs_read_start(fd, length);
+    while ((data = next_chunk(&chunk)) != NULL && chunk) {
+        for (uint16_t i = 0; i < chunk; i++)
+            CHECK(data[i] == test_byte(offset + got + i));
+        got += chunk;
+        gc_mmceman_fs_read_release();
+    }
+    CHECK(result() == (int32_t)got);
+    return got;
+}
+
+static void write_stream(uint8_t fd, uint32_t length) {
+    gc_mmceman_fs_write_start(fd, length);
+    for (uint32_t pos = 0; pos < length; pos += MMCEMAN_FS_CHUNK_SIZE) {
+        uint64_t deadline = sim_now_us() + WAIT_US;
+        while (!gc_mmceman_fs_write_ready()) {
+            CHECK(sim_now_us() < deadline);
+            sim_yield();
+        }
+        /* the whole buffer is filled, core 0 must only write what was announced */
+        uint8_t *buf = gc_mmceman_fs_write_buffer();
+        for (uint32_t i = 0; i < MMCEMAN_FS_CHUNK_SIZE; i++)
+            buf[i] = test_byte(pos + i);
+        gc_mmceman_fs_write_chunk();
+    }
+}
+
+static void test_streams(void) {
+    int32_t fd = fs_open(TEST_PATH, MMCEMAN_FS_O_READ | MMCEMAN_FS_O_WRITE | MMCEMAN_FS_O_CREATE | MMCEMAN_FS_O_TRUNC);
+    CHECK(fd >= 0 && fd < FS_MAX_FDS);
+
+    write_stream((uint8_t)fd, TEST_SIZE);
+    CHECK(result() == TEST_SIZE);
+
+    /* asking for more than there is ends the stream at the end of the file */
+    gc_mmceman_fs_seek((uint8_t)fd, 0, SEEK_SET);
+    CHECK(result() == 0);
+    CHECK(read_stream((uint8_t)fd, 4 * MMCEMAN_FS_CHUNK_SIZE, 0) == TEST_SIZE);
+    CHECK(read_stream((uint8_t)fd, MMCEMAN_FS_CHUNK_SIZE, TEST_SIZE) == 0);
+
+    /* odd offsets and lengths, the stream stops after the requested bytes */
+    gc_mmceman_fs_seek((uint8_t)fd, 100, SEEK_SET);
+    CHECK(result() == 100);
+    CHECK(read_stream((uint8_t)fd, 700, 100) == 700);
+
+    /* the next command ends a stream the cube walked away from */
+    uint16_t chunk;
+    gc_mmceman_fs_seek((uint8_t)fd, 0, SEEK_SET);
+    CHECK(result() == 0);
+    gc_mmceman_fs_read_start((uint8_t)fd, TEST_SIZE);
+    next_chunk(&chunk);
+    CHECK(chunk == MMCEMAN_FS_CHUNK_SIZE);
+    gc_mmceman_fs_read_release();
+    gc_mmceman_fs_seek((uint8_t)fd, 0, SEEK_CUR);
+    CHECK(gc_mmceman_fs_read_ready());
+    CHECK(result() > 0);
+
+    /* a path command too, the path only replaces the old one once the stream is over */
+    gc_mmceman_fs_read_start((uint8_t)fd, TEST_SIZE);
+    CHECK(fs_stat(TEST_PATH) == 0);
+    CHECK(gc_mmceman_fs_read_ready());
+    CHECK(gc_mmceman_fs_entry()->type == 0);
+    CHECK(gc_mmceman_fs_entry()->size == TEST_SIZE);
+    CHECK(strcmp(gc_mmceman_fs_entry()->name, TEST_PATH + 1) == 0);
+
+    gc_mmceman_fs_close((uint8_t)fd);
+    CHECK(result() == 0);
+    gc_mmceman_fs_close((uint8_t)fd);
+    CHECK(result() == -1);
+}
+
+/* only descriptors opened through the commands, and never past the table */
+static void test_bad_fds(void) {
+    int32_t fd = fs_open(TEST_PATH, MMCEMAN_FS_O_READ);
+    CHECK(fd >= 0);
+
+    const uint8_t bad_fds[] = { (uint8_t)((fd + 1) % FS_MAX_FDS), FS_MAX_FDS, 0xFF };
+    for (size_t i = 0; i < sizeof(bad_fds) / sizeof(bad_fds[0]); i++) {
+        uint8_t bad = bad_fds[i];
+        uint16_t chunk;
+
+        gc_mmceman_fs_seek(bad, 0, SEEK_SET);
+        CHECK(result() == -1);
+        gc_mmceman_fs_readdir(bad);
+        CHECK(result() == -1);
+        gc_mmceman_fs_read_start(bad, MMCEMAN_FS_CHUNK_SIZE);
+        CHECK(result() == -1);
+        CHECK(next_chunk(&chunk) != NULL && chunk == 0);
+        gc_mmceman_fs_write_start(bad, MMCEMAN_FS_CHUNK_SIZE);
+        gc_mmceman_fs_write_chunk();
+        CHECK(result() == -1);
+        CHECK(gc_mmceman_fs_write_ready());
+        gc_mmceman_fs_close(bad);
+        CHECK(result() == -1);
+    }
+
+    gc_mmceman_fs_readdir((uint8_t)fd);
+    CHECK(result() == -1);
+    gc_mmceman_fs_close((uint8_t)fd);
+    CHECK(result() == 0);
+}
+
+static void test_readdir(void) {
+    bool seen = false;
+
+    int32_t fd = fs_open("/", MMCEMAN_FS_O_READ);
+    CHECK(fd >= 0);
+    for (;;) {
+        gc_mmceman_fs_readdir((uint8_t)fd);
+        int32_t r = result();
+        if (r != 1) {
+            CHECK(r == 0);
+            break;
+        }
+        seen |= strcmp(gc_mmceman_fs_entry()->name, TEST_PATH + 1) == 0;
+    }
+    CHECK(seen);
+    gc_mmceman_fs_close((uint8_t)fd);
+    CHECK(result() == 0);
+}
+
+/* the cube must not get at the card folders however it spells the path */
+static void test_card_home(const char *root) {
+    static const char *const refused[] = {
+        "MemoryCards/GC/Card1/Card1-1.raw",
+        "/MemoryCards/GC/Card1/Card1-1.raw",
+        "/memorycards/gc/card1/CARD1-1.RAW",
+        "MemoryCards/GC/Card1/Card1-1.jnl",
+        "MEMORYCARDS//GC/Card1/Card1-1.jnl",
+        "./MemoryCards/./GC/Card1/Card1-1.raw",
+        "/MemoryCards/GC",
+        "MemoryCards/gc/",
+        "MemoryCards/GC/Card1",
+        "MemoryCards/GC/new.bin",
+        "MemoryCards/../MemoryCards/GC/Card1/Card1-1.raw",
+    };
+    FILE *f;
+
+    CHECK((f = fopen(sim_fw_card_image(root), "wb")) != NULL);
+    fclose(f);
+    CHECK((f = fopen(sim_sd_host_path("MemoryCards/GC/Card1/Card1-1.jnl"), "wb")) != NULL);
+    fclose(f);
+
+    for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+        if (fs_open(refused[i], MMCEMAN_FS_O_READ | MMCEMAN_FS_O_WRITE | MMCEMAN_FS_O_CREATE) != -1) {
+            fprintf(stderr, "opened %s\n", refused[i]);
+            CHECK(false);
+        }
+    }
+    CHECK(!sd_exists("MemoryCards/GC/new.bin"));
+
+    /* everything around it is the cube's */
+    int32_t fd = fs_open("/MemoryCards", MMCEMAN_FS_O_READ);
+    CHECK(fd >= 0);
+    gc_mmceman_fs_close((uint8_t)fd);
+    CHECK(result() == 0);
+    fd = fs_open("/MemoryCards/GCX", MMCEMAN_FS_O_WRITE | MMCEMAN_FS_O_CREATE);
+    CHECK(fd >= 0);
+    gc_mmceman_fs_close((uint8_t)fd);
+    CHECK(result() == 0);
+}
+
+int main(void) {
+    const char *root = sim_fw_tmpdir();
+
+    sim_init();
+    sim_sd_set_root(root);
+    sim_start_core0(core0_main);
+
+    test_streams();
+    test_bad_fds();
+    test_readdir();
+    test_card_home(root);
+
+    printf("fs commands ok\n");
+    sim_fw_cleanup();
+    return 0;
+}
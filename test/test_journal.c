@@ -0,0 +1,250 @@
+/*
+* Power loss while the journal is written. Two flush passes are journaled
+* over a card image, then the journal is cut at every record boundary and in
+* the middle of records (in the header, between header and data, inside a
+* data sector) and replayed on a fresh copy of the old image. Behind the cut
+* is either an empty file or the same records of an older epoch. Whatever
+* the cut, the image has to come out as the old state or one of the
+* committed passes, and never lose a pass whose commit record made it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc_cardman.h"
+#include "gc_journal.h"
+#include "sd.h"
+
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define SECTOR          512
+#define CARD_SECTORS    128
+#define CARD_SIZE       (CARD_SECTORS * SECTOR)
+#define CARD_PATH       "card.raw"
+#define JOURNAL_PATH    "card.jnl"
+#define MAX_CUTS        512
+#define STATES          3
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+typedef struct {
+    uint32_t sector;
+    uint32_t count;
+} run_t;
+
+/* runs of each pass, the second one overwrites part of the first */
+static const run_t pass_a[] = { { 3, 1 }, { 10, GC_JOURNAL_MAX_RUN }, { 40, 5 }, { 127, 1 } };
+static const run_t pass_b[] = { { 12, 4 }, { 0, 2 }, { 64, GC_JOURNAL_MAX_RUN }, { 41, 1 } };
+
+static uint8_t states[STATES][CARD_SIZE];
+/* the same passes journaled in two epochs, the older one is what a cut leaves behind the tail */
+static uint8_t *journal, *stale;
+static size_t journal_len;
+
+/* a cut position and the state the image must have after replaying up to it */
+static uint32_t cut_pos[MAX_CUTS];
+static int cut_state[MAX_CUTS];
+static int num_cuts;
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+static void put_file(const char *path, const void *data, size_t len) {
+    FILE *f = fopen(sim_sd_host_path(path), "wb");
+    CHECK(f != NULL);
+    CHECK(fwrite(data, 1, len, f) == len);
+    fclose(f);
+}
+
+static size_t get_file(const char *path, uint8_t **data) {
+    FILE *f = fopen(sim_sd_host_path(path), "rb");
+    CHECK(f != NULL);
+    fseek(f, 0, SEEK_END);
+    size_t len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *data = malloc(len);
+    CHECK(*data != NULL);
+    CHECK(fread(*data, 1, len, f) == len);
+    fclose(f);
+    return len;
+}
+
+static void open_card(void) {
+    gc_cardman_fd = sd_open(CARD_PATH, O_RDWR);
+    CHECK(gc_cardman_fd >= 0);
+}
+
+static void close_card(void) {
+    sd_close(gc_cardman_fd);
+    gc_cardman_fd = -1;
+}
+
+static void add_cut(uint32_t pos, int state) {
+    CHECK(num_cuts < MAX_CUTS);
+    cut_pos[num_cuts] = pos;
+    cut_state[num_cuts] = state;
+    num_cuts++;
+}
+
+/*
+* Every boundary of a record and the cuts inside it, all of them leave the journal at the last commit.
+* Only the first 24 bytes of a header sector carry the header, a cut in the padding behind them is not torn.
+*/
+static void add_record_cuts(uint32_t pos, uint32_t count, int state) {
+    add_cut(pos, state);
+    add_cut(pos + 8, state);
+    add_cut(pos + 22, state);
+    for (uint32_t i = 0; i < count; i++) {
+        add_cut(pos + (1 + i) * SECTOR, state);
+        add_cut(pos + (1 + i) * SECTOR + 100, state);
+    }
+}
+
+static uint8_t sector_byte(int pass, uint32_t sector, uint32_t i) {
+    return (uint8_t)((pass + 1) * 0x35 + sector * 11 + i * 3);
+}
+
+/* journals one flush pass, the next state is the previous one with its runs on top */
+static uint32_t journal_pass(int pass, const run_t *runs, size_t num_runs, uint32_t pos) {
+    static uint8_t buf[GC_JOURNAL_MAX_RUN * SECTOR];
+
+    memcpy(states[pass + 1], states[pass], CARD_SIZE);
+    for (size_t r = 0; r < num_runs; r++) {
+        for (uint32_t s = 0; s < runs[r].count; s++)
+            for (uint32_t i = 0; i < SECTOR; i++)
+                buf[s * SECTOR + i] = sector_byte(pass, runs[r].sector + s, i);
+        memcpy(&states[pass + 1][runs[r].sector * SECTOR], buf, runs[r].count * SECTOR);
+
+        CHECK(gc_journal_append(runs[r].sector, runs[r].count, buf) == 0);
+        add_record_cuts(pos, runs[r].count, pass);
+        pos += (1 + runs[r].count) * SECTOR;
+    }
+
+    CHECK(gc_journal_commit() == 0);
+    /* only the whole commit record makes the pass count */
+    add_record_cuts(pos, 0, pass);
+    pos += SECTOR;
+    add_cut(pos, pass + 1);
+    return pos;
+}
+
+static uint32_t journal_passes(void) {
+    uint32_t pos = SECTOR;
+    pos = journal_pass(0, pass_a, sizeof(pass_a) / sizeof(pass_a[0]), pos);
+    pos = journal_pass(1, pass_b, sizeof(pass_b) / sizeof(pass_b[0]), pos);
+    return pos;
+}
+
+static void make_journal(void) {
+    uint8_t *card;
+
+    for (uint32_t i = 0; i < CARD_SIZE; i++)
+        states[0][i] = (uint8_t)(i ^ (i >> 9));
+    put_file(CARD_PATH, states[0], CARD_SIZE);
+
+    open_card();
+    gc_journal_open(JOURNAL_PATH, false);
+    CHECK(gc_journal_is_active());
+
+    /* a torn checkpoint leaves nothing to replay */
+    add_cut(0, 0);
+    add_cut(100, 0);
+    uint32_t end = journal_passes();
+
+    /* nothing was folded into the image yet */
+    close_card();
+    CHECK(get_file(CARD_PATH, &card) == CARD_SIZE);
+    CHECK(memcmp(card, states[0], CARD_SIZE) == 0);
+    free(card);
+    CHECK(get_file(JOURNAL_PATH, &stale) == end);
+
+    /* closing folds the journal in, that is the last state */
+    open_card();
+    gc_journal_close();
+    close_card();
+    CHECK(get_file(CARD_PATH, &card) == CARD_SIZE);
+    CHECK(memcmp(card, states[STATES - 1], CARD_SIZE) == 0);
+    free(card);
+
+    /* the next epoch writes the same records over the old ones */
+    int cuts = num_cuts;
+    open_card();
+    gc_journal_open(JOURNAL_PATH, false);
+    CHECK(journal_passes() == end);
+    close_card();
+    num_cuts = cuts;
+    journal_len = get_file(JOURNAL_PATH, &journal);
+    CHECK(journal_len == end);
+    CHECK(memcmp(journal, stale, end) != 0);
+    gc_journal_close();
+}
+
+static int which_state(const uint8_t *card) {
+    for (int s = 0; s < STATES; s++)
+        if (memcmp(card, states[s], CARD_SIZE) == 0)
+            return s;
+    return -1;
+}
+
+/* the old image with the journal as far as it got, then the boot that replays it */
+static void replay_cut(uint32_t cut, int expected, bool leftovers) {
+    uint8_t *cut_journal = calloc(1, journal_len);
+    uint8_t *card;
+
+    CHECK(cut_journal != NULL);
+    if (leftovers)
+        memcpy(cut_journal, stale, journal_len);
+    memcpy(cut_journal, journal, cut);
+    put_file(JOURNAL_PATH, cut_journal, journal_len);
+    put_file(CARD_PATH, states[0], CARD_SIZE);
+    free(cut_journal);
+
+    open_card();
+    gc_journal_open(JOURNAL_PATH, true);
+    close_card();
+
+    CHECK(get_file(CARD_PATH, &card) == CARD_SIZE);
+    int state = which_state(card);
+    free(card);
+    if (state != expected) {
+        fprintf(stderr, "cut at %u%s: image is state %d, expected %d\n", cut,
+                leftovers ? " before an older epoch" : "", state, expected);
+        fail();
+    }
+
+    /* the replayed journal starts over, closing must not change the image again */
+    open_card();
+    gc_journal_close();
+    close_card();
+    CHECK(get_file(CARD_PATH, &card) == CARD_SIZE);
+    CHECK(which_state(card) == expected);
+    free(card);
+}
+
+int main(void) {
+    const char *root = sim_fw_tmpdir();
+    int seen[STATES] = { 0 };
+
+    sim_init();
+    sim_sd_set_root(root);
+
+    make_journal();
+    for (int i = 0; i < num_cuts; i++) {
+        replay_cut(cut_pos[i], cut_state[i], false);
+        /* without the new checkpoint the older epoch is whole, and it was folded into the image before */
+        if (cut_pos[i] >= SECTOR)
+            replay_cut(cut_pos[i], cut_state[i], true);
+        seen[cut_state[i]]++;
+    }
+
+    printf("journal: %d cuts replayed, %d to the old image, %d to pass 1, %d to pass 2\n",
+           num_cuts, seen[0], seen[1], seen[2]);
+    free(journal);
+    free(stale);
+    sim_fw_cleanup();
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+* The card answers the cube while its image is still coming in from a slow
+* SD card. Reads run from the end of the card, which is loaded last, so they
+* hit segments that are not in PSRAM yet and have to wait for them. Every page
+* has to come back as it is in the image, and writes made during the load must
+* not be overwritten by it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gc_cardman.h"
+
+#include "cube.h"
+#include "sd_dir.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define CARD_MBIT       16
+#define CARD_SIZE       (CARD_MBIT * 1024 * 1024 / 8)
+#define EXI_BYTE_NS     500
+/* an SD card that takes 5 ms for every 8 kB chunk of the load */
+#define SD_CALL_US      500
+#define SD_SECTOR_US    300
+#define READS           48
+#define WRITES          8
+#define WAIT_US         20000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+static uint8_t image[CARD_SIZE];
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+static void make_image(const char *root) {
+    for (uint32_t i = 0; i < CARD_SIZE; i++)
+        image[i] = (uint8_t)((i * 13) ^ (i >> 9) ^ (i >> 17));
+    image[37] = 1; /* encoded card, the INT of a write comes from the alarm */
+
+    FILE *f = fopen(sim_fw_card_image(root), "wb");
+    CHECK(f != NULL);
+    CHECK(fwrite(image, 1, CARD_SIZE, f) == CARD_SIZE);
+    fclose(f);
+}
+
+static bool image_on_sd_matches(const char *path) {
+    static uint8_t sd[CARD_SIZE];
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+    size_t n = fread(sd, 1, CARD_SIZE, f);
+    fclose(f);
+    return n == CARD_SIZE && memcmp(sd, image, CARD_SIZE) == 0;
+}
+
+static void check_page(uint32_t addr) {
+    uint8_t page[CUBE_PAGE_SIZE];
+
+    CHECK(cube_read(addr, page, NULL));
+    if (memcmp(page, &image[addr], CUBE_PAGE_SIZE) != 0) {
+        fprintf(stderr, "page at %06x differs from the image\n", addr);
+        fail();
+    }
+}
+
+/* the middle of the card, which is still on its way while the cube reads the end */
+static uint32_t write_addr(uint32_t i) {
+    return CARD_SIZE / 2 + i * 0x10000u + (i % 4) * CUBE_WRITE_SIZE;
+}
+
+int main(void) {
+    uint32_t loading_reads = 0, waiting_reads = 0, loading_writes = 0;
+    uint8_t data[CUBE_WRITE_SIZE];
+
+    const char *root = sim_fw_tmpdir();
+    sim_settings.cardsize = CARD_MBIT;
+    make_image(root);
+    sim_sd_set_delay(SD_CALL_US, SD_SECTOR_US);
+    sim_fw_boot(root);
+    sim_exi_set_byte_ns(EXI_BYTE_NS);
+    CHECK(sim_fw_wait_ready(WAIT_US));
+
+    CHECK(cube_probe(NULL));
+    CHECK(cube_unlock());
+    CHECK(cube_int_enable(true));
+
+    /* reads back to front, a page in every 43 kB or so, with writes into the middle between them */
+    for (uint32_t i = 0; i < READS; i++) {
+        uint32_t addr = (CARD_SIZE - (i + 1) * 0xA900u) & ~(uint32_t)(CUBE_PAGE_SIZE - 1);
+        loading_reads += !gc_cardman_is_idle();
+        waiting_reads += !gc_cardman_is_segment_available(addr / CUBE_PAGE_SIZE);
+        check_page(addr);
+
+        if (i % (READS / WRITES))
+            continue;
+        uint32_t w = i / (READS / WRITES);
+        addr = write_addr(w);
+        for (uint32_t j = 0; j < CUBE_WRITE_SIZE; j++)
+            data[j] = (uint8_t)(0xA5 ^ (w * 31 + j));
+        loading_writes += !gc_cardman_is_idle();
+        CHECK(cube_write(addr, data, NULL));
+        memcpy(&image[addr], data, CUBE_WRITE_SIZE);
+        check_page(addr & ~(uint32_t)(CUBE_PAGE_SIZE - 1));
+    }
+
+    printf("%u of %u reads and %u of %u writes while the image was loading, %u reads of pages not in yet\n",
+           loading_reads, READS, loading_writes, WRITES, waiting_reads);
+    /* without that the test has not shown anything, how many depends on how busy the host is */
+    CHECK(waiting_reads >= READS / 8);
+    CHECK(loading_writes > 0);
+
+    uint64_t deadline = sim_now_us() + WAIT_US;
+    while (!gc_cardman_is_idle()) {
+        CHECK(sim_now_us() < deadline);
+        sim_yield();
+    }
+
+    /* once loaded, the whole card and then the SD image have what the cube left */
+    for (uint32_t addr = 0; addr < CARD_SIZE; addr += 0x4000u + CUBE_PAGE_SIZE)
+        check_page(addr);
+    for (uint32_t i = 0; i < WRITES; i++)
+        check_page(write_addr(i) & ~(uint32_t)(CUBE_PAGE_SIZE - 1));
+
+    sim_sd_set_delay(0, 0);
+    deadline = sim_now_us() + WAIT_US;
+    while (!image_on_sd_matches(sim_fw_card_image(root)))
+        CHECK(sim_now_us() < deadline);
+
+    sim_fw_cleanup();
+    return 0;
+}
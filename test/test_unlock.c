@@ -0,0 +1,229 @@
+/*
+* The unlock cipher. The card LFSR is advanced through a jump table, these
+* are the vectors that hold it to the bit-serial LFSR it replaced: first the
+* two LFSRs directly, for step counts around every level of the table and
+* beyond its last one, then whole handshakes with the cube, where the key
+* words the card answers with are checked against the serial cipher.
+*
+* Also prints what the LFSR advances of one handshake cost, serial and with
+* the table, and how long the card takes to its first key word. Host time of
+* a model, only good for comparing two builds on the same machine.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "card_emu/gc_unlock.h"
+#include "gc_cardman.h"
+
+#include "cube.h"
+#include "sim_fw.h"
+#include "sim_hw.h"
+
+#define CARD_SIZE       0x80000
+#define EXI_BYTE_NS     500
+#define VECTORS         4096
+#define MAX_STEPS       9000
+#define HANDSHAKES      64
+#define TIMING_ROUNDS   2000
+#define WAIT_US         20000000
+
+#define CHECK(x) do { if (!(x)) { fprintf(stderr, "FAIL %s:%u: %s\n", __FILE__, __LINE__, #x); fail(); } } while (0)
+
+static uint8_t image[CARD_SIZE];
+static uint32_t rng = 0x2545F491;
+static volatile uint32_t sink;
+
+static void fail(void) {
+    sim_fw_cleanup();
+    exit(1);
+}
+
+/* xorshift32 */
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* the bit-serial LFSR the table replaces, one step per bit */
+static uint32_t exnor_serial(uint32_t a, uint32_t b) {
+    for (uint32_t c = 0; c < b; c++) {
+        uint32_t r3 = ~((a << 23) ^ (a << 15) ^ a ^ (a << 7));
+        a = (a << 1) | ((r3 >> 30) & 0x02);
+    }
+    return a;
+}
+
+static uint32_t exnor_1st_serial(uint32_t a, uint32_t b) {
+    for (uint32_t c = 0; c < b; c++) {
+        uint32_t r3 = ~((a >> 23) ^ (a >> 15) ^ a ^ (a >> 7));
+        a = (a >> 1) | ((r3 << 30) & 0x40000000);
+    }
+    return a;
+}
+
+static uint32_t reverse32(uint32_t a) {
+    uint32_t r = 0;
+    for (int i = 0; i < 32; i++, a >>= 1)
+        r = (r << 1) | (a & 1);
+    return r;
+}
+
+/* init_cipher and update_cipher of the card, on the serial LFSR */
+static uint32_t cipher_init(uint32_t offset, uint32_t length) {
+    uint32_t val = exnor_1st_serial(offset, (length << 3) + 1);
+    uint32_t r3 = ~((val >> 23) ^ (val >> 15) ^ val ^ (val >> 7));
+    return reverse32(val | (r3 << 31));
+}
+
+static uint32_t cipher_update(uint32_t cipher, uint32_t count) {
+    uint32_t val = exnor_serial(cipher, count);
+    uint32_t r3 = ~((val << 23) ^ (val << 15) ^ val ^ (val << 7));
+    return val | (r3 >> 31);
+}
+
+static void check_lfsr(uint32_t a, uint32_t b) {
+    if ((exnor(a, b) != exnor_serial(a, b)) || (exnor_1st(a, b) != exnor_1st_serial(a, b))) {
+        fprintf(stderr, "LFSR differs from the serial one for a=%08x b=%u\n", a, b);
+        fail();
+    }
+}
+
+static void test_lfsr(void) {
+    /* all-zero and all-one states, and every count around a power of two up to past the last level */
+    static const uint32_t states[] = { 0, 0xFFFFFFFF, 1, 0x80000000 };
+
+    for (uint32_t bit = 0; bit < 14; bit++) {
+        for (uint32_t d = 0; d < 3; d++) {
+            uint32_t b = (1u << bit) + d - 1;
+            for (size_t i = 0; i < sizeof(states) / sizeof(states[0]); i++)
+                check_lfsr(states[i], b);
+            check_lfsr(next_random(), b);
+        }
+    }
+    for (uint32_t i = 0; i < VECTORS; i++) {
+        uint32_t a = next_random();
+        check_lfsr(a, next_random() % MAX_STEPS);
+    }
+}
+
+static void make_image(const char *root) {
+    for (uint32_t i = 0; i < CARD_SIZE; i++)
+        image[i] = (uint8_t)((i * 7) ^ (i >> 9));
+    image[37] = 1;
+
+    FILE *f = fopen(sim_fw_card_image(root), "wb");
+    CHECK(f != NULL);
+    CHECK(fwrite(image, 1, CARD_SIZE, f) == CARD_SIZE);
+    fclose(f);
+}
+
+/* the serial and the time stamp the card builds its flash ID from are in the header */
+static void expected_keys(uint32_t offset, uint32_t length, uint32_t key[CUBE_UNLOCK_KEY_WORDS]) {
+    uint8_t flash_id[12];
+    uint64_t rand = 0;
+
+    for (int i = 12; i < 20; i++)
+        rand = (rand << 8) | image[i];
+    for (int i = 0; i < 12; i++) {
+        rand = ((rand * 0x41c64e6dULL) + 0x3039ULL) >> 16;
+        flash_id[i] = (uint8_t)(image[i] - (uint8_t)rand);
+        rand = (((rand * 0x41c64e6dULL) + 0x3039ULL) >> 16) & 0x7fff;
+    }
+
+    uint32_t cipher = cipher_init(offset, length);
+    for (int i = 0; i < CUBE_UNLOCK_KEY_WORDS; i++) {
+        uint32_t word = 0;
+        /* the cube's challenge words are zero */
+        if (i < 3)
+            word = ((uint32_t)flash_id[i * 4] << 24) | (flash_id[i * 4 + 1] << 16) | (flash_id[i * 4 + 2] << 8) | flash_id[i * 4 + 3];
+        key[i] = word ^ cipher;
+        cipher = cipher_update(cipher, 32);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* lengths from 4 to 32 bytes as the IPL sends them, on each of the offsets that start a new unlock */
+static void test_handshakes(uint32_t latency) {
+    uint32_t first_us[HANDSHAKES], cpu_us[HANDSHAKES];
+
+    for (uint32_t i = 0; i < HANDSHAKES; i++) {
+        uint32_t key[CUBE_UNLOCK_KEY_WORDS], want[CUBE_UNLOCK_KEY_WORDS];
+        cube_timing_t timing;
+        uint32_t offset = 0x7FEC8000u + (i % 8) * 0x1000u;
+        uint32_t length = 4 + (i * 5) % 29;
+
+        CHECK(cube_unlock_keys(offset, length, key, &timing));
+        expected_keys(offset, length, want);
+        for (int w = 0; w < CUBE_UNLOCK_KEY_WORDS; w++) {
+            if (key[w] != want[w]) {
+                fprintf(stderr, "offset %08x length %u: key word %d is %08x, expected %08x\n", offset, length, w,
+                        key[w], want[w]);
+                fail();
+            }
+        }
+        first_us[i] = timing.first_data_us;
+        cpu_us[i] = timing.core1_cpu_us;
+    }
+
+    qsort(first_us, HANDSHAKES, sizeof(first_us[0]), cmp_u32);
+    qsort(cpu_us, HANDSHAKES, sizeof(cpu_us[0]), cmp_u32);
+    printf("unlock: %u handshakes, first key word after median %u max %u us, budget %u us (%u bytes), "
+           "core 1 median %u us\n", HANDSHAKES, first_us[HANDSHAKES / 2], first_us[HANDSHAKES - 1],
+           latency * EXI_BYTE_NS / 1000, latency, cpu_us[HANDSHAKES / 2]);
+}
+
+/* the advances of one handshake with the longest first message: init, four key words and the closing one */
+static uint32_t advance_ns(uint32_t (*lfsr)(uint32_t, uint32_t), uint32_t (*lfsr_1st)(uint32_t, uint32_t),
+                           uint32_t latency) {
+    uint64_t start = sim_now_us();
+    for (uint32_t i = 0; i < TIMING_ROUNDS; i++) {
+        uint32_t a = lfsr_1st(i, (32 << 3) + 1);
+        for (int w = 0; w < CUBE_UNLOCK_KEY_WORDS - 1; w++)
+            a = lfsr(a, 32);
+        sink = lfsr(a, ((8 + latency) << 3) + 1);
+    }
+    return (uint32_t)((sim_now_us() - start) * 1000 / TIMING_ROUNDS);
+}
+
+int main(void) {
+    uint32_t id;
+
+    const char *root = sim_fw_tmpdir();
+    make_image(root);
+    sim_fw_boot(root);
+    sim_exi_set_byte_ns(EXI_BYTE_NS);
+    CHECK(sim_fw_wait_ready(WAIT_US));
+
+    /* the table is built by the time the card answers */
+    CHECK(cube_probe(&id));
+    test_lfsr();
+    printf("unlock LFSR: %u vectors match the serial one\n", VECTORS);
+
+    uint32_t latency = cube_id_latency(id);
+    uint32_t serial_ns = advance_ns(exnor_serial, exnor_1st_serial, latency);
+    uint32_t table_ns = advance_ns(exnor, exnor_1st, latency);
+    printf("unlock LFSR advances of a handshake: serial %u ns, jump table %u ns\n", serial_ns, table_ns);
+
+    /* the header has to be in PSRAM before the card can answer with the serial */
+    uint64_t deadline = sim_now_us() + WAIT_US;
+    while (!gc_cardman_is_idle()) {
+        CHECK(sim_now_us() < deadline);
+        sim_yield();
+    }
+    test_handshakes(latency);
+
+    /* unlocked again by the last one, reads go on */
+    uint8_t page[CUBE_PAGE_SIZE];
+    CHECK(cube_read(0x2000, page, NULL));
+    CHECK(memcmp(page, &image[0x2000], CUBE_PAGE_SIZE) == 0);
+
+    sim_fw_cleanup();
+    return 0;
+}